@@ -0,0 +1,192 @@
+//! Benchmarks for every stage of the document pipeline, on generated documents.
+//!
+//! ```sh
+//! cargo bench --features r-compiler,r-dom,r-render -- --save-baseline main
+//! # ...make a change...
+//! cargo bench --features r-compiler,r-dom,r-render -- --baseline main
+//! ```
+//!
+//! Criterion keeps the saved baselines in `target/criterion`.
+
+use std::{fmt::Write as _, fs, path::PathBuf};
+
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion};
+
+use project_a::{
+  compiler::{self, Diagnostic, Level},
+  dom::{CompiledDocument, Dirty},
+  render,
+};
+
+/// (elements, rules) pairs, from a small screen to a very large dashboard.
+const SIZES: &[(usize, usize)] = &[(1_000, 100), (10_000, 1_000), (100_000, 10_000)];
+
+/// Children per element, the generated tree is a complete tree in breadth first order.
+const FANOUT: usize = 8;
+
+const WIDTH: f32 = 1920.0;
+const HEIGHT: f32 = 1080.0;
+
+/// Fails the benchmark on errors, the generated documents should always compile.
+struct Reporter;
+
+impl compiler::DiagnosticReporter for Reporter {
+  type FileId = ();
+
+  fn add_file(&mut self, _: String, _: String) {}
+
+  fn add_diagnostic(&mut self, diagnostic: Diagnostic<()>) {
+    if let Level::Bug | Level::Error = diagnostic.min_level {
+      panic!("{}", diagnostic);
+    }
+  }
+
+  fn get_position(&mut self, _: &(), _: usize, _: usize) -> usize {
+    0
+  }
+
+  fn get_line(&mut self, _: &(), _: usize) -> usize {
+    0
+  }
+
+  fn checkpoint(&mut self) -> Result<(), ()> {
+    Ok(())
+  }
+}
+
+fn write_element(out: &mut String, index: usize, elements: usize, rules: usize) {
+  write!(out, "<Unstyled class=\"c{} r{}\"", index % rules, index % FANOUT).unwrap();
+  if index % 100 == 0 || index == elements - 1 {
+    write!(out, " id=\"n{}\"", index).unwrap();
+  }
+
+  let first_child = index * FANOUT + 1;
+  if first_child >= elements {
+    out.push_str("/>");
+    return;
+  }
+
+  out.push('>');
+  for child in first_child..(first_child + FANOUT).min(elements) {
+    write_element(out, child, elements, rules);
+  }
+  out.push_str("</Unstyled>");
+}
+
+/// Writes a `.frame` document with `elements` elements and a stylesheet with `rules` rules
+/// next to it, and returns the path of the document.
+///
+/// The rules are a mix of class, id, descendant and sibling selectors, so every index
+/// bucket and the sibling sensitive paths get exercised.
+fn generate(elements: usize, rules: usize) -> PathBuf {
+  let dir = std::env::temp_dir().join("frameui-bench");
+  fs::create_dir_all(&dir).unwrap();
+
+  let mut css = String::new();
+  for i in 0..rules {
+    let selector = match i % 4 {
+      0 => format!(".c{}", i),
+      1 => format!("#n{}", i * 100),
+      2 => format!(".r{} .c{}", i % FANOUT, i),
+      _ => format!(".r0 + .c{}", i),
+    };
+    writeln!(
+      css,
+      "{} {{ width: {}px; height: 10px; background-color: rgb({}, 0, 0); }}",
+      selector,
+      i % 50,
+      i % 256
+    )
+    .unwrap();
+  }
+
+  let style = dir.join(format!("{}-{}.css", elements, rules));
+  fs::write(&style, css).unwrap();
+
+  let mut frame = String::new();
+  write!(
+    frame,
+    "<Frame><Head><Style src=\"{}\"/></Head><Body>",
+    style.file_name().unwrap().to_str().unwrap()
+  )
+  .unwrap();
+  write_element(&mut frame, 0, elements, rules);
+  frame.push_str("</Body></Frame>");
+
+  let path = dir.join(format!("{}-{}.frame", elements, rules));
+  fs::write(&path, frame).unwrap();
+  path
+}
+
+fn compile(path: &PathBuf) -> CompiledDocument {
+  compiler::compile(path, &mut Reporter).unwrap()
+}
+
+/// Compiles the document and runs a first style pass, like the first frame would.
+fn styled(path: &PathBuf) -> CompiledDocument {
+  let doc = compile(path);
+  doc.compute_style(WIDTH, HEIGHT, yoga::Direction::LTR);
+  doc
+}
+
+fn mark_all_dirty(doc: &CompiledDocument) {
+  for el in doc.tree.write().unwrap().nodes_mut() {
+    el.mark_dirty(Dirty::all());
+  }
+}
+
+fn label(elements: usize, rules: usize) -> String {
+  format!("{}x{}", elements, rules)
+}
+
+fn bench_pipeline(c: &mut Criterion) {
+  for &(elements, rules) in SIZES {
+    let path = generate(elements, rules);
+    let id = label(elements, rules);
+
+    let mut group = c.benchmark_group("pipeline");
+    if elements >= 10_000 {
+      group.sample_size(10);
+    }
+
+    group.bench_function(BenchmarkId::new("compile", &id), |b| b.iter(|| compile(&path)));
+
+    let doc = styled(&path);
+    let saved = doc.save();
+
+    group.bench_function(BenchmarkId::new("save", &id), |b| b.iter(|| doc.save()));
+    group.bench_function(BenchmarkId::new("load", &id), |b| {
+      b.iter(|| CompiledDocument::load(black_box(&saved)))
+    });
+
+    group.bench_function(BenchmarkId::new("init_yoga", &id), |b| {
+      b.iter_batched(|| doc.reset_yoga(), |()| doc.init_yoga(), BatchSize::PerIteration)
+    });
+
+    group.bench_function(BenchmarkId::new("compute_style/full", &id), |b| {
+      b.iter_batched(
+        || mark_all_dirty(&doc),
+        |()| doc.compute_style(WIDTH, HEIGHT, yoga::Direction::LTR),
+        BatchSize::PerIteration,
+      )
+    });
+
+    group.bench_function(BenchmarkId::new("compute_style/clean", &id), |b| {
+      b.iter(|| doc.compute_style(WIDTH, HEIGHT, yoga::Direction::LTR))
+    });
+
+    let last = format!("#n{}", elements - 1);
+    group.bench_function(BenchmarkId::new("query_selector", &id), |b| {
+      b.iter(|| doc.query_selector(black_box(&last)))
+    });
+
+    group.bench_function(BenchmarkId::new("display_list", &id), |b| {
+      b.iter(|| render::build_display_list(&doc, WIDTH, HEIGHT))
+    });
+
+    group.finish();
+  }
+}
+
+criterion_group!(benches, bench_pipeline);
+criterion_main!(benches);
@@ -22,7 +22,7 @@ except ImportError:
 
 def main():
   parser = argparse.ArgumentParser('build tool for project-a')
-  parser.add_argument('--module', action='append', choices=['event', 'render'])
+  parser.add_argument('--module', action='append', choices=['dom', 'event', 'render'])
   parser.add_argument('--out-dir')
   args = parser.parse_args()
 
@@ -1,2 +1,3 @@
+#define MODULE_DOM
 #define MODULE_EVENT
 #define MODULE_RENDER
@@ -8,8 +8,42 @@
 
 #define STRUCTURE_VERSION 0
 
+#if defined(MODULE_RENDER)
+/**
+ *module=render
+ */
+typedef enum {
+  /**
+   * Only composites the last frame, without looking at the document.
+   */
+  Composite,
+  /**
+   * Restyles the document and rebuilds the whole display list.
+   */
+  Full,
+  /**
+   * Restyles the document and only sends what changed since the last frame,
+   * reusing the retained display list when layout didn't change.
+   */
+  Incremental,
+} RenderMode;
+#endif
+
 typedef struct CompiledDocument CompiledDocument;
 
+#if defined(MODULE_DOM)
+/**
+ * A batch of changes to a document, applied all at once by `CompiledDocument::commit`.
+ *
+ * Building a transaction doesn't touch the document, so it can be filled in on any
+ * thread without blocking rendering. Committing takes each of the document's locks once,
+ * and only marks the elements that were changed (and whatever selectors can see them
+ * from) as dirty, so the next style pass only restyles those.
+ *module=dom
+ */
+typedef struct Transaction Transaction;
+#endif
+
 typedef struct EventHandler_CWindowing EventHandler_CWindowing;
 
 #if defined(MODULE_RENDER)
@@ -19,6 +53,18 @@ typedef struct EventHandler_CWindowing EventHandler_CWindowing;
 typedef struct Gl Gl;
 #endif
 
+#if defined(MODULE_RENDER)
+/**
+ * Pixels being copied out of an offscreen frame.
+ *
+ * The copy runs on the GPU in the background, so several snapshots can be in flight
+ * while the next document is styled and laid out. It must be used and dropped on
+ * the thread (and with the GL context) of the renderer that created it.
+ *module=render
+ */
+typedef struct Readback Readback;
+#endif
+
 /**
  *module=render
  */
@@ -31,6 +77,56 @@ typedef struct Renderer Renderer;
 typedef EventHandler_CWindowing EventHandler;
 #endif
 
+#if defined(MODULE_DOM)
+/**
+ * The memory a `CompiledDocument` holds on to, in bytes, see `CompiledDocument::memory_report`.
+ *
+ * Sizes are what the document allocated rather than what the allocator handed out for it,
+ * so the process' heap is usually somewhat larger than the total.
+ *module=dom
+ */
+typedef struct {
+  /**
+   * Elements in the tree, not counting the free slots of removed subtrees.
+   */
+  uint32_t nodes;
+  /**
+   * The tree's nodes, and the classes and rules of each element.
+   */
+  uint64_t tree;
+  /**
+   * Strings the document copied into its own memory.
+   */
+  uint64_t strings;
+  /**
+   * Strings read in place from the file or binary the document was loaded from. These are
+   * pages the process maps rather than heap, and can be evicted while the document isn't used.
+   */
+  uint64_t mapped_strings;
+  /**
+   * The stylesheet's rules, parsed selectors, rule index and merged deltas.
+   */
+  uint64_t stylesheet;
+  /**
+   * Script attributes that are compiled, see `CompiledDocument::trim`.
+   */
+  uint32_t compiled_scripts;
+  /**
+   * The script engine, scope and compiled scripts. Rhai doesn't say how much it allocates,
+   * so this only counts the structures themselves and not what they point to.
+   */
+  uint64_t scripts;
+  /**
+   * The elements' yoga nodes.
+   */
+  uint64_t yoga;
+  /**
+   * The boxes of the last layout pass, see `LayoutCache`.
+   */
+  uint64_t layout;
+} DocumentMemoryReport;
+#endif
+
 #if defined(MODULE_RENDER)
 /**
  *module=render
@@ -41,6 +137,175 @@ typedef struct {
 } DeviceSize;
 #endif
 
+#if defined(MODULE_RENDER)
+/**
+ * Counters for the most recent frame.
+ *
+ * The style and display list counters describe the last scene that was built,
+ * the WebRender counters the last frame that was composited.
+ *module=render
+ */
+typedef struct {
+  /**
+   * Elements whose style was recomputed.
+   */
+  uint32_t nodes_restyled;
+  /**
+   * Elements that reused a sibling's style instead of matching selectors.
+   */
+  uint32_t styles_shared;
+  /**
+   * Candidate rules that were matched against an element.
+   */
+  uint32_t rules_tested;
+  /**
+   * Candidate rules that matched.
+   */
+  uint32_t rules_matched;
+  /**
+   * Script attributes that were evaluated.
+   */
+  uint32_t script_evals;
+  /**
+   * Time spent in yoga, in microseconds.
+   */
+  uint64_t layout_us;
+  /**
+   * Time spent building the display list (or patching its colors), in microseconds.
+   */
+  uint64_t display_list_us;
+  /**
+   * Display items pushed, `0` if the retained display list was reused.
+   */
+  uint32_t display_items;
+  /**
+   * Elements that were skipped along with everything below them because they couldn't be seen.
+   */
+  uint32_t subtrees_culled;
+  /**
+   * Time WebRender spent on the CPU, in microseconds.
+   */
+  uint64_t webrender_cpu_us;
+  /**
+   * Time WebRender spent on the GPU, in microseconds. Only measured while profiling is enabled.
+   */
+  uint64_t webrender_gpu_us;
+  /**
+   * Draw calls WebRender issued.
+   */
+  uint32_t draw_calls;
+} FrameStats;
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * The memory a `Renderer` and WebRender hold on to, in bytes, see `Renderer::memory_report`.
+ *
+ * The CPU sizes are what the allocator handed out, the GPU sizes are what WebRender asked
+ * the driver for. Neither includes the documents, see `CompiledDocument::memory_report`.
+ *module=render
+ */
+typedef struct {
+  /**
+   * The display lists of the scenes of every view.
+   */
+  uint64_t display_lists;
+  /**
+   * Images and rasterized blobs.
+   */
+  uint64_t images;
+  uint64_t fonts;
+  /**
+   * GPU cache bookkeeping and its copy on the CPU.
+   */
+  uint64_t gpu_cache;
+  /**
+   * Clip stores, render tasks, hit testers and compiled shaders.
+   */
+  uint64_t other;
+  /**
+   * Textures of the texture cache, these are freed by `Renderer::trim`.
+   */
+  uint64_t texture_cache_textures;
+  /**
+   * Color and depth targets that frames are drawn into before they are composited.
+   */
+  uint64_t render_target_textures;
+  /**
+   * The GPU cache texture, vertex data and swap chain.
+   */
+  uint64_t other_textures;
+} RenderMemoryReport;
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Options for `Renderer_new` and `Renderer_new_offscreen`, passing null uses the defaults (all zero).
+ *module=render
+ */
+typedef struct {
+  /**
+   * A directory where compiled shader programs are kept between launches, or null to compile them every launch.
+   */
+  const char *program_cache_dir;
+  /**
+   * Compile every shader while starting up instead of the first time each one is used.
+   */
+  bool precache_shaders;
+  /**
+   * Called with `wake_up_user` from WebRender's threads when a new frame is ready, the host
+   * should then call `EventHandler_handle_empty` (or `EventHandler_needs_frame`) on its own
+   * thread, like after an event. Threaded `EventHandler`s need it to show the scenes their
+   * worker thread builds, without it they only show up with the next event.
+   *
+   * It must be safe to call from any thread, `glfwPostEmptyEvent` is an example.
+   */
+  void (*wake_up)(void *user);
+  void *wake_up_user;
+} RendererOptions;
+#endif
+
+#if defined(MODULE_EVENT)
+typedef enum {
+  Resized,
+  ScaleFactorChanged,
+  Redraw,
+  Empty,
+  PointerMoved,
+  PointerDown,
+  PointerUp,
+  PointerLeft,
+} Event_Tag;
+
+typedef struct {
+  DeviceSize size;
+} Resized_Body;
+
+typedef struct {
+  float scale;
+} ScaleFactorChanged_Body;
+
+typedef struct {
+  float x;
+  float y;
+} PointerMoved_Body;
+
+/**
+ * An event for `EventHandler_handle_events`, `tag` says which of the fields is set.
+ *
+ * Pointer positions are in device pixels of the framebuffer.
+ *module=event
+ */
+typedef struct {
+  Event_Tag tag;
+  union {
+    Resized_Body resized;
+    ScaleFactorChanged_Body scale_factor_changed;
+    PointerMoved_Body pointer_moved;
+  };
+} Event;
+#endif
+
 #if defined(MODULE_EVENT)
 /**
  *module=event
@@ -59,6 +324,97 @@ typedef const void *(*GlLoadFunc)(const char *symbol);
 extern "C" {
 #endif // __cplusplus
 
+#if defined(MODULE_DOM)
+/**
+ * Starts a batch of changes, see `Transaction_*`. Nothing changes until `CompiledDocument_commit`.
+ *module=dom,index=4
+ */
+Transaction *CompiledDocument_begin_transaction(const CompiledDocument *self) CF_SWIFT_NAME(CompiledDocument.begin_transaction(self:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Returns a new reference to the document, functions that take ownership of
+ * a document (like `EventHandler_new`) consume one reference.
+ *module=dom,index=1
+ */
+const CompiledDocument *CompiledDocument_clone(const CompiledDocument *self) CF_SWIFT_NAME(CompiledDocument.clone(self:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Applies and frees `txn`, the changes show up in the next frame.
+ *
+ * Returns false without changing anything if `txn` appends elements and another
+ * transaction appended or removed elements since it was started.
+ *module=dom,index=5
+ */
+bool CompiledDocument_commit(const CompiledDocument *self,
+                             Transaction *txn) CF_SWIFT_NAME(CompiledDocument.commit(self:txn:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Releases one reference, the document is freed with the last one.
+ *
+ * The interned class names, ids and selector names are shared by every document and are
+ * never freed. A process can intern a few million different names, after that new ones
+ * are ignored and never match a selector.
+ *module=dom,index=2
+ */
+void CompiledDocument_drop(const CompiledDocument *self) CF_SWIFT_NAME(CompiledDocument.drop(self:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Memory maps the `.cframe` file at `path` and loads it, reading its strings in place.
+ *
+ * The elements and the stylesheet are still copied into the document's own memory.
+ *
+ * Returns null if the file can't be opened or isn't a valid document.
+ * The file must not be modified while the document is alive.
+ *module=dom,index=0
+ */
+const CompiledDocument *CompiledDocument_load_mmap(const char *path) CF_SWIFT_NAME(CompiledDocument.load_mmap(path:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Measures the memory the document holds on to.
+ *module=dom,index=7
+ */
+DocumentMemoryReport CompiledDocument_memory_report(const CompiledDocument *self) CF_SWIFT_NAME(CompiledDocument.memory_report(self:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Returns the first element matching `selector`, or `UINT32_MAX` if there is none.
+ *
+ * The root element is always `0`.
+ *module=dom,index=6
+ */
+uint32_t CompiledDocument_query_selector(const CompiledDocument *self,
+                                         const char *selector) CF_SWIFT_NAME(CompiledDocument.query_selector(self:selector:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Sets the number of threads used to match styles, `0` and `1` restyle on the rendering thread.
+ *module=dom,index=3
+ */
+void CompiledDocument_set_style_threads(const CompiledDocument *self,
+                                        uint32_t threads) CF_SWIFT_NAME(CompiledDocument.set_style_threads(self:threads:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Frees compiled scripts and parsed selectors, for documents that aren't being shown.
+ * They are rebuilt the first time they are needed again.
+ *module=dom,index=8
+ */
+void CompiledDocument_trim(const CompiledDocument *self) CF_SWIFT_NAME(CompiledDocument.trim(self:));
+#endif
+
 #if defined(MODULE_EVENT)
 /**
  * This is the brief
@@ -69,6 +425,22 @@ extern "C" {
 void EventHandler_drop(EventHandler *self) CF_SWIFT_NAME(EventHandler.drop(self:));
 #endif
 
+#if defined(MODULE_EVENT)
+/**
+ * Returns the element under the pointer as of the last pointer event, like `EventHandler_hit_test`.
+ *module=event,index=11
+ */
+uint32_t EventHandler_get_hovered(EventHandler *self, uint32_t *view) CF_SWIFT_NAME(EventHandler.get_hovered(self:view:));
+#endif
+
+#if defined(MODULE_EVENT)
+/**
+ * Returns the element a button was pressed on until it is released, like `EventHandler_hit_test`.
+ *module=event,index=12
+ */
+uint32_t EventHandler_get_pressed(EventHandler *self, uint32_t *view) CF_SWIFT_NAME(EventHandler.get_pressed(self:view:));
+#endif
+
 #if defined(MODULE_EVENT)
 /**
  *module=event,index=6
@@ -83,6 +455,17 @@ void *EventHandler_get_user(EventHandler *self) CF_SWIFT_NAME(EventHandler.get_u
 void EventHandler_handle_empty(EventHandler *self) CF_SWIFT_NAME(EventHandler.handle_empty(self:));
 #endif
 
+#if defined(MODULE_EVENT)
+/**
+ * Handles `count` events and renders at most one frame afterwards, where calling
+ * `EventHandler_handle_redraw` for each redraw renders every time.
+ *module=event,index=9
+ */
+void EventHandler_handle_events(EventHandler *self,
+                                const Event *events,
+                                uintptr_t count) CF_SWIFT_NAME(EventHandler.handle_events(self:events:count:));
+#endif
+
 #if defined(MODULE_EVENT)
 /**
  *module=event,index=4
@@ -108,14 +491,58 @@ void EventHandler_handle_scale_factor_change(EventHandler *self,
 
 #if defined(MODULE_EVENT)
 /**
+ * Returns the element at `x`, `y` (in device pixels of the framebuffer), or `UINT32_MAX` if
+ * there is none, and writes the view it is in to `view` unless it is null.
+ *
+ * This uses a grid built along with the last display list, so it is cheap enough to call
+ * for every pointer move.
+ *module=event,index=10
+ */
+uint32_t EventHandler_hit_test(EventHandler *self,
+                               float x,
+                               float y,
+                               uint32_t *view) CF_SWIFT_NAME(EventHandler.hit_test(self:x:y:view:));
+#endif
+
+#if defined(MODULE_EVENT)
+/**
+ * Returns true if something changed since the last frame or WebRender has a new frame ready.
+ *
+ * Hosts can use this to decide if they need to call `EventHandler_handle_redraw`.
+ *module=event,index=8
+ */
+bool EventHandler_needs_frame(EventHandler *self) CF_SWIFT_NAME(EventHandler.needs_frame(self:));
+#endif
+
+#if defined(MODULE_EVENT)
+/**
+ * Takes ownership of `renderer` and `doc`.
+ *
+ * If `threaded` is true style, layout and display list building run on a worker thread,
+ * and the handler only composites the scene that is ready.
+ * Threaded hosts have to pass `RendererOptions::wake_up` to the renderer to
+ * find out when the next scene is ready.
  *module=event,index=0
  */
 EventHandler *EventHandler_new(Renderer *renderer,
                                const CompiledDocument *doc,
+                               bool threaded,
                                EmptyCallback swap_buffers,
                                EmptyCallback make_current,
                                EmptyCallback make_not_current,
-                               void *user) CF_SWIFT_NAME(EventHandler.new(renderer:doc:swap_buffers:make_current:make_not_current:user:));
+                               void *user) CF_SWIFT_NAME(EventHandler.new(renderer:doc:threaded:swap_buffers:make_current:make_not_current:user:));
+#endif
+
+#if defined(MODULE_EVENT)
+/**
+ * Takes ownership of `doc` and shows it from the next frame on.
+ *
+ * If only the stylesheets differ from the current document's, the current document takes
+ * them over and keeps its layout, script variables and scroll positions.
+ *module=event,index=13
+ */
+void EventHandler_set_document(EventHandler *self,
+                               const CompiledDocument *doc) CF_SWIFT_NAME(EventHandler.set_document(self:doc:));
 #endif
 
 #if defined(MODULE_EVENT)
@@ -126,6 +553,22 @@ void EventHandler_set_user(EventHandler *self,
                            void *user) CF_SWIFT_NAME(EventHandler.set_user(self:user:));
 #endif
 
+#if defined(MODULE_EVENT)
+/**
+ * Frees the caches of the renderer and the document, call it when the window is hidden.
+ *module=event,index=14
+ */
+void EventHandler_trim(EventHandler *self) CF_SWIFT_NAME(EventHandler.trim(self:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Frees functions that were loaded but never passed to `Renderer_new` or `Renderer_new_offscreen`.
+ *module=render,index=2
+ */
+void Gl_drop(Gl *self) CF_SWIFT_NAME(Gl.drop(self:));
+#endif
+
 #if defined(MODULE_RENDER)
 /**
  *module=render,index=0
@@ -140,6 +583,53 @@ Gl *Gl_load_gl(GlLoadFunc func) CF_SWIFT_NAME(Gl.load_gl(func:));
 Gl *Gl_load_gles(GlLoadFunc func) CF_SWIFT_NAME(Gl.load_gles(func:));
 #endif
 
+#if defined(MODULE_RENDER)
+/**
+ *module=render,index=0
+ */
+void Readback_drop(Readback *self) CF_SWIFT_NAME(Readback.drop(self:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ *module=render,index=1
+ */
+DeviceSize Readback_get_size(const Readback *self) CF_SWIFT_NAME(Readback.get_size(self:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Returns true if the pixels have arrived, so `Readback_read` won't block.
+ *module=render,index=2
+ */
+bool Readback_is_ready(const Readback *self) CF_SWIFT_NAME(Readback.is_ready(self:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Copies the snapshot into `buffer` as 8 bit RGBA, top row first, waiting for the GPU if needed.
+ *
+ * Returns false without copying anything if `len` is less than `width * height * 4`.
+ *module=render,index=3
+ */
+bool Readback_read(const Readback *self,
+                   uint8_t *buffer,
+                   uintptr_t len) CF_SWIFT_NAME(Readback.read(self:buffer:len:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Adds a view that shows another document in the given part of the framebuffer,
+ * drawn on top of the main view and earlier views. Returns the id for `Renderer_render_view`,
+ * the main view is `0`.
+ *module=render,index=9
+ */
+uint32_t Renderer_add_view(Renderer *self,
+                           int32_t x,
+                           int32_t y,
+                           DeviceSize size) CF_SWIFT_NAME(Renderer.add_view(self:x:y:size:));
+#endif
+
 #if defined(MODULE_RENDER)
 /**
  *module=render,index=1
@@ -149,20 +639,85 @@ void Renderer_drop(Renderer *self) CF_SWIFT_NAME(Renderer.drop(self:));
 
 #if defined(MODULE_RENDER)
 /**
+ * Returns the counters for the most recent frame.
+ *module=render,index=5
+ */
+FrameStats Renderer_get_frame_stats(const Renderer *self) CF_SWIFT_NAME(Renderer.get_frame_stats(self:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Measures what WebRender holds on to, across every view. Don't call it every frame.
+ *module=render,index=13
+ */
+RenderMemoryReport Renderer_memory_report(const Renderer *self) CF_SWIFT_NAME(Renderer.memory_report(self:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Threaded `EventHandler`s need `RendererOptions::wake_up`, see there.
  *module=render,index=0
  */
 Renderer *Renderer_new(Gl *gl,
                        float device_pixel_ratio,
-                       DeviceSize device_size) CF_SWIFT_NAME(Renderer.new(gl:device_pixel_ratio:device_size:));
+                       DeviceSize device_size,
+                       const RendererOptions *options) CF_SWIFT_NAME(Renderer.new(gl:device_pixel_ratio:device_size:options:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Creates a renderer that draws into a framebuffer instead of a window, for `Renderer_snapshot`.
+ *
+ * The GL context still has to be current, but it can be a pbuffer or surfaceless one.
+ *module=render,index=7
+ */
+Renderer *Renderer_new_offscreen(Gl *gl,
+                                 float device_pixel_ratio,
+                                 DeviceSize device_size,
+                                 const RendererOptions *options) CF_SWIFT_NAME(Renderer.new_offscreen(gl:device_pixel_ratio:device_size:options:));
 #endif
 
 #if defined(MODULE_RENDER)
 /**
+ * Does nothing if the renderer belongs to a threaded `EventHandler`, which renders on its own.
  *module=render,index=4
  */
 void Renderer_render(Renderer *self,
-                     bool inner,
-                     const CompiledDocument *doc) CF_SWIFT_NAME(Renderer.render(self:inner:doc:));
+                     RenderMode mode,
+                     const CompiledDocument *doc) CF_SWIFT_NAME(Renderer.render(self:mode:doc:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Like `Renderer_render`, but builds the scene of `view`.
+ *
+ * Returns false without rendering if there is no such view, or if it is the main view and
+ * the renderer belongs to a threaded `EventHandler`.
+ *module=render,index=11
+ */
+bool Renderer_render_view(Renderer *self,
+                          uint32_t view,
+                          RenderMode mode,
+                          const CompiledDocument *doc) CF_SWIFT_NAME(Renderer.render_view(self:view:mode:doc:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Scrolls an `overflow: scroll` element of a view to `x`, `y` and composites, `0` is the main view.
+ *
+ * Scrolling only moves things on the compositor as long as it stays within the content that
+ * was built around the last position. Returns true once it doesn't, the view then needs
+ * a `Renderer_render_view` to fill in the rest.
+ *
+ * Returns false without scrolling if there is no such view, or if it is the main view and
+ * the renderer belongs to a threaded `EventHandler`.
+ *module=render,index=12
+ */
+bool Renderer_scroll_view(Renderer *self,
+                          uint32_t view,
+                          uint32_t node,
+                          float x,
+                          float y) CF_SWIFT_NAME(Renderer.scroll_view(self:view:node:x:y:));
 #endif
 
 #if defined(MODULE_RENDER)
@@ -173,6 +728,15 @@ void Renderer_set_device_size(Renderer *self,
                               DeviceSize size) CF_SWIFT_NAME(Renderer.set_device_size(self:size:));
 #endif
 
+#if defined(MODULE_RENDER)
+/**
+ * Enables GPU timer queries, `FrameStats::webrender_gpu_us` is `0` while profiling is disabled.
+ *module=render,index=6
+ */
+void Renderer_set_profiling(Renderer *self,
+                            bool enabled) CF_SWIFT_NAME(Renderer.set_profiling(self:enabled:));
+#endif
+
 #if defined(MODULE_RENDER)
 /**
  *module=render,index=3
@@ -181,6 +745,115 @@ void Renderer_set_scale_factor(Renderer *self,
                                float scale) CF_SWIFT_NAME(Renderer.set_scale_factor(self:scale:));
 #endif
 
+#if defined(MODULE_RENDER)
+/**
+ * Moves and resizes a view added with `Renderer_add_view`.
+ *
+ * Returns false without changing anything if there is no such view, or if it is the main
+ * view and the renderer belongs to a threaded `EventHandler`.
+ *module=render,index=10
+ */
+bool Renderer_set_view_rect(Renderer *self,
+                            uint32_t view,
+                            int32_t x,
+                            int32_t y,
+                            DeviceSize size) CF_SWIFT_NAME(Renderer.set_view_rect(self:view:x:y:size:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Renders `doc` into the offscreen framebuffer and starts reading it back in the background.
+ *
+ * Several snapshots can be in flight at once, each one has to be freed with `Readback_drop`.
+ * The renderer must have been created with `Renderer_new_offscreen`.
+ *module=render,index=8
+ */
+Readback *Renderer_snapshot(Renderer *self,
+                            const CompiledDocument *doc) CF_SWIFT_NAME(Renderer.snapshot(self:doc:));
+#endif
+
+#if defined(MODULE_RENDER)
+/**
+ * Frees WebRender's caches and textures, for windows that are hidden. The GL context has to be current.
+ *module=render,index=14
+ */
+void Renderer_trim(Renderer *self) CF_SWIFT_NAME(Renderer.trim(self:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Appends an element to `parent`, returning the id it will have once the transaction is
+ * committed, or `UINT32_MAX` if `parent` doesn't exist. The new id can be used in the same transaction.
+ *module=dom,index=6
+ */
+uint32_t Transaction_append(Transaction *self, uint32_t parent) CF_SWIFT_NAME(Transaction.append(self:parent:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Frees `txn` without applying it.
+ *module=dom,index=0
+ */
+void Transaction_drop(Transaction *self) CF_SWIFT_NAME(Transaction.drop(self:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Removes `node` and its subtree. Returns false if `node` doesn't exist or is the root.
+ *module=dom,index=7
+ */
+bool Transaction_remove(Transaction *self, uint32_t node) CF_SWIFT_NAME(Transaction.remove(self:node:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ * Sets `class`, `id`, or their script versions `:class` and `:id`. A null `value` removes the attribute.
+ *
+ * Returns false if `node` or `name` is unknown, or if a script `value` doesn't compile.
+ *module=dom,index=5
+ */
+bool Transaction_set_attribute(Transaction *self,
+                               uint32_t node,
+                               const char *name,
+                               const char *value) CF_SWIFT_NAME(Transaction.set_attribute(self:node:name:value:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ *module=dom,index=3
+ */
+bool Transaction_set_variable_bool(Transaction *self,
+                                   const char *name,
+                                   bool value) CF_SWIFT_NAME(Transaction.set_variable_bool(self:name:value:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ *module=dom,index=2
+ */
+bool Transaction_set_variable_float(Transaction *self,
+                                    const char *name,
+                                    double value) CF_SWIFT_NAME(Transaction.set_variable_float(self:name:value:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ *module=dom,index=1
+ */
+bool Transaction_set_variable_int(Transaction *self,
+                                  const char *name,
+                                  int64_t value) CF_SWIFT_NAME(Transaction.set_variable_int(self:name:value:));
+#endif
+
+#if defined(MODULE_DOM)
+/**
+ *module=dom,index=4
+ */
+bool Transaction_set_variable_string(Transaction *self,
+                                     const char *name,
+                                     const char *value) CF_SWIFT_NAME(Transaction.set_variable_string(self:name:value:));
+#endif
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
@@ -1,152 +1,469 @@
+#pragma once
+
+#if __cplusplus < 201703L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#error "project-a.hpp needs C++17"
+#endif
+
 #include <cassert>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
 
 namespace frameui {
 
 namespace c_api {
 #include "project-a.h"
 }
-namespace event {
-typedef void (*EmptyCallback)(void *);
 
-class EventHandler {
+// Which modules the library was built with, for `if constexpr`. The classes of
+// a module that wasn't built aren't declared.
+#if defined(MODULE_DOM)
+inline constexpr bool kHasDom = true;
+#else
+inline constexpr bool kHasDom = false;
+#endif
+
+#if defined(MODULE_EVENT)
+inline constexpr bool kHasEvent = true;
+#else
+inline constexpr bool kHasEvent = false;
+#endif
+
+#if defined(MODULE_RENDER)
+inline constexpr bool kHasRender = true;
+#else
+inline constexpr bool kHasRender = false;
+#endif
+
+namespace detail {
+
+// Owns a pointer from the C API and frees it with `Drop`.
+//
+// Handles are move-only and exactly the size of the pointer, every method is
+// inline and calls the C function directly. A moved from handle is empty.
+template <typename T, void (*Drop)(T *)>
+class Handle {
  public:
-  EventHandler(Renderer *renderer, const CompiledDocument *doc,
-               EmptyCallback swap_buffers, EmptyCallback make_current,
-               EmptyCallback make_not_current, void *user) {
-    self = c_api::EventHandler_new(renderer, doc, swap_buffers, make_current,
-                                   make_not_current, user);
+  Handle() noexcept = default;
+  explicit Handle(T *self) noexcept : self(self) {}
+
+  Handle(const Handle &) = delete;
+  Handle &operator=(const Handle &) = delete;
+
+  Handle(Handle &&other) noexcept : self(other.TakeInternalPointer()) {}
+
+  Handle &operator=(Handle &&other) noexcept {
+    if (this != &other) {
+      Reset(other.TakeInternalPointer());
+    }
+    return *this;
   }
 
-  ~EventHandler() {
+  ~Handle() { Reset(); }
+
+  explicit operator bool() const noexcept { return self != nullptr; }
+
+  T *GetInternalPointer() const noexcept { return self; }
+
+  // Releases the pointer without freeing it.
+  T *TakeInternalPointer() noexcept {
+    T *out = self;
+    self = nullptr;
+    return out;
+  }
+
+  // Frees the current pointer (if any) and takes ownership of `ptr`.
+  void Reset(T *ptr = nullptr) noexcept {
     if (self) {
-      c_api::EventHandler_drop(self);
+      Drop(self);
     }
+    self = ptr;
+  }
+
+ protected:
+  T *self = nullptr;
+};
+
+}  // namespace detail
+
+#if defined(MODULE_DOM)
+namespace dom {
+
+using DocumentMemoryReport = c_api::DocumentMemoryReport;
+
+class CompiledDocument
+    : public detail::Handle<const c_api::CompiledDocument,
+                            c_api::CompiledDocument_drop> {
+ public:
+  using Handle::Handle;
+
+  // Returns an empty document if the file can't be loaded.
+  static CompiledDocument LoadMmap(const char *path) {
+    return CompiledDocument(c_api::CompiledDocument_load_mmap(path));
   }
 
-  void HandleResize(DeviceSize size) {
+  // Returns a new reference to the same document.
+  CompiledDocument Clone() const {
     assert(self != nullptr);
-    return c_api::EventHandler_handle_resize(self, size);
+    return CompiledDocument(c_api::CompiledDocument_clone(self));
   }
 
-  void HandleScaleFactorChange(float scale) {
+  void SetStyleThreads(uint32_t threads) const {
     assert(self != nullptr);
-    return c_api::EventHandler_handle_scale_factor_change(self, scale);
+    return c_api::CompiledDocument_set_style_threads(self, threads);
   }
 
-  void HandleRedraw() {
+  uint32_t QuerySelector(const char *selector) const {
     assert(self != nullptr);
-    return c_api::EventHandler_handle_redraw(self);
+    return c_api::CompiledDocument_query_selector(self, selector);
   }
 
-  void HandleEmpty() {
+  DocumentMemoryReport GetMemoryReport() const {
     assert(self != nullptr);
-    return c_api::EventHandler_handle_empty(self);
+    return c_api::CompiledDocument_memory_report(self);
   }
 
-  void *GetUser() {
+  // Frees what the document can rebuild, for documents that aren't shown.
+  void Trim() const {
     assert(self != nullptr);
-    return c_api::EventHandler_get_user(self);
+    return c_api::CompiledDocument_trim(self);
   }
+};
 
-  void SetUser(void *user) {
+// Collects changes to a document and applies them in one step with Commit.
+// Changes that were never committed are thrown away. The document has to
+// outlive the transaction.
+class Transaction
+    : public detail::Handle<c_api::Transaction, c_api::Transaction_drop> {
+ public:
+  explicit Transaction(const CompiledDocument &doc)
+      : Handle(c_api::CompiledDocument_begin_transaction(
+            doc.GetInternalPointer())),
+        doc(doc.GetInternalPointer()) {}
+
+  bool SetVariableInt(const char *name, int64_t value) {
     assert(self != nullptr);
-    return c_api::EventHandler_set_user(self, user);
+    return c_api::Transaction_set_variable_int(self, name, value);
   }
 
-  c_api::EventHandler *GetInternalPointer() { return self; }
+  bool SetVariableFloat(const char *name, double value) {
+    assert(self != nullptr);
+    return c_api::Transaction_set_variable_float(self, name, value);
+  }
 
-  c_api::EventHandler *TakeInternalPointer() {
-    c_api::EventHandler *out = self;
-    self = nullptr;
-    return out;
+  bool SetVariableBool(const char *name, bool value) {
+    assert(self != nullptr);
+    return c_api::Transaction_set_variable_bool(self, name, value);
+  }
+
+  bool SetVariableString(const char *name, const char *value) {
+    assert(self != nullptr);
+    return c_api::Transaction_set_variable_string(self, name, value);
+  }
+
+  bool SetAttribute(uint32_t node, const char *name, const char *value) {
+    assert(self != nullptr);
+    return c_api::Transaction_set_attribute(self, node, name, value);
+  }
+
+  uint32_t Append(uint32_t parent) {
+    assert(self != nullptr);
+    return c_api::Transaction_append(self, parent);
+  }
+
+  bool Remove(uint32_t node) {
+    assert(self != nullptr);
+    return c_api::Transaction_remove(self, node);
+  }
+
+  // Applies the changes, the transaction is empty afterwards.
+  bool Commit() {
+    assert(self != nullptr);
+    return c_api::CompiledDocument_commit(doc, TakeInternalPointer());
   }
 
  private:
-  c_api::EventHandler *self = nullptr;
+  const c_api::CompiledDocument *doc;
 };
 
-}  // namespace event
+}  // namespace dom
+#endif
 
+#if defined(MODULE_RENDER)
 namespace render {
 
-class DeviceSize {
+using DeviceSize = c_api::DeviceSize;
+using FrameStats = c_api::FrameStats;
+using GlLoadFunc = c_api::GlLoadFunc;
+using RenderMemoryReport = c_api::RenderMemoryReport;
+using RenderMode = c_api::RenderMode;
+using RendererOptions = c_api::RendererOptions;
+
+// GL functions, handed over to a Renderer when it is created.
+class Gl : public detail::Handle<c_api::Gl, c_api::Gl_drop> {
  public:
-  c_api::DeviceSize *GetInternalPointer() { return self; }
+  using Handle::Handle;
 
-  c_api::DeviceSize *TakeInternalPointer() {
-    c_api::DeviceSize *out = self;
-    self = nullptr;
-    return out;
+  static Gl LoadGl(GlLoadFunc func) { return Gl(c_api::Gl_load_gl(func)); }
+
+  static Gl LoadGles(GlLoadFunc func) { return Gl(c_api::Gl_load_gles(func)); }
+};
+
+class Readback
+    : public detail::Handle<c_api::Readback, c_api::Readback_drop> {
+ public:
+  using Handle::Handle;
+
+  DeviceSize GetSize() const {
+    assert(self != nullptr);
+    return c_api::Readback_get_size(self);
   }
 
- private:
-  c_api::DeviceSize *self = nullptr;
+  bool IsReady() const {
+    assert(self != nullptr);
+    return c_api::Readback_is_ready(self);
+  }
+
+  bool Read(uint8_t *buffer, uintptr_t len) const {
+    assert(self != nullptr);
+    return c_api::Readback_read(self, buffer, len);
+  }
 };
 
-class Gl {
+class Renderer
+    : public detail::Handle<c_api::Renderer, c_api::Renderer_drop> {
  public:
-  static Gl *LoadGl(GlLoadFunc func) {
+  using Handle::Handle;
+
+  Renderer(Gl &&gl, float device_pixel_ratio, DeviceSize device_size,
+           const RendererOptions *options = nullptr)
+      : Handle(c_api::Renderer_new(gl.TakeInternalPointer(),
+                                   device_pixel_ratio, device_size, options)) {}
+
+  static Renderer NewOffscreen(Gl &&gl, float device_pixel_ratio,
+                               DeviceSize device_size,
+                               const RendererOptions *options = nullptr) {
+    return Renderer(c_api::Renderer_new_offscreen(
+        gl.TakeInternalPointer(), device_pixel_ratio, device_size, options));
+  }
+
+  void SetDeviceSize(DeviceSize size) {
     assert(self != nullptr);
-    return c_api::Gl_load_gl(func);
+    return c_api::Renderer_set_device_size(self, size);
   }
 
-  static Gl *LoadGles(GlLoadFunc func) {
+  void SetScaleFactor(float scale) {
     assert(self != nullptr);
-    return c_api::Gl_load_gles(func);
+    return c_api::Renderer_set_scale_factor(self, scale);
   }
 
-  c_api::Gl *GetInternalPointer() { return self; }
+  void SetProfiling(bool enabled) {
+    assert(self != nullptr);
+    return c_api::Renderer_set_profiling(self, enabled);
+  }
 
-  c_api::Gl *TakeInternalPointer() {
-    c_api::Gl *out = self;
-    self = nullptr;
-    return out;
+  FrameStats GetFrameStats() const {
+    assert(self != nullptr);
+    return c_api::Renderer_get_frame_stats(self);
   }
 
- private:
-  c_api::Gl *self = nullptr;
+  RenderMemoryReport GetMemoryReport() const {
+    assert(self != nullptr);
+    return c_api::Renderer_memory_report(self);
+  }
+
+  // Frees WebRender's caches and textures while the window is hidden. The GL
+  // context has to be current.
+  void Trim() {
+    assert(self != nullptr);
+    return c_api::Renderer_trim(self);
+  }
+
+#if defined(MODULE_DOM)
+  Readback Snapshot(const dom::CompiledDocument &doc) {
+    assert(self != nullptr);
+    return Readback(c_api::Renderer_snapshot(self, doc.GetInternalPointer()));
+  }
+
+  void Render(RenderMode mode, const dom::CompiledDocument &doc) {
+    assert(self != nullptr);
+    return c_api::Renderer_render(self, mode, doc.GetInternalPointer());
+  }
+
+  bool RenderView(uint32_t view, RenderMode mode,
+                  const dom::CompiledDocument &doc) {
+    assert(self != nullptr);
+    return c_api::Renderer_render_view(self, view, mode,
+                                       doc.GetInternalPointer());
+  }
+#endif
+
+  uint32_t AddView(int32_t x, int32_t y, DeviceSize size) {
+    assert(self != nullptr);
+    return c_api::Renderer_add_view(self, x, y, size);
+  }
+
+  bool SetViewRect(uint32_t view, int32_t x, int32_t y, DeviceSize size) {
+    assert(self != nullptr);
+    return c_api::Renderer_set_view_rect(self, view, x, y, size);
+  }
+
+  bool ScrollView(uint32_t view, uint32_t node, float x, float y) {
+    assert(self != nullptr);
+    return c_api::Renderer_scroll_view(self, view, node, x, y);
+  }
 };
 
-typedef const void *(*GlLoadFunc)(const char *);
+}  // namespace render
+#endif
 
-class Renderer {
+#if defined(MODULE_EVENT)
+namespace event {
+
+using EmptyCallback = c_api::EmptyCallback;
+using Event = c_api::Event;
+
+// An EmptyCallback that calls `Method` on the `T` the user pointer points to.
+//
+// Rust calls the callbacks, so they must not throw.
+template <typename T, void (T::*Method)()>
+void Trampoline(void *user) noexcept {
+  (static_cast<T *>(user)->*Method)();
+}
+
+// Bundles three functors (usually lambdas) into something EventHandler can
+// take as its context, without allocating or type erasing them.
+template <typename SwapBuffersFn, typename MakeCurrentFn,
+          typename MakeNotCurrentFn>
+struct Callbacks {
+  SwapBuffersFn swap_buffers;
+  MakeCurrentFn make_current;
+  MakeNotCurrentFn make_not_current;
+
+  void SwapBuffers() { swap_buffers(); }
+  void MakeCurrent() { make_current(); }
+  void MakeNotCurrent() { make_not_current(); }
+};
+
+template <typename SwapBuffersFn, typename MakeCurrentFn,
+          typename MakeNotCurrentFn>
+Callbacks(SwapBuffersFn, MakeCurrentFn, MakeNotCurrentFn)
+    ->Callbacks<SwapBuffersFn, MakeCurrentFn, MakeNotCurrentFn>;
+
+class EventHandler
+    : public detail::Handle<c_api::EventHandler, c_api::EventHandler_drop> {
  public:
-  Renderer(Gl *gl, float device_pixel_ratio, DeviceSize device_size) {
-    self = c_api::Renderer_new(gl, device_pixel_ratio, device_size);
+  using Handle::Handle;
+
+  EventHandler(render::Renderer &&renderer, dom::CompiledDocument &&doc,
+               bool threaded, EmptyCallback swap_buffers,
+               EmptyCallback make_current, EmptyCallback make_not_current,
+               void *user)
+      : Handle(c_api::EventHandler_new(
+            renderer.TakeInternalPointer(), doc.TakeInternalPointer(),
+            threaded, swap_buffers, make_current, make_not_current, user)) {}
+
+  // Calls `context.SwapBuffers()`, `context.MakeCurrent()` and
+  // `context.MakeNotCurrent()` through trampolines generated for `Context`,
+  // with `&context` as the user pointer. `context` has to outlive the handler.
+  template <typename Context>
+  EventHandler(render::Renderer &&renderer, dom::CompiledDocument &&doc,
+               bool threaded, Context &context)
+      : EventHandler(std::move(renderer), std::move(doc), threaded,
+                     &Trampoline<Context, &Context::SwapBuffers>,
+                     &Trampoline<Context, &Context::MakeCurrent>,
+                     &Trampoline<Context, &Context::MakeNotCurrent>,
+                     &context) {}
+
+  void HandleResize(render::DeviceSize size) {
+    assert(self != nullptr);
+    return c_api::EventHandler_handle_resize(self, size);
   }
 
-  ~Renderer() {
-    if (self) {
-      c_api::Renderer_drop(self);
-    }
+  void HandleScaleFactorChange(float scale) {
+    assert(self != nullptr);
+    return c_api::EventHandler_handle_scale_factor_change(self, scale);
   }
 
-  void SetDeviceSize(DeviceSize size) {
+  void HandleRedraw() {
     assert(self != nullptr);
-    return c_api::Renderer_set_device_size(self, size);
+    return c_api::EventHandler_handle_redraw(self);
   }
 
-  void SetScaleFactor(float scale) {
+  void HandleEmpty() {
     assert(self != nullptr);
-    return c_api::Renderer_set_scale_factor(self, scale);
+    return c_api::EventHandler_handle_empty(self);
   }
 
-  void Render(_Bool inner, const CompiledDocument *doc) {
+  // Handles every event and renders at most one frame afterwards.
+  void HandleEvents(const Event *events, size_t count) {
     assert(self != nullptr);
-    return c_api::Renderer_render(self, inner, doc);
+    return c_api::EventHandler_handle_events(self, events, count);
   }
 
-  c_api::Renderer *GetInternalPointer() { return self; }
+  // Takes anything contiguous, like std::vector<Event>, std::array or
+  // std::span<const Event>.
+  template <typename Events>
+  void HandleEvents(const Events &events) {
+    return HandleEvents(std::data(events), std::size(events));
+  }
 
-  c_api::Renderer *TakeInternalPointer() {
-    c_api::Renderer *out = self;
-    self = nullptr;
-    return out;
+  void HandleEvents(std::initializer_list<Event> events) {
+    return HandleEvents(std::data(events), std::size(events));
   }
 
- private:
-  c_api::Renderer *self = nullptr;
+  // Shows `doc` from the next frame on, keeping the current document's layout
+  // if only the stylesheets changed.
+  void SetDocument(dom::CompiledDocument &&doc) {
+    assert(self != nullptr);
+    return c_api::EventHandler_set_document(self, doc.TakeInternalPointer());
+  }
+
+  void *GetUser() {
+    assert(self != nullptr);
+    return c_api::EventHandler_get_user(self);
+  }
+
+  // Replaces the user pointer, including the context of the templated
+  // constructor.
+  void SetUser(void *user) {
+    assert(self != nullptr);
+    return c_api::EventHandler_set_user(self, user);
+  }
+
+  // Returns the element at `x`, `y` or UINT32_MAX, see EventHandler_hit_test.
+  uint32_t HitTest(float x, float y, uint32_t *view = nullptr) {
+    assert(self != nullptr);
+    return c_api::EventHandler_hit_test(self, x, y, view);
+  }
+
+  uint32_t GetHovered(uint32_t *view = nullptr) {
+    assert(self != nullptr);
+    return c_api::EventHandler_get_hovered(self, view);
+  }
+
+  uint32_t GetPressed(uint32_t *view = nullptr) {
+    assert(self != nullptr);
+    return c_api::EventHandler_get_pressed(self, view);
+  }
+
+  bool NeedsFrame() {
+    assert(self != nullptr);
+    return c_api::EventHandler_needs_frame(self);
+  }
+
+  // Frees the caches of the renderer and the document while the window is
+  // hidden.
+  void Trim() {
+    assert(self != nullptr);
+    return c_api::EventHandler_trim(self);
+  }
 };
 
-}  // namespace render
-}  // namespace frameui
\ No newline at end of file
+}  // namespace event
+#endif
+
+}  // namespace frameui
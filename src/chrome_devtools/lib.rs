@@ -1,21 +1,33 @@
-use std::{sync::Arc, thread};
+use std::{
+  collections::{HashMap, HashSet},
+  convert::TryFrom,
+  sync::{mpsc, Arc},
+  thread,
+  time::{Duration, Instant},
+};
 
 use devtools_protocol as dt;
 
 use dashmap::DashMap;
-use futures_util::sink::SinkExt;
+use futures_util::{sink::SinkExt, stream::StreamExt};
 use log::{error, trace};
 use tokio::{
   net::{TcpListener, TcpStream, ToSocketAddrs},
   runtime::Runtime,
-  stream::StreamExt,
+  time,
 };
 use tungstenite::{
   handshake::server::{Request, Response},
   protocol::Message,
 };
 
-use ::dom::{CompiledDocument, Element, ElementData};
+use ::dom::{
+  tree::{Node, NodeId, Tree},
+  CompiledDocument, Element, ElementData, Observers, TreeChange,
+};
+
+/// How often connections check for tree changes and frames to send.
+const POLL_INTERVAL: Duration = Duration::from_millis(16);
 
 #[derive(PartialEq, Debug)]
 #[repr(u16)]
@@ -35,59 +47,467 @@ enum NodeType {
   Notation = 12, // historical
 }
 
-fn node_from_element(node_id: NodeId, parent: Option<NodeId>, elements: &Arena<Element>) -> dt::dom::Node {
-  let children: Vec<dt::dom::Node> = node_id
-    .children(elements)
-    .map(|x| node_from_element(x, Some(node_id), elements))
-    .collect();
-
-  let node = elements.get(node_id).unwrap().get();
+/// The protocol reserves `0` for "no node", so ids are shifted by one.
+fn protocol_id(id: NodeId) -> i64 {
+  id.index() as i64 + 1
+}
 
-  let node_name = node.get_local_name().to_string();
+fn node_id(id: i64) -> Option<NodeId> {
+  usize::try_from(id - 1).ok().map(NodeId::from_index)
+}
 
-  let node_type = match node.data {
-    ElementData::Root(..) => NodeType::Document,
-    _ => NodeType::Element,
+/// The computed `class` and `id` of `el`, `None` for the ones it doesn't have.
+fn attributes(el: &Element) -> [(&'static str, Option<String>); 2] {
+  let classes = if el.classes.is_empty() {
+    None
+  } else {
+    Some(
+      el.classes
+        .iter()
+        .map(|class| class.as_str())
+        .collect::<Vec<_>>()
+        .join(" "),
+    )
   };
+  [
+    ("class", classes),
+    ("id", el.id.as_ref().map(|id| id.as_str().to_string())),
+  ]
+}
+
+/// Returns the box of `node` from the last layout pass.
+///
+/// Elements have no padding or borders and the layout cache only keeps border boxes,
+/// so every box of the model is the same quad.
+fn box_model(doc: &CompiledDocument, node: i64) -> Option<dt::dom::BoxModel> {
+  let layout = doc.layout.read().unwrap();
+  let index = layout.index_of(node_id(node)?)?;
+
+  let (x, y) = (f64::from(layout.x[index]), f64::from(layout.y[index]));
+  let (width, height) = (f64::from(layout.width[index]), f64::from(layout.height[index]));
+  let quad = vec![x, y, x + width, y, x + width, y + height, x, y + height];
 
-  let node_value = String::new();
-
-  dt::dom::Node {
-    node_id: Into::<usize>::into(node_id) as i64,
-    backend_node_id: Into::<usize>::into(node_id) as i64,
-    node_type: node_type as i64,
-    local_name: node_name.clone(),
-    node_name,
-    node_value,
-    children: Some(children),
-    parent_id: parent.map(|x| Into::<usize>::into(x) as i64),
-
-    attributes: None,
-    base_url: None,
-    child_node_count: None,
-    content_document: None,
-    distributed_nodes: None,
-    document_url: None,
-    frame_id: None,
-    imported_document: None,
-    internal_subset: None,
-    is_svg: None,
-    name: None,
-    pseudo_elements: None,
-    pseudo_type: None,
-    public_id: None,
-    shadow_root_type: None,
-    shadow_roots: None,
-    system_id: None,
-    template_content: None,
-    value: None,
-    xml_version: None,
+  Some(dt::dom::BoxModel {
+    content: quad.clone(),
+    padding: quad.clone(),
+    border: quad.clone(),
+    margin: quad,
+    width: width.round() as i64,
+    height: height.round() as i64,
+    shape_outside: None,
+  })
+}
+
+/// The counters of one frame, see `DevTools::record_frame`.
+#[derive(Debug)]
+struct Frame {
+  /// Since the `DevTools` was created.
+  time: Duration,
+  counters: Vec<(&'static str, f64)>,
+}
+
+impl Frame {
+  /// The frame as a counter event of the Trace Event Format.
+  fn trace_event(&self) -> HashMap<String, serde_json::Value> {
+    let args = self
+      .counters
+      .iter()
+      .map(|&(name, value)| (name.to_string(), value.into()))
+      .collect();
+
+    let mut event = HashMap::new();
+    event.insert("name".to_string(), "FrameStats".into());
+    event.insert("cat".to_string(), "frameui".into());
+    event.insert("ph".to_string(), "C".into());
+    event.insert("ts".to_string(), (self.time.as_micros() as u64).into());
+    event.insert("pid".to_string(), std::process::id().into());
+    event.insert("tid".to_string(), 0.into());
+    event.insert("args".to_string(), serde_json::Value::Object(args));
+    event
+  }
+}
+
+struct View {
+  doc: Arc<CompiledDocument>,
+  frames: Observers<Arc<Frame>>,
+}
+
+type Views = DashMap<usize, View>;
+
+/// The part of a document a client was sent, so events only mention nodes it knows about.
+#[derive(Debug, Default)]
+struct Mirror {
+  known: HashSet<NodeId>,
+  /// Nodes whose children the client was sent, the others only have a child count.
+  expanded: HashSet<NodeId>,
+}
+
+impl Mirror {
+  /// Serializes `node` and its descendants down to `depth` levels below it, or all of them if
+  /// `depth` is negative.
+  fn node(&mut self, node: Node<'_, Element>, depth: i64) -> dt::dom::Node {
+    let children = if depth == 0 {
+      None
+    } else {
+      self.expanded.insert(node.id());
+      Some(node.children().map(|child| self.node(child, depth - 1)).collect())
+    };
+    self.known.insert(node.id());
+
+    let el: &Element = node.inner();
+    let node_name = el.get_local_name().to_string();
+
+    let node_type = match el.data {
+      ElementData::Root(..) => NodeType::Document,
+      _ => NodeType::Element,
+    };
+
+    let attributes = attributes(el)
+      .iter()
+      .filter_map(|(name, value)| Some(vec![name.to_string(), value.clone()?]))
+      .flatten()
+      .collect();
+
+    dt::dom::Node {
+      node_id: protocol_id(node.id()),
+      backend_node_id: protocol_id(node.id()),
+      node_type: node_type as i64,
+      local_name: node_name.clone(),
+      node_name,
+      node_value: String::new(),
+      children,
+      child_node_count: Some(node.children().count() as i64),
+      parent_id: node.parent().map(|parent| protocol_id(parent.id())),
+      attributes: Some(attributes),
+
+      base_url: None,
+      content_document: None,
+      distributed_nodes: None,
+      document_url: None,
+      frame_id: None,
+      imported_document: None,
+      internal_subset: None,
+      is_svg: None,
+      name: None,
+      pseudo_elements: None,
+      pseudo_type: None,
+      public_id: None,
+      shadow_root_type: None,
+      shadow_roots: None,
+      system_id: None,
+      template_content: None,
+      value: None,
+      xml_version: None,
+    }
+  }
+
+  /// Turns `change` into the events for what the client knows, a change below a node whose
+  /// children it wasn't sent only updates that node's child count.
+  fn events(&mut self, tree: &Tree<Element>, change: TreeChange, events: &mut Vec<dt::dom::Event>) {
+    let child_count_updated = |parent| {
+      dt::dom::Event::ChildNodeCountUpdated(dt::dom::ChildNodeCountUpdatedEvent {
+        node_id: protocol_id(parent),
+        child_node_count: tree.children(parent).count() as i64,
+      })
+    };
+
+    match change {
+      TreeChange::Inserted {
+        parent,
+        previous_sibling,
+        node,
+      } => {
+        if self.expanded.contains(&parent) {
+          events.push(dt::dom::Event::ChildNodeInserted(dt::dom::ChildNodeInsertedEvent {
+            parent_node_id: protocol_id(parent),
+            previous_node_id: previous_sibling.map_or(0, protocol_id),
+            node: Box::new(self.node(tree.get(node), 0)),
+          }));
+        } else if self.known.contains(&parent) {
+          events.push(child_count_updated(parent));
+        }
+      }
+
+      TreeChange::Removed { parent, node } => {
+        if self.expanded.contains(&parent) {
+          events.push(dt::dom::Event::ChildNodeRemoved(dt::dom::ChildNodeRemovedEvent {
+            parent_node_id: protocol_id(parent),
+            node_id: protocol_id(node),
+          }));
+        } else if self.known.contains(&parent) {
+          events.push(child_count_updated(parent));
+        }
+      }
+
+      TreeChange::Attributes { node } => {
+        if !self.known.contains(&node) {
+          return;
+        }
+
+        for (name, value) in attributes(&tree[node]).iter().cloned() {
+          let node_id = protocol_id(node);
+          let name = name.to_string();
+          events.push(match value {
+            Some(value) => dt::dom::Event::AttributeModified(dt::dom::AttributeModifiedEvent { node_id, name, value }),
+            None => dt::dom::Event::AttributeRemoved(dt::dom::AttributeRemovedEvent { node_id, name }),
+          });
+        }
+      }
+    }
+  }
+}
+
+fn result(id: u64, result: dt::CommandResultData) -> String {
+  serde_json::to_string(&dt::CommandResult { id, result }).unwrap()
+}
+
+/// The result of a command that doesn't return anything.
+fn empty_result(id: u64) -> String {
+  format!(r#"{{"id":{},"result":{{}}}}"#, id)
+}
+
+fn event(event: dt::Event) -> String {
+  serde_json::to_string(&event).unwrap()
+}
+
+/// The state of one client connection.
+///
+/// Everything is serialized on the DevTools thread, the threads that change the document only
+/// queue `TreeChange`s and frames, and only while a client subscribed to them.
+struct Session {
+  view: usize,
+  doc: Arc<CompiledDocument>,
+  mirror: Mirror,
+  /// Subscribed once the client asked for the document.
+  tree_changes: Option<mpsc::Receiver<TreeChange>>,
+  /// Subscribed while the `Performance` or `Tracing` domain is enabled.
+  frames: Option<mpsc::Receiver<Arc<Frame>>>,
+  performance: bool,
+  tracing: bool,
+  last_frame: Option<Arc<Frame>>,
+}
+
+impl Session {
+  fn new(view: usize, views: &Views) -> Option<Self> {
+    Some(Self {
+      view,
+      doc: Arc::clone(&views.get(&view)?.doc),
+      mirror: Mirror::default(),
+      tree_changes: None,
+      frames: None,
+      performance: false,
+      tracing: false,
+      last_frame: None,
+    })
+  }
+
+  /// Returns the messages that answer `cmd`.
+  fn handle(&mut self, views: &Views, cmd: dt::Command) -> Vec<String> {
+    let id = cmd.id;
+    match cmd.data {
+      dt::CommandData::DOM(cmd) => match cmd {
+        dt::dom::Command::GetDocument(params) => {
+          let depth = params.and_then(|params| params.depth).unwrap_or(1);
+
+          let tree = self.doc.tree.read().unwrap();
+          // Changes are only made with the tree locked, so every change from now on is missing
+          // from the snapshot and every earlier one is part of it.
+          self.tree_changes = Some(self.doc.observers.subscribe());
+          self.mirror = Mirror::default();
+          let root = self.mirror.node(tree.get(tree.root()), depth);
+
+          vec![result(
+            id,
+            dt::CommandResultData::DOM(dt::dom::CommandResult::GetDocument { root: Box::new(root) }),
+          )]
+        }
+
+        dt::dom::Command::RequestChildNodes(params) => {
+          let depth = params.depth.unwrap_or(1);
+          let mut messages = Vec::new();
+
+          let tree = self.doc.tree.read().unwrap();
+          let mirror = &mut self.mirror;
+          if let Some(node) = node_id(params.node_id).filter(|node| mirror.known.contains(node)) {
+            let nodes = tree.children(node).map(|child| mirror.node(child, depth - 1)).collect();
+            mirror.expanded.insert(node);
+
+            messages.push(event(dt::Event::DOM(dt::dom::Event::SetChildNodes(
+              dt::dom::SetChildNodesEvent {
+                parent_id: params.node_id,
+                nodes,
+              },
+            ))));
+          }
+          messages.push(empty_result(id));
+          messages
+        }
+
+        dt::dom::Command::GetBoxModel(params) => {
+          let node = params.and_then(|params| params.node_id.or(params.backend_node_id));
+          match node.and_then(|node| box_model(&self.doc, node)) {
+            Some(model) => vec![result(
+              id,
+              dt::CommandResultData::DOM(dt::dom::CommandResult::GetBoxModel { model: Box::new(model) }),
+            )],
+            None => Vec::new(),
+          }
+        }
+
+        _ => Vec::new(),
+      },
+
+      dt::CommandData::Performance(cmd) => match cmd {
+        dt::performance::Command::Enable(..) => {
+          self.performance = true;
+          self.watch_frames(views);
+          vec![empty_result(id)]
+        }
+
+        dt::performance::Command::Disable(..) => {
+          self.performance = false;
+          self.watch_frames(views);
+          vec![empty_result(id)]
+        }
+
+        dt::performance::Command::GetMetrics(..) => vec![result(
+          id,
+          dt::CommandResultData::Performance(dt::performance::CommandResult::GetMetrics {
+            metrics: self.metrics(),
+          }),
+        )],
+
+        _ => Vec::new(),
+      },
+
+      dt::CommandData::Tracing(cmd) => match cmd {
+        dt::tracing::Command::Start(..) => {
+          self.tracing = true;
+          self.watch_frames(views);
+          vec![empty_result(id)]
+        }
+
+        dt::tracing::Command::End(..) => {
+          // Frames that are still queued belong to the trace.
+          let mut messages = self.poll_frames();
+          self.tracing = false;
+          self.watch_frames(views);
+
+          messages.push(empty_result(id));
+          messages.push(event(dt::Event::Tracing(dt::tracing::Event::TracingComplete(
+            dt::tracing::TracingCompleteEvent {
+              data_loss_occurred: false,
+              stream: None,
+              trace_format: None,
+              stream_compression: None,
+            },
+          ))));
+          messages
+        }
+
+        _ => Vec::new(),
+      },
+
+      _ => Vec::new(),
+    }
+  }
+
+  fn watch_frames(&mut self, views: &Views) {
+    if !self.performance && !self.tracing {
+      self.frames = None;
+    } else if self.frames.is_none() {
+      self.frames = views.get(&self.view).map(|view| view.frames.subscribe());
+    }
+  }
+
+  fn metrics(&self) -> Vec<dt::performance::Metric> {
+    let frame = match &self.last_frame {
+      Some(frame) => frame,
+      None => return Vec::new(),
+    };
+
+    std::iter::once(("Timestamp", frame.time.as_secs_f64()))
+      .chain(frame.counters.iter().copied())
+      .map(|(name, value)| dt::performance::Metric {
+        name: name.to_string(),
+        value,
+      })
+      .collect()
+  }
+
+  /// Returns the messages for whatever changed since the last poll.
+  fn poll(&mut self, views: &Views) -> Vec<String> {
+    let mut messages = Vec::new();
+
+    // A live reload replaced the document, the client has to ask for the new one.
+    if let Some(doc) = views.get(&self.view).map(|view| Arc::clone(&view.doc)) {
+      if !Arc::ptr_eq(&doc, &self.doc) {
+        self.doc = doc;
+        self.mirror = Mirror::default();
+        if self.tree_changes.take().is_some() {
+          messages.push(event(dt::Event::DOM(dt::dom::Event::DocumentUpdated)));
+        }
+      }
+    }
+
+    messages.extend(self.poll_tree());
+    messages.extend(self.poll_frames());
+    messages
+  }
+
+  fn poll_tree(&mut self) -> Vec<String> {
+    let changes: Vec<_> = match &self.tree_changes {
+      Some(changes) => changes.try_iter().collect(),
+      None => return Vec::new(),
+    };
+    if changes.is_empty() {
+      return Vec::new();
+    }
+
+    let tree = self.doc.tree.read().unwrap();
+    let mut events = Vec::new();
+    for change in changes {
+      self.mirror.events(&tree, change, &mut events);
+    }
+    events.into_iter().map(|e| event(dt::Event::DOM(e))).collect()
+  }
+
+  fn poll_frames(&mut self) -> Vec<String> {
+    let frames: Vec<_> = match &self.frames {
+      Some(frames) => frames.try_iter().collect(),
+      None => return Vec::new(),
+    };
+    let mut messages = Vec::new();
+
+    if let Some(frame) = frames.last() {
+      self.last_frame = Some(Arc::clone(frame));
+      // Metrics are a snapshot, only the latest frame matters.
+      if self.performance {
+        messages.push(event(dt::Event::Performance(dt::performance::Event::Metrics(
+          dt::performance::MetricsEvent {
+            metrics: self.metrics(),
+            title: "frame".to_string(),
+          },
+        ))));
+      }
+    }
+
+    if self.tracing && !frames.is_empty() {
+      messages.push(event(dt::Event::Tracing(dt::tracing::Event::DataCollected(
+        dt::tracing::DataCollectedEvent {
+          value: frames.iter().map(|frame| frame.trace_event()).collect(),
+        },
+      ))));
+    }
+
+    messages
   }
 }
 
 pub struct DevTools {
   counter: usize,
-  documents: Arc<DashMap<usize, Arc<CompiledDocument>>>,
+  documents: Arc<Views>,
+  epoch: Instant,
 }
 
 impl DevTools {
@@ -108,10 +528,14 @@ impl DevTools {
       });
     });
 
-    DevTools { counter: 0, documents }
+    DevTools {
+      counter: 0,
+      documents,
+      epoch: Instant::now(),
+    }
   }
 
-  async fn handle_connection(stream: TcpStream, views: Arc<DashMap<usize, Arc<CompiledDocument>>>) {
+  async fn handle_connection(stream: TcpStream, views: Arc<Views>) {
     let mut idx = 0;
     let callback = |req: &Request, response: Response| {
       idx = match req.uri().path()[1..].parse() {
@@ -128,60 +552,96 @@ impl DevTools {
       }
     };
 
-    match tokio_tungstenite::accept_hdr_async(stream, callback).await {
-      Ok(mut ws_stream) => {
-        while let Some(Ok(msg)) = ws_stream.next().await {
-          if let Message::Text(text) = msg {
+    let ws_stream = match tokio_tungstenite::accept_hdr_async(stream, callback).await {
+      Ok(ws_stream) => ws_stream,
+      Err(e) => {
+        error!("websocket error: {}", e);
+        return;
+      }
+    };
+    let mut session = match Session::new(idx, &views) {
+      Some(session) => session,
+      None => return,
+    };
+
+    let (mut sink, mut stream) = ws_stream.split();
+    let mut ticks = time::interval(POLL_INTERVAL);
+    loop {
+      let messages = tokio::select! {
+        msg = stream.next() => match msg {
+          Some(Ok(Message::Text(text))) => {
             let msg: Result<dt::Command, _> = serde_json::from_str(&text);
             trace!("{:#?}", msg);
 
             match msg {
-              Ok(cmd) => {
-                let id = cmd.id;
-                match cmd.data {
-                  dt::CommandData::DOM(cmd) => match cmd {
-                    dt::dom::Command::GetDocument { .. } => {
-                      let out = {
-                        let view = { Arc::clone(views.get(&idx).unwrap().value()) };
-
-                        // let elements = view.elements.read().unwrap();
-                        let root = node_from_element(view.root, None, &elements);
-
-                        dt::CommandResult {
-                          id,
-                          result: dt::CommandResultData::DOM(dt::dom::CommandResult::GetDocument {
-                            root: Box::new(root),
-                          }),
-                        }
-                      };
-
-                      ws_stream
-                        .send(Message::Text(serde_json::to_string(&out).unwrap()))
-                        .await
-                        .unwrap();
-                    }
-
-                    _ => {}
-                  },
-
-                  _ => {}
-                }
-              }
-
+              Ok(cmd) => session.handle(&views, cmd),
               Err(e) => {
                 println!("{} {:?}", text, e);
+                Vec::new()
               }
-            };
+            }
           }
+
+          Some(Ok(_)) => Vec::new(),
+          _ => break,
+        },
+
+        _ = ticks.tick() => session.poll(&views),
+      };
+
+      for message in messages {
+        if let Err(e) = sink.send(Message::Text(message)).await {
+          error!("websocket error: {}", e);
+          return;
         }
       }
-
-      Err(e) => error!("websocket error: {}", e),
     }
   }
 
-  pub fn add_view(&mut self, view: Arc<CompiledDocument>) {
-    self.documents.insert(self.counter, view);
+  /// Makes `view` inspectable at `ws://<addr>/<id>`, returning the id.
+  pub fn add_view(&mut self, view: Arc<CompiledDocument>) -> usize {
+    self.documents.insert(
+      self.counter,
+      View {
+        doc: view,
+        frames: Observers::default(),
+      },
+    );
     self.counter += 1;
+    self.counter - 1
+  }
+
+  /// Shows `view` at `id` instead of the document it had, like after a live reload.
+  ///
+  /// Connected clients are told the document was updated, and see the new one once they ask for it again.
+  pub fn set_view(&self, id: usize, view: Arc<CompiledDocument>) {
+    if let Some(mut existing) = self.documents.get_mut(&id) {
+      existing.doc = view;
+      return;
+    }
+
+    self.documents.insert(
+      id,
+      View {
+        doc: view,
+        frames: Observers::default(),
+      },
+    );
+  }
+
+  /// Streams the counters of a frame of view `id` (like `render::FrameStats::counters`) to the
+  /// clients that enabled the `Performance` or `Tracing` domain.
+  ///
+  /// Until a client does this is a map lookup and an atomic load, so it can be called after
+  /// every frame.
+  pub fn record_frame(&self, id: usize, counters: &[(&'static str, f64)]) {
+    if let Some(view) = self.documents.get(&id) {
+      if view.frames.is_observed() {
+        view.frames.notify(Arc::new(Frame {
+          time: self.epoch.elapsed(),
+          counters: counters.to_vec(),
+        }));
+      }
+    }
   }
 }
@@ -0,0 +1,130 @@
+use std::{
+  fs,
+  hash::{Hash, Hasher},
+  io::{self, BufReader, BufWriter, Write},
+  path::{Path, PathBuf},
+};
+
+use serde::{de::DeserializeOwned, Deserialize, Serialize};
+use url::Url;
+
+use super::{fetch, init_fetcher};
+
+/// What a cache entry holds, each kind gets its own directory.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub(crate) enum Kind {
+  /// The CSS (and source map) libsass produced for a Sass or SCSS stylesheet.
+  Css,
+  /// A `StyleSheet` parsed from CSS, along with its strings.
+  StyleSheet,
+  /// A whole compiled document, as written to a `.cframe`.
+  Document,
+}
+
+impl Kind {
+  const ALL: [Kind; 3] = [Kind::Css, Kind::StyleSheet, Kind::Document];
+
+  fn dir_name(self) -> &'static str {
+    match self {
+      Kind::Css => "css",
+      Kind::StyleSheet => "stylesheet",
+      Kind::Document => "document",
+    }
+  }
+}
+
+/// Hashes the content something was produced from into a cache key.
+///
+/// SeaHash has fixed keys (unlike `DefaultHasher`), so keys are the same on every run.
+pub(crate) fn key<T: Hash + ?Sized>(value: &T) -> u64 {
+  let mut hasher = seahash::SeaHasher::new();
+  value.hash(&mut hasher);
+  hasher.finish()
+}
+
+/// A file that was read to produce a cache entry, which isn't part of the entry's key.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub(crate) struct Input {
+  url: String,
+  hash: u64,
+}
+
+impl Input {
+  pub fn new(url: &Url, content: &str) -> Self {
+    Self {
+      url: url.to_string(),
+      hash: key(content),
+    }
+  }
+
+  /// Returns the path of the input if it is a local file.
+  #[must_use]
+  pub fn path(&self) -> Option<PathBuf> {
+    Url::parse(&self.url).ok()?.to_file_path().ok()
+  }
+
+  /// Returns true if the input can still be read and has the same content.
+  #[must_use]
+  pub fn is_current(&self) -> bool {
+    Url::parse(&self.url)
+      .ok()
+      .and_then(|url| fetch(&url).ok())
+      .map_or(false, |content| key(content.as_str()) == self.hash)
+  }
+}
+
+/// Keeps the results of the expensive compile steps in a directory, so inputs that didn't
+/// change skip libsass and cssparser (or the whole compile) the next time.
+///
+/// Entries are keyed by a hash of their content and never updated in place, a changed input
+/// simply hashes to a different key. Linked stylesheets and Sass imports aren't part of the
+/// key, so entries list them as `Input`s and are only used if all of them are unchanged.
+/// Errors are ignored, a broken cache only means the work is done again.
+#[derive(Debug, Clone)]
+pub struct Cache {
+  dir: PathBuf,
+}
+
+impl Cache {
+  /// Opens (or creates) the cache in `dir`.
+  ///
+  /// Every compiler version and `.cframe` format version gets its own subdirectory, since
+  /// entries are serialized compiler types and documents. Remote resources are kept in
+  /// `http`, which every version shares.
+  pub fn open<P: AsRef<Path>>(dir: P) -> io::Result<Self> {
+    init_fetcher(&dir.as_ref().join("http"))?;
+
+    let format = dom::MAGIC_BYTES[dom::MAGIC_BYTES.len() - 1];
+    let dir = dir.as_ref().join(format!("v{}-{}", env!("CARGO_PKG_VERSION"), format));
+    for kind in &Kind::ALL {
+      fs::create_dir_all(dir.join(kind.dir_name()))?;
+    }
+
+    Ok(Self { dir })
+  }
+
+  fn path(&self, kind: Kind, key: u64) -> PathBuf {
+    self.dir.join(kind.dir_name()).join(format!("{:016x}.bin", key))
+  }
+
+  pub(crate) fn get<T: DeserializeOwned>(&self, kind: Kind, key: u64) -> Option<T> {
+    let reader = BufReader::new(fs::File::open(self.path(kind, key)).ok()?);
+    bincode::deserialize_from(reader).ok()
+  }
+
+  pub(crate) fn put<T: Serialize>(&self, kind: Kind, key: u64, value: &T) {
+    let path = self.path(kind, key);
+    // Write to a temporary file first, so other compilers never see a truncated entry.
+    let tmp = path.with_extension(format!("{}.tmp", std::process::id()));
+
+    let written = fs::File::create(&tmp).map_err(bincode::Error::from).and_then(|file| {
+      let mut writer = BufWriter::new(file);
+      bincode::serialize_into(&mut writer, value)?;
+      // Dropping a `BufWriter` flushes it but ignores errors, a short write must not be renamed into place.
+      writer.flush().map_err(bincode::Error::from)
+    });
+    if written.is_err() || fs::rename(&tmp, path).is_err() {
+      let _ = fs::remove_file(tmp);
+    }
+  }
+}
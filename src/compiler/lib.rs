@@ -1,22 +1,29 @@
 use std::{
   fmt,
-  fs::File,
-  io,
-  io::{prelude::*, BufReader},
-  path::Path,
+  io::{self, prelude::*},
+  path::{Path, PathBuf},
 };
 
+use fetch::{Error as FetchError, Fetcher};
+use once_cell::sync::OnceCell;
 use quick_xml::events::{BytesStart, Event};
-use reqwest::blocking::{get, Response};
+use rayon::prelude::*;
+use serde::{Deserialize, Serialize};
 use url::Url;
 
-use dom::{CompiledDocument, Element, ElementData, RootElement, UnstyledElement};
-use style::StyleSheet;
+use dom::{format::DocumentWriter, CompiledDocument, Element, ElementData, RootElement, UnstyledElement};
+use style::{StringTable, StyleSheet};
 
-use dom::tree::Node;
+use dom::tree::{NodeId, Tree};
 
 #[path = "style.rs"]
 mod _style;
+mod cache;
+mod watch;
+
+pub use cache::Cache;
+use cache::{Input, Kind};
+pub use watch::Watcher;
 
 pub trait IntoUrl {
   fn into_url(&self) -> Result<Url, DiagnosticKind>;
@@ -129,48 +136,49 @@ impl<'i> From<quick_xml::Error> for DiagnosticKind<'i> {
   }
 }
 
-enum Reader {
-  File(BufReader<File>),
-  Network(BufReader<Response>),
-}
-
-impl Reader {
-  pub fn get(url: &Url) -> Result<Reader, DiagnosticKind> {
-    if url.scheme() == "file" {
-      let file = File::open(url.to_file_path().unwrap())?;
-      let buf = BufReader::new(file);
-      Ok(Reader::File(buf))
-    } else {
-      let resp = get(url.clone())?;
-      let buf = BufReader::new(resp);
-      Ok(Reader::Network(buf))
+impl<'i> From<FetchError> for DiagnosticKind<'i> {
+  fn from(e: FetchError) -> DiagnosticKind<'i> {
+    match e {
+      FetchError::IO(e) => DiagnosticKind::IOError(e),
+      FetchError::Reqwest(e) => DiagnosticKind::ReqwestError(e),
     }
   }
 }
 
-impl Read for Reader {
-  fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
-    match self {
-      Reader::File(buf_reader) => buf_reader.read(buf),
-      Reader::Network(buf_reader) => buf_reader.read(buf),
-    }
-  }
+static FETCHER: OnceCell<Fetcher> = OnceCell::new();
+
+/// The fetcher every resource of every document is fetched with.
+///
+/// Set up by `Cache::open` to keep HTTP responses next to the compiler's own entries, or
+/// without a disk cache if the compiler runs without one.
+fn fetcher() -> &'static Fetcher {
+  FETCHER.get_or_init(|| Fetcher::new(None).expect("couldn't start the fetcher"))
 }
 
-impl BufRead for Reader {
-  fn consume(&mut self, amt: usize) {
-    match self {
-      Reader::File(buf) => buf.consume(amt),
-      Reader::Network(buf) => buf.consume(amt),
-    }
+/// Makes `fetcher` keep HTTP responses in `dir`, unless something was already fetched.
+fn init_fetcher(dir: &Path) -> io::Result<()> {
+  if FETCHER.get().is_none() {
+    let _ = FETCHER.set(Fetcher::new(Some(dir))?);
   }
+  Ok(())
+}
 
-  fn fill_buf(&mut self) -> io::Result<&[u8]> {
-    match self {
-      Reader::File(buf) => buf.fill_buf(),
-      Reader::Network(buf) => buf.fill_buf(),
-    }
-  }
+fn into_string(bytes: Vec<u8>) -> Result<String, FetchError> {
+  String::from_utf8(bytes).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e).into())
+}
+
+/// Reads the whole file at `url`.
+fn fetch(url: &Url) -> Result<String, FetchError> {
+  fetcher().fetch_blocking(url).and_then(into_string)
+}
+
+/// Reads the whole files at `urls` concurrently.
+fn fetch_all(urls: &[Url]) -> Vec<Result<String, FetchError>> {
+  fetcher()
+    .fetch_all(urls)
+    .into_iter()
+    .map(|result| result.and_then(into_string))
+    .collect()
 }
 
 pub trait DiagnosticReporter {
@@ -182,10 +190,34 @@ pub trait DiagnosticReporter {
   fn checkpoint(&mut self) -> Result<(), ()>;
 }
 
+/// Where compiled elements go, a tree for `compile` or a `.cframe` for `compile_into`.
+trait ElementSink {
+  fn append(&mut self, parent: NodeId, data: ElementData, attrs: dom::RawElementAttributes) -> io::Result<NodeId>;
+}
+
+impl ElementSink for Tree<Element> {
+  fn append(&mut self, parent: NodeId, data: ElementData, attrs: dom::RawElementAttributes) -> io::Result<NodeId> {
+    Ok(Tree::append(self, parent, Element::new(data, attrs)))
+  }
+}
+
+/// Elements are written as they're read, without allocating their yoga nodes.
+impl<W: Write + Seek> ElementSink for DocumentWriter<W> {
+  fn append(&mut self, parent: NodeId, data: ElementData, attrs: dom::RawElementAttributes) -> io::Result<NodeId> {
+    DocumentWriter::append(self, parent, data, &attrs)
+  }
+}
+
 struct Context<'r, FileId: fmt::Debug + Clone> {
-  root: Node<Element>,
+  sink: &'r mut dyn ElementSink,
   reporter: &'r mut dyn DiagnosticReporter<FileId = FileId>,
   stylesheet: StyleSheet,
+  strings: StringTable,
+  /// The `<Style>` elements that were read so far.
+  styles: Vec<_style::StyleJob>,
+  /// The files other than the document that went into it.
+  inputs: Vec<Input>,
+  cache: Option<&'r Cache>,
 }
 
 #[macro_export]
@@ -459,12 +491,13 @@ impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
   ) -> Result<(), ()> {
     buf.clear();
 
-    self.compile_ui_element(self.root.clone(), reader, buf, url, file_id)
+    // Both sinks start out with just the root.
+    self.compile_ui_element(NodeId::from_index(0), reader, buf, url, file_id)
   }
 
   fn compile_ui_element<R: BufRead>(
     &mut self,
-    parent: Node<Element>,
+    parent: NodeId,
     reader: &mut quick_xml::Reader<R>,
     buf: &mut Vec<u8>,
     url: &Url,
@@ -486,7 +519,7 @@ impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
           match name {
             "Unstyled" => {
               let e = e.to_owned();
-              self.compile_unstyled(e, parent.clone(), reader, buf, url, file_id)?;
+              self.compile_unstyled(e, parent, reader, buf, url, file_id)?;
             }
 
             _ => panic!("unknown {}", name),
@@ -507,7 +540,7 @@ impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
   fn compile_unstyled<'a, R: BufRead>(
     &mut self,
     e: BytesStart<'a>,
-    parent: Node<Element>,
+    parent: NodeId,
     reader: &mut quick_xml::Reader<R>,
     buf: &mut Vec<u8>,
     url: &Url,
@@ -536,30 +569,28 @@ impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
       match key {
         "class" => {
           raw_attributes.class = Some(dom::RawAttributeValue::Raw {
-            value: value.to_string(),
+            value: self.strings.push(&value),
             up_to_date: false,
           });
         }
 
         ":class" => {
           raw_attributes.class = Some(dom::RawAttributeValue::Script {
-            script: value.to_string(),
-            up_to_date: false,
+            script: self.strings.push(&value),
             ast: None,
           });
         }
 
         "id" => {
           raw_attributes.id = Some(dom::RawAttributeValue::Raw {
-            value: value.to_string(),
+            value: self.strings.push(&value),
             up_to_date: false,
           });
         }
 
         ":id" => {
           raw_attributes.id = Some(dom::RawAttributeValue::Script {
-            script: value.to_string(),
-            up_to_date: false,
+            script: self.strings.push(&value),
             ast: None,
           });
         }
@@ -581,48 +612,163 @@ impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
       }
     }
 
-    let el = Element::new(ElementData::Unstyled(UnstyledElement), raw_attributes);
-    let node = parent.append(el);
+    let node = self
+      .sink
+      .append(parent, ElementData::Unstyled(UnstyledElement), raw_attributes)
+      .map_err(handle_error_with_location!(self, file_id, reader))?;
 
     self.compile_ui_element(node, reader, buf, url, file_id)
   }
 }
 
+/// A compiled document in the cache, along with everything it was compiled from.
+#[derive(Debug, Serialize, Deserialize)]
+struct CachedDocument {
+  inputs: Vec<Input>,
+  data: Vec<u8>,
+}
+
 pub fn compile<URL: IntoUrl, FileId: fmt::Debug + Clone>(
   url: URL,
   reporter: &mut dyn DiagnosticReporter<FileId = FileId>,
 ) -> Result<CompiledDocument, ()> {
+  compile_inner(url, reporter, None).map(|(doc, _)| doc)
+}
+
+/// Like `compile`, but reuses whatever `cache` has for the inputs that didn't change.
+///
+/// A document whose source, stylesheets and Sass imports are all unchanged is loaded from the
+/// cache without compiling anything. Otherwise only the stylesheets that changed go through
+/// libsass and cssparser. Diagnostics are only reported for the parts that are compiled.
+pub fn compile_cached<URL: IntoUrl, FileId: fmt::Debug + Clone>(
+  url: URL,
+  reporter: &mut dyn DiagnosticReporter<FileId = FileId>,
+  cache: &Cache,
+) -> Result<CompiledDocument, ()> {
+  compile_inner(url, reporter, Some(cache)).map(|(doc, _)| doc)
+}
+
+/// Like `compile_cached`, but also returns the local files the document was compiled from
+/// (the document itself, its stylesheets and their Sass imports), to watch them for changes.
+pub fn compile_watched<URL: IntoUrl, FileId: fmt::Debug + Clone>(
+  url: URL,
+  reporter: &mut dyn DiagnosticReporter<FileId = FileId>,
+  cache: &Cache,
+) -> Result<(CompiledDocument, Vec<PathBuf>), ()> {
+  let url = url.into_url().map_err(handle_error!(reporter))?;
+  let (doc, inputs) = compile_inner(url.as_str(), reporter, Some(cache))?;
+
+  let files = std::iter::once(url.to_file_path().ok())
+    .chain(inputs.iter().map(Input::path))
+    .flatten()
+    .collect();
+  Ok((doc, files))
+}
+
+/// Compiles a document straight into a `.cframe` written to `writer`, returning the writer.
+///
+/// Unlike `compile` followed by `save_into`, the tree never exists in memory, elements are
+/// written out as they're read. If compiling fails `writer` holds a partial document.
+pub fn compile_into<URL: IntoUrl, FileId: fmt::Debug + Clone, W: Write + Seek>(
+  url: URL,
+  reporter: &mut dyn DiagnosticReporter<FileId = FileId>,
+  writer: W,
+) -> Result<W, ()> {
   let url = url.into_url().map_err(handle_error!(reporter))?;
+  let source = read_source(&url, reporter)?;
+  let mut sink = DocumentWriter::new(writer).map_err(handle_error!(reporter))?;
 
-  let mut out = String::new();
-  let mut reader = Reader::get(&url).map_err(handle_error!(reporter))?;
-  reader.read_to_string(&mut out).map_err(handle_error!(reporter))?;
+  let ctx = compile_with(&url, source, reporter, &mut sink, None)?;
+  let (stylesheet, strings) = (ctx.stylesheet, ctx.strings);
 
-  let file_id = reporter.add_file(url.to_string(), out);
+  let mut writer = sink.finish(&stylesheet, &strings).map_err(handle_error!(reporter))?;
+  writer.flush().map_err(handle_error!(reporter))?;
+  Ok(writer)
+}
 
-  let reader = Reader::get(&url).map_err(handle_error!(reporter))?;
-  let mut reader = quick_xml::Reader::from_reader(reader);
+/// Reads the document at `url`, it is only read once per compile and parsed from memory.
+fn read_source<FileId: fmt::Debug + Clone>(
+  url: &Url,
+  reporter: &mut dyn DiagnosticReporter<FileId = FileId>,
+) -> Result<String, ()> {
+  fetch(url).map_err(handle_error!(reporter))
+}
+
+/// Compiles the document at `url` (whose content is `source`) into `sink`, returning the
+/// context with its stylesheet and strings.
+fn compile_with<'r, FileId: fmt::Debug + Clone>(
+  url: &Url,
+  source: String,
+  reporter: &'r mut dyn DiagnosticReporter<FileId = FileId>,
+  sink: &'r mut dyn ElementSink,
+  cache: Option<&'r Cache>,
+) -> Result<Context<'r, FileId>, ()> {
+  // The reporter keeps its own copy for printing diagnostics, copying it is cheaper than reading it again.
+  let file_id = reporter.add_file(url.to_string(), source.clone());
+
+  let mut reader = quick_xml::Reader::from_str(&source);
   reader.check_comments(true);
 
   let mut buf = Vec::new();
 
-  let root = Node::new(Element::new(
-    ElementData::Root(RootElement),
-    dom::RawElementAttributes::default(),
-  ));
-
   let mut ctx = Context {
-    root,
+    sink,
     reporter,
     stylesheet: StyleSheet::new(),
+    strings: StringTable::new(),
+    styles: Vec::new(),
+    inputs: Vec::new(),
+    cache,
   };
 
-  ctx.compile_root(&mut reader, &mut buf, &url, &file_id)?;
+  ctx.compile_root(&mut reader, &mut buf, url, &file_id)?;
+  ctx.compile_styles(&file_id)?;
 
   ctx.reporter.checkpoint()?;
 
-  let doc = CompiledDocument::new(ctx.root, ctx.stylesheet);
+  Ok(ctx)
+}
+
+fn compile_inner<URL: IntoUrl, FileId: fmt::Debug + Clone>(
+  url: URL,
+  reporter: &mut dyn DiagnosticReporter<FileId = FileId>,
+  cache: Option<&Cache>,
+) -> Result<(CompiledDocument, Vec<Input>), ()> {
+  let url = url.into_url().map_err(handle_error!(reporter))?;
+
+  let out = read_source(&url, reporter)?;
+
+  let key = cache::key(&(url.as_str(), &out));
+  if let Some(cached) = cache.and_then(|cache| cache.get::<CachedDocument>(Kind::Document, key)) {
+    if cached.inputs.par_iter().all(Input::is_current) {
+      // A cached document that doesn't load is compiled again like any other miss.
+      if let Ok(doc) = CompiledDocument::load(&cached.data) {
+        return Ok((doc, cached.inputs));
+      }
+    }
+  }
+
+  let mut tree = Tree::new(Element::new(
+    ElementData::Root(RootElement),
+    dom::RawElementAttributes::default(),
+  ));
+
+  let ctx = compile_with(&url, out, reporter, &mut tree, cache)?;
+  let (stylesheet, strings, inputs) = (ctx.stylesheet, ctx.strings, ctx.inputs);
+
+  let doc = CompiledDocument::new(tree, stylesheet, strings);
   doc.init_yoga();
 
-  Ok(doc)
+  match cache {
+    Some(cache) => {
+      let cached = CachedDocument {
+        inputs,
+        data: doc.save(),
+      };
+      cache.put(Kind::Document, key, &cached);
+      Ok((doc, cached.inputs))
+    }
+
+    None => Ok((doc, inputs)),
+  }
 }
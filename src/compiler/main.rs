@@ -1,4 +1,10 @@
-use std::path::Path;
+use std::{
+  fs::File,
+  io::{prelude::*, BufWriter},
+  path::{Path, PathBuf},
+  thread,
+  time::{Duration, Instant},
+};
 
 use codespan_reporting::{
   diagnostic::{Diagnostic, Label},
@@ -8,7 +14,8 @@ use codespan_reporting::{
 };
 use cssparser::ToCss;
 
-use compiler::{compile, DiagnosticKind, Level};
+use compiler::{compile_cached, compile_into, compile_watched, Cache, DiagnosticKind, Level, Watcher};
+use rayon::prelude::*;
 
 struct DiagnosticPrinter {
   should_exit: bool,
@@ -178,6 +185,62 @@ impl compiler::DiagnosticReporter for DiagnosticPrinter {
   }
 }
 
+/// How often `--watch` checks the inputs for changes.
+const POLL_INTERVAL: Duration = Duration::from_millis(20);
+
+/// Compiles `input` into `output` for `--watch`, returning the files it was compiled from.
+///
+/// The document is written next to `output` and renamed over it, so apps that reload `output`
+/// never read a partial document.
+fn compile_watched_into(input: &Path, output: &Path, cache: &Cache) -> Option<Vec<PathBuf>> {
+  let start = Instant::now();
+  let mut printer = DiagnosticPrinter::new();
+  let (doc, files) = compile_watched(&input, &mut printer, cache).ok()?;
+
+  let tmp = output.with_extension("cframe.tmp");
+  let written = File::create(&tmp)
+    .and_then(|file| doc.save_into(BufWriter::new(file)))
+    .and_then(|mut writer| writer.flush())
+    .and_then(|()| std::fs::rename(&tmp, output));
+  if let Err(e) = written {
+    eprintln!("couldn't write {}: {}", output.display(), e);
+    let _ = std::fs::remove_file(tmp);
+    return None;
+  }
+
+  eprintln!("compiled {} in {} ms", input.display(), start.elapsed().as_millis());
+  Some(files)
+}
+
+/// Compiles every input, then compiles them again whenever one of the files they were compiled from changes.
+///
+/// A change recompiles the whole document the changed file belongs to. The cache keeps the
+/// stylesheets that didn't change from going through libsass and cssparser again, but the
+/// markup is always parsed again and the whole `.cframe` is rewritten.
+fn watch(inputs: &[&Path], output_for: impl Fn(&Path) -> PathBuf + Sync, cache: &Cache) -> ! {
+  let compile = |input: &Path| compile_watched_into(input, &output_for(input), cache);
+
+  // A document that doesn't compile is compiled again once it changes.
+  let mut watchers: Vec<Watcher> = inputs
+    .par_iter()
+    .map(|input| Watcher::new(compile(input).unwrap_or_else(|| vec![input.to_path_buf()])))
+    .collect();
+
+  loop {
+    thread::sleep(POLL_INTERVAL);
+    inputs
+      .par_iter()
+      .zip(watchers.par_iter_mut())
+      .for_each(|(input, watcher)| {
+        if watcher.changed() {
+          if let Some(files) = compile(input) {
+            *watcher = Watcher::new(files);
+          }
+        }
+      });
+  }
+}
+
 use clap::{App, Arg};
 
 fn main() {
@@ -187,8 +250,9 @@ fn main() {
     .about(env!("CARGO_PKG_DESCRIPTION"))
     .arg(
       Arg::with_name("INPUT")
-        .help("Sets the input file to use")
+        .help("Sets the input files to use")
         .required(true)
+        .multiple(true)
         .index(1),
     )
     .arg(
@@ -196,16 +260,65 @@ fn main() {
         .short("o")
         .long("output")
         .value_name("FILE")
-        .help("Sets the output file")
+        .help("Sets the output file, or the output directory if there are several inputs")
         .required(true)
         .takes_value(true),
     )
+    .arg(
+      Arg::with_name("cache")
+        .long("cache")
+        .value_name("DIR")
+        .help("Keeps compiled stylesheets and documents in DIR, so unchanged inputs aren't compiled again")
+        .takes_value(true),
+    )
+    .arg(
+      Arg::with_name("watch")
+        .short("w")
+        .long("watch")
+        .help("Keeps running and compiles an input again whenever it, its stylesheets or their imports change"),
+    )
     .get_matches();
 
-  let mut printer = DiagnosticPrinter::new();
-  let result = compile(&Path::new(matches.value_of("INPUT").unwrap()), &mut printer);
-  if let Ok(doc) = result {
-    let f = std::fs::File::create(matches.value_of("output").unwrap()).unwrap();
-    doc.save_into(f);
+  let inputs: Vec<_> = matches.values_of("INPUT").unwrap().map(Path::new).collect();
+  let output = Path::new(matches.value_of("output").unwrap());
+  let cache = matches
+    .value_of("cache")
+    .map(|dir| Cache::open(dir).expect("couldn't open the cache"));
+
+  let output_for = |input: &Path| -> PathBuf {
+    if inputs.len() == 1 {
+      output.to_path_buf()
+    } else {
+      output.join(input.with_extension("cframe").file_name().unwrap())
+    }
+  };
+  if inputs.len() > 1 {
+    std::fs::create_dir_all(output).unwrap();
   }
+
+  if matches.is_present("watch") {
+    // Stylesheets that didn't change come from the cache, so only the ones that did are compiled again.
+    let cache = cache.unwrap_or_else(|| {
+      Cache::open(std::env::temp_dir().join("frameui-compiler-cache")).expect("couldn't open the cache")
+    });
+    watch(&inputs, output_for, &cache);
+  }
+
+  // Every document gets its own printer, diagnostics of different documents may interleave.
+  inputs.par_iter().for_each(|input| {
+    let mut printer = DiagnosticPrinter::new();
+    let path = output_for(input);
+    let file = BufWriter::new(File::create(&path).unwrap());
+
+    let result = match &cache {
+      Some(cache) => compile_cached(input, &mut printer, cache).map(|doc| doc.save_into(file).unwrap()),
+      // Without a cache the document is streamed to the file, and never built in memory.
+      None => compile_into(input, &mut printer, file),
+    };
+
+    // Don't leave a partial document behind.
+    if result.is_err() {
+      let _ = std::fs::remove_file(path);
+    }
+  });
 }
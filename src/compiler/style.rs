@@ -1,15 +1,19 @@
 use std::{fmt, io::prelude::*};
 
 use quick_xml::events::BytesStart;
+use rayon::prelude::*;
 use serde::{Deserialize, Serialize};
 use source_map_mappings::{parse_mappings, Bias, Mappings};
 use url::Url;
 
-use style::StyleSheet;
+use style::{StringTable, StyleSheet};
 
-use super::{handle_error_with_location, Context, Diagnostic, DiagnosticKind, Level, Reader};
+use super::{
+  cache::{self, Cache, Input, Kind},
+  fetch, fetch_all, handle_error_with_location, Context, Diagnostic, DiagnosticKind, FetchError, Level,
+};
 
-#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
 enum StyleType {
   CSS,
   Sass,
@@ -22,6 +26,51 @@ enum StyleSource {
   Data(String),
 }
 
+/// A `<Style>` element, stylesheets are only fetched and compiled once the whole document was read.
+#[derive(Debug)]
+pub(crate) struct StyleJob {
+  source: StyleSource,
+  ty: StyleType,
+  /// The line inline CSS starts on in the document, `0` for everything else.
+  offset: usize,
+  /// Where the element is in the document.
+  position: usize,
+}
+
+/// The output of libsass.
+#[derive(Debug, Serialize, Deserialize)]
+struct CompiledCss {
+  css: String,
+  source_map: Option<String>,
+  /// The files that were imported.
+  includes: Vec<Input>,
+}
+
+/// A stylesheet that is ready to be appended to the document's.
+struct CompiledStyle {
+  stylesheet: StyleSheet,
+  /// The strings `stylesheet` refers to.
+  strings: StringTable,
+  /// The files it was produced from.
+  inputs: Vec<Input>,
+}
+
+/// Errors from a worker thread, reported once every stylesheet is done.
+enum StyleError {
+  Fetch(FetchError),
+  Sass {
+    file: String,
+    src: String,
+    line: usize,
+    column: usize,
+    text: String,
+  },
+  Css {
+    css: String,
+    source_map: Option<String>,
+  },
+}
+
 enum SourceMapOrFileId<FileId> {
   SourceMap(SourceMap),
   FileId(FileId),
@@ -63,6 +112,7 @@ impl SourceMap {
 }
 
 impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
+  /// Reads a `<Style>` element, its stylesheet is compiled by `compile_styles`.
   pub fn compile_style<'a, R: BufRead>(
     &mut self,
     e: BytesStart<'a>,
@@ -182,103 +232,274 @@ impl<'r, FileId: fmt::Debug + Clone> Context<'r, FileId> {
       (StyleSource::Data(text), ty.unwrap_or(StyleType::SCSS))
     };
 
-    let (css, offset, source) = match ty {
-      StyleType::CSS => match source {
-        StyleSource::Url(url) => {
-          let mut url_reader = Reader::get(&url).map_err(handle_error_with_location!(self, file_id, reader))?;
-          let mut out = String::new();
-          url_reader
-            .read_to_string(&mut out)
-            .map_err(handle_error_with_location!(self, file_id, reader))?;
-          let file_id = self.reporter.add_file(url.to_string(), out.clone());
-          (out, 0, SourceMapOrFileId::FileId(file_id))
+    // Only inline CSS is parsed as it appears in the document, Sass errors go through the source map.
+    let offset = match (&source, ty) {
+      (StyleSource::Data(..), StyleType::CSS) => offset,
+      _ => 0,
+    };
+    self.styles.push(StyleJob {
+      source,
+      ty,
+      offset,
+      position: reader.buffer_position(),
+    });
+
+    Ok(())
+  }
+
+  /// Fetches, compiles and parses every stylesheet of the document in parallel, then appends
+  /// them to the document's stylesheet in document order and sorts its rules into cascade order.
+  ///
+  /// Every error is reported, not only the first one.
+  pub fn compile_styles(&mut self, file_id: &FileId) -> Result<(), ()> {
+    let cache = self.cache;
+    let jobs = std::mem::take(&mut self.styles);
+
+    // Linked stylesheets are all requested at once, instead of every worker waiting on its own.
+    let urls: Vec<_> = jobs
+      .iter()
+      .filter_map(|job| match &job.source {
+        StyleSource::Url(url) => Some(url.clone()),
+        StyleSource::Data(_) => None,
+      })
+      .collect();
+    let mut fetched = fetch_all(&urls).into_iter();
+    let texts: Vec<_> = jobs
+      .iter()
+      .map(|job| match job.source {
+        StyleSource::Url(_) => fetched.next(),
+        StyleSource::Data(_) => None,
+      })
+      .collect();
+
+    let results: Vec<_> = jobs
+      .par_iter()
+      .zip(texts)
+      .map(|(job, text)| job.run(cache, text))
+      .collect();
+
+    let mut failed = false;
+    for (job, result) in jobs.iter().zip(results) {
+      match result {
+        Ok(compiled) => {
+          self
+            .stylesheet
+            .append(compiled.stylesheet, &compiled.strings, &mut self.strings);
+          self.inputs.extend(compiled.inputs);
         }
 
-        StyleSource::Data(text) => (text, offset, SourceMapOrFileId::FileId(file_id.clone())),
-      },
+        Err(e) => {
+          self.report_style_error(job, e, file_id);
+          failed = true;
+        }
+      }
+    }
 
-      ty => {
-        let (text, url) = match source {
-          StyleSource::Url(url) => {
-            let mut url_reader = Reader::get(&url).map_err(handle_error_with_location!(self, file_id, reader))?;
+    if failed {
+      return Err(());
+    }
 
-            let mut out = String::new();
-            url_reader
-              .read_to_string(&mut out)
-              .map_err(handle_error_with_location!(self, file_id, reader))?;
+    // Matching applies rules in index order, so the cascade is settled here once.
+    self.stylesheet.sort_by_specificity(&mut self.strings);
+    Ok(())
+  }
+
+  fn report_style_error(&mut self, job: &StyleJob, e: StyleError, file_id: &FileId) {
+    match e {
+      StyleError::Fetch(e) => {
+        self.reporter.add_diagnostic(Diagnostic {
+          location: Some((file_id.clone(), job.position)),
+          min_level: Level::Error,
+          kind: e.into(),
+        });
+      }
 
-            (out, url)
+      StyleError::Sass {
+        file,
+        src,
+        line,
+        column,
+        text,
+      } => {
+        let file_id = self.reporter.add_file(file, src);
+        let pos = self.reporter.get_position(&file_id, line - 1, column);
+        self.reporter.add_diagnostic(Diagnostic {
+          location: Some((file_id, pos)),
+          min_level: Level::Error,
+          kind: DiagnosticKind::SassParseError(text),
+        });
+      }
+
+      StyleError::Css { css, source_map } => {
+        let source = match (source_map, &job.source) {
+          (Some(source_map), _) => SourceMapOrFileId::SourceMap(SourceMap::parse(&source_map)),
+          (None, StyleSource::Url(url)) => {
+            SourceMapOrFileId::FileId(self.reporter.add_file(url.to_string(), css.clone()))
           }
+          (None, StyleSource::Data(..)) => SourceMapOrFileId::FileId(file_id.clone()),
+        };
 
-          StyleSource::Data(text) => (text, Url::parse("file:///C/bar.txt").unwrap()),
+        // Parse errors borrow the CSS, so the worker only says that parsing failed and
+        // the stylesheet is parsed again here to get the error.
+        let mut input = StyleSheet::create_parser_input_with_line_offset(&css, job.offset as u32);
+        let e = match StyleSheet::new().parse(&mut input, &mut StringTable::new()) {
+          Ok(()) => unreachable!("the stylesheet parsed the second time"),
+          Err(e) => e,
         };
 
-        let ctx = sass::DataContext::new(&text).unwrap();
-        let opt = ctx.options();
-        opt.set_input_path(url.as_str()).unwrap();
-        opt.set_source_map_file("stdin").unwrap();
-        opt.set_source_map_contents(true);
-        opt.set_is_indented_syntax_src(ty == StyleType::Sass);
-
-        let compiled = ctx.compile().map_err(|e| {
-          let file_id = self.reporter.add_file(e.file().unwrap(), e.src().unwrap());
-          let pos = self
-            .reporter
-            .get_position(&file_id, e.line() as usize - 1, e.column() as usize);
-          self.reporter.add_diagnostic(Diagnostic {
-            location: Some((file_id, pos)),
-            min_level: Level::Error,
-            kind: DiagnosticKind::SassParseError(e.text().unwrap()),
-          });
-        })?;
-
-        let css = compiled.output().unwrap();
-        let source_map = unsafe { compiled.source_map().unwrap() };
-        let source_map = SourceMap::parse(&source_map);
-
-        (css, 0, SourceMapOrFileId::SourceMap(source_map))
+        let location = match source {
+          SourceMapOrFileId::FileId(file_id) => {
+            let pos = self
+              .reporter
+              .get_position(&file_id, e.0.location.line as usize, e.0.location.column as usize);
+            Some((file_id, pos))
+          }
+
+          SourceMapOrFileId::SourceMap(source_map) => {
+            let original_location = source_map
+              .mappings
+              .original_location_for(e.0.location.line, e.0.location.column, Bias::GreatestLowerBound)
+              .unwrap();
+            let original_location = original_location.original.as_ref().unwrap();
+
+            let file_id = self.reporter.add_file(
+              source_map.sources[original_location.source as usize].clone(),
+              source_map.sources_content[original_location.source as usize].clone(),
+            );
+
+            let pos = self.reporter.get_position(
+              &file_id,
+              original_location.original_line as usize,
+              original_location.original_column as usize,
+            );
+
+            Some((file_id, pos))
+          }
+        };
+
+        self.reporter.add_diagnostic(Diagnostic {
+          location,
+          min_level: Level::Error,
+          kind: DiagnosticKind::CssParseError(e),
+        });
       }
+    }
+  }
+}
+
+impl StyleJob {
+  /// Produces the stylesheet from the content of its URL (if it was already fetched), this
+  /// runs on a worker thread.
+  fn run(&self, cache: Option<&Cache>, text: Option<Result<String, FetchError>>) -> Result<CompiledStyle, StyleError> {
+    let mut inputs = Vec::new();
+    let (text, url) = match &self.source {
+      StyleSource::Url(url) => {
+        let text = text.unwrap_or_else(|| fetch(url)).map_err(StyleError::Fetch)?;
+        inputs.push(Input::new(url, &text));
+        (text, url.clone())
+      }
+
+      StyleSource::Data(text) => (text.clone(), Url::parse("file:///C/bar.txt").unwrap()),
     };
 
-    let mut input = StyleSheet::create_parser_input_with_line_offset(&css, offset as u32);
-    self.stylesheet.parse(&mut input).map_err(|e| {
-      let location = match source {
-        SourceMapOrFileId::FileId(file_id) => {
-          let pos = self
-            .reporter
-            .get_position(&file_id, e.0.location.line as usize, e.0.location.column as usize);
-          Some((file_id, pos))
-        }
+    let css = match self.ty {
+      StyleType::CSS => CompiledCss {
+        css: text,
+        source_map: None,
+        includes: Vec::new(),
+      },
 
-        SourceMapOrFileId::SourceMap(source_map) => {
-          let original_location = source_map
-            .mappings
-            .original_location_for(e.0.location.line, e.0.location.column, Bias::GreatestLowerBound)
-            .unwrap();
-          let original_location = original_location.original.as_ref().unwrap();
-
-          let file_id = self.reporter.add_file(
-            source_map.sources[original_location.source as usize].clone(),
-            source_map.sources_content[original_location.source as usize].clone(),
-          );
-
-          let pos = self.reporter.get_position(
-            &file_id,
-            original_location.original_line as usize,
-            original_location.original_column as usize,
-          );
-
-          Some((file_id, pos))
+      ty => {
+        // Imports are resolved relative to the input path, so it is part of the key too.
+        let key = cache::key(&(ty, url.as_str(), &text));
+        let cached = cache
+          .and_then(|cache| cache.get::<CompiledCss>(Kind::Css, key))
+          .filter(|css| css.includes.iter().all(Input::is_current));
+
+        match cached {
+          Some(css) => css,
+          None => {
+            let css = compile_sass(&text, &url, ty)?;
+            if let Some(cache) = cache {
+              cache.put(Kind::Css, key, &css);
+            }
+            css
+          }
         }
-      };
+      }
+    };
+    inputs.extend(css.includes.iter().cloned());
+
+    let key = cache::key(&(&css.css, self.offset));
+    if let Some((stylesheet, cached_strings)) =
+      cache.and_then(|cache| cache.get::<(StyleSheet, String)>(Kind::StyleSheet, key))
+    {
+      let mut strings = StringTable::new();
+      strings.push(&cached_strings);
+      return Ok(CompiledStyle {
+        stylesheet,
+        strings,
+        inputs,
+      });
+    }
 
-      self.reporter.add_diagnostic(Diagnostic {
-        location,
-        min_level: Level::Error,
-        kind: DiagnosticKind::CssParseError(e),
+    let mut stylesheet = StyleSheet::new();
+    let mut strings = StringTable::new();
+    let parsed = {
+      let mut input = StyleSheet::create_parser_input_with_line_offset(&css.css, self.offset as u32);
+      stylesheet.parse(&mut input, &mut strings).is_ok()
+    };
+    if !parsed {
+      return Err(StyleError::Css {
+        css: css.css,
+        source_map: css.source_map,
       });
-    })?;
+    }
 
-    Ok(())
+    if let Some(cache) = cache {
+      cache.put(Kind::StyleSheet, key, &(&stylesheet, strings.as_str()));
+    }
+
+    Ok(CompiledStyle {
+      stylesheet,
+      strings,
+      inputs,
+    })
   }
 }
+
+fn compile_sass(text: &str, url: &Url, ty: StyleType) -> Result<CompiledCss, StyleError> {
+  let ctx = sass::DataContext::new(text).unwrap();
+  let opt = ctx.options();
+  opt.set_input_path(url.as_str()).unwrap();
+  opt.set_source_map_file("stdin").unwrap();
+  opt.set_source_map_contents(true);
+  opt.set_is_indented_syntax_src(ty == StyleType::Sass);
+
+  let compiled = ctx.compile().map_err(|e| StyleError::Sass {
+    file: e.file().unwrap(),
+    src: e.src().unwrap(),
+    line: e.line() as usize,
+    column: e.column() as usize,
+    text: e.text().unwrap(),
+  })?;
+
+  // The input itself is already an input of the stylesheet, and libsass lists it by the
+  // URL it was given rather than a path.
+  let includes = compiled
+    .included_files()
+    .unwrap()
+    .into_iter()
+    .filter_map(|path| {
+      let url = Url::from_file_path(path).ok()?;
+      let content = fetch(&url).ok()?;
+      Some(Input::new(&url, &content))
+    })
+    .collect();
+
+  Ok(CompiledCss {
+    css: compiled.output().unwrap(),
+    source_map: Some(unsafe { compiled.source_map().unwrap() }),
+    includes,
+  })
+}
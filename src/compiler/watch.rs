@@ -0,0 +1,45 @@
+use std::{
+  fs,
+  path::{Path, PathBuf},
+  time::SystemTime,
+};
+
+/// Polls the files a document was compiled from (see `compile_watched`) for changes.
+///
+/// Polling a handful of files every few milliseconds is cheap, and unlike file system events
+/// it behaves the same whether editors write files in place or replace them.
+#[derive(Debug, Clone)]
+pub struct Watcher {
+  files: Vec<(PathBuf, Option<SystemTime>)>,
+}
+
+fn modified(path: &Path) -> Option<SystemTime> {
+  fs::metadata(path).and_then(|metadata| metadata.modified()).ok()
+}
+
+impl Watcher {
+  #[must_use]
+  pub fn new(files: Vec<PathBuf>) -> Self {
+    Self {
+      files: files
+        .into_iter()
+        .map(|path| {
+          let modified = modified(&path);
+          (path, modified)
+        })
+        .collect(),
+    }
+  }
+
+  /// Returns true if any of the files was modified, created or removed since the last call.
+  pub fn changed(&mut self) -> bool {
+    let mut changed = false;
+    // Every file is checked, so changes saved together only count once.
+    for (path, last_modified) in &mut self.files {
+      let modified = modified(path);
+      changed |= modified != *last_modified;
+      *last_modified = modified;
+    }
+    changed
+  }
+}
@@ -261,7 +261,10 @@ fn generate_properties(
       };
 
       let (def, ty) = if prop.optional.unwrap_or_default() {
-        (quote!(#[serde(default)]), quote!(Option<#ty>))
+        (
+          quote!(#[serde(default, skip_serializing_if = "Option::is_none")]),
+          quote!(Option<#ty>),
+        )
       } else {
         (quote!(), ty)
       };
@@ -309,6 +312,7 @@ fn main() {
     let mut types = Vec::new();
     let mut commands = Vec::new();
     let mut command_results = Vec::new();
+    let mut events = Vec::new();
 
     for ty in domain.types.clone().unwrap_or_default() {
       let ident = format_ident!("{}", ty.id);
@@ -426,6 +430,45 @@ fn main() {
       }
     }
 
+    for event in domain.events.as_ref().unwrap_or(&Vec::new()) {
+      let name = format!("{}.{}", domain.domain, event.name);
+      let ident = format_ident!("{}", uppercase_first(&event.name));
+      let description = event.description.clone().unwrap_or_default();
+
+      if let Some(parameters) = &event.parameters {
+        // Suffixed, since events and commands can have the same name.
+        let params_ident = format_ident!("{}Event", ident);
+        let props = generate_properties(
+          &params_ident,
+          &mut types,
+          parameters,
+          true,
+          &domain.domain,
+          &browser.domains,
+        );
+
+        types.push(quote!(
+          #[doc = #description]
+          #[derive(Debug, Clone, PartialEq, serde::Serialize)]
+          pub struct #params_ident {
+            #(#props),*
+          }
+        ));
+
+        events.push(quote!(
+          #[serde(rename = #name)]
+          #[doc = #description]
+          #ident(#params_ident)
+        ));
+      } else {
+        events.push(quote!(
+          #[serde(rename = #name)]
+          #[doc = #description]
+          #ident
+        ));
+      }
+    }
+
     let ident = format_ident!("{}", domain.domain.to_lowercase());
     let description = domain.description.clone().unwrap_or_default();
     let dependencies = format!(
@@ -449,6 +492,12 @@ fn main() {
         pub enum CommandResult {
           #(#command_results),*
         }
+
+        #[derive(Debug, Clone, PartialEq, serde::Serialize)]
+        #[serde(tag = "method", content = "params")]
+        pub enum Event {
+          #(#events),*
+        }
       }
     ));
   }
@@ -459,6 +508,12 @@ fn main() {
     quote!(#variant_ident(#mod_ident::Command))
   });
 
+  let event_variants = domain_names.iter().map(|name| {
+    let variant_ident = format_ident!("{}", name);
+    let mod_ident = format_ident!("{}", name.to_lowercase());
+    quote!(#variant_ident(#mod_ident::Event))
+  });
+
   let command_result_variants = domain_names.iter().map(|name| {
     let variant_ident = format_ident!("{}", name);
     let mod_ident = format_ident!("{}", name.to_lowercase());
@@ -497,6 +552,13 @@ fn main() {
     pub enum CommandResultData {
       #(#command_result_variants),*
     }
+
+    /// A message the backend sends without being asked, like `DOM.childNodeInserted`.
+    #[derive(Debug, Clone, PartialEq, serde::Serialize)]
+    #[serde(untagged)]
+    pub enum Event {
+      #(#event_variants),*
+    }
   );
 
   let path = Path::new(&env::var("OUT_DIR").unwrap()).join("bindings.rs");
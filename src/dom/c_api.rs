@@ -0,0 +1,238 @@
+#![allow(non_snake_case)]
+
+use std::{ffi::CStr, os::raw::c_char, sync::Arc};
+
+use super::*;
+
+/// Returned instead of a node id when there is no such node.
+const NO_NODE: u32 = u32::MAX;
+
+unsafe fn to_str<'a>(s: *const c_char) -> Option<&'a str> {
+  CStr::from_ptr(s).to_str().ok()
+}
+
+#[allow(non_snake_case)]
+impl CompiledDocument {
+  /// Memory maps the `.cframe` file at `path` and loads it, reading its strings in place.
+  ///
+  /// The elements and the stylesheet are still copied into the document's own memory.
+  ///
+  /// Returns null if the file can't be opened or isn't a valid document.
+  /// The file must not be modified while the document is alive.
+  #[no_mangle]
+  #[doc = "module=dom,index=0"]
+  pub unsafe extern "C" fn CompiledDocument_load_mmap(path: *const c_char) -> *const Self {
+    let path = match to_str(path) {
+      Some(path) => path,
+      None => return std::ptr::null(),
+    };
+
+    match Self::load_mmap(path) {
+      Ok(doc) => Arc::into_raw(Arc::new(doc)),
+      Err(_) => std::ptr::null(),
+    }
+  }
+
+  /// Returns a new reference to the document, functions that take ownership of
+  /// a document (like `EventHandler_new`) consume one reference.
+  #[no_mangle]
+  #[doc = "module=dom,index=1"]
+  pub unsafe extern "C" fn CompiledDocument_clone(&self) -> *const Self {
+    let doc = Arc::from_raw(self as *const Self);
+    let out = Arc::clone(&doc);
+    Arc::into_raw(doc);
+    Arc::into_raw(out)
+  }
+
+  /// Releases one reference, the document is freed with the last one.
+  ///
+  /// The interned class names, ids and selector names are shared by every document and are
+  /// never freed. A process can intern a few million different names, after that new ones
+  /// are ignored and never match a selector.
+  #[no_mangle]
+  #[doc = "module=dom,index=2"]
+  pub unsafe extern "C" fn CompiledDocument_drop(&self) {
+    drop(Arc::from_raw(self as *const Self));
+  }
+
+  /// Sets the number of threads used to match styles, `0` and `1` restyle on the rendering thread.
+  #[no_mangle]
+  #[doc = "module=dom,index=3"]
+  pub unsafe extern "C" fn CompiledDocument_set_style_threads(&self, threads: u32) {
+    self.set_style_threads(threads as usize);
+  }
+
+  /// Starts a batch of changes, see `Transaction_*`. Nothing changes until `CompiledDocument_commit`.
+  #[no_mangle]
+  #[doc = "module=dom,index=4"]
+  pub unsafe extern "C" fn CompiledDocument_begin_transaction(&self) -> *mut Transaction {
+    Box::into_raw(Box::new(self.transaction()))
+  }
+
+  /// Applies and frees `txn`, the changes show up in the next frame.
+  ///
+  /// Returns false without changing anything if `txn` appends elements and another
+  /// transaction appended or removed elements since it was started.
+  #[no_mangle]
+  #[doc = "module=dom,index=5"]
+  pub unsafe extern "C" fn CompiledDocument_commit(&self, txn: *mut Transaction) -> bool {
+    self.commit(*Box::from_raw(txn))
+  }
+
+  /// Returns the first element matching `selector`, or `UINT32_MAX` if there is none.
+  ///
+  /// The root element is always `0`.
+  #[no_mangle]
+  #[doc = "module=dom,index=6"]
+  pub unsafe extern "C" fn CompiledDocument_query_selector(&self, selector: *const c_char) -> u32 {
+    to_str(selector)
+      .and_then(|selector| self.query_selector(selector))
+      .map_or(NO_NODE, |id| id.index() as u32)
+  }
+
+  /// Measures the memory the document holds on to.
+  #[no_mangle]
+  #[doc = "module=dom,index=7"]
+  pub unsafe extern "C" fn CompiledDocument_memory_report(&self) -> DocumentMemoryReport {
+    self.memory_report()
+  }
+
+  /// Frees compiled scripts and parsed selectors, for documents that aren't being shown.
+  /// They are rebuilt the first time they are needed again.
+  #[no_mangle]
+  #[doc = "module=dom,index=8"]
+  pub unsafe extern "C" fn CompiledDocument_trim(&self) {
+    self.trim();
+  }
+}
+
+#[allow(non_snake_case)]
+impl Transaction {
+  fn node(&self, node: u32) -> Option<NodeId> {
+    let node = NodeId::from_index(node as usize);
+    if self.contains(node) {
+      Some(node)
+    } else {
+      None
+    }
+  }
+
+  /// Frees `txn` without applying it.
+  #[no_mangle]
+  #[doc = "module=dom,index=0"]
+  pub unsafe extern "C" fn Transaction_drop(&mut self) {
+    drop(Box::from_raw(self as *mut Self));
+  }
+
+  #[no_mangle]
+  #[doc = "module=dom,index=1"]
+  pub unsafe extern "C" fn Transaction_set_variable_int(&mut self, name: *const c_char, value: i64) -> bool {
+    match to_str(name) {
+      Some(name) => {
+        self.set_variable(name, value);
+        true
+      }
+      None => false,
+    }
+  }
+
+  #[no_mangle]
+  #[doc = "module=dom,index=2"]
+  pub unsafe extern "C" fn Transaction_set_variable_float(&mut self, name: *const c_char, value: f64) -> bool {
+    match to_str(name) {
+      Some(name) => {
+        self.set_variable(name, value);
+        true
+      }
+      None => false,
+    }
+  }
+
+  #[no_mangle]
+  #[doc = "module=dom,index=3"]
+  pub unsafe extern "C" fn Transaction_set_variable_bool(&mut self, name: *const c_char, value: bool) -> bool {
+    match to_str(name) {
+      Some(name) => {
+        self.set_variable(name, value);
+        true
+      }
+      None => false,
+    }
+  }
+
+  #[no_mangle]
+  #[doc = "module=dom,index=4"]
+  pub unsafe extern "C" fn Transaction_set_variable_string(
+    &mut self,
+    name: *const c_char,
+    value: *const c_char,
+  ) -> bool {
+    match (to_str(name), to_str(value)) {
+      (Some(name), Some(value)) => {
+        self.set_variable(name, value.to_string());
+        true
+      }
+      _ => false,
+    }
+  }
+
+  /// Sets `class`, `id`, or their script versions `:class` and `:id`. A null `value` removes the attribute.
+  ///
+  /// Returns false if `node` or `name` is unknown, or if a script `value` doesn't compile.
+  #[no_mangle]
+  #[doc = "module=dom,index=5"]
+  pub unsafe extern "C" fn Transaction_set_attribute(
+    &mut self,
+    node: u32,
+    name: *const c_char,
+    value: *const c_char,
+  ) -> bool {
+    let node = match self.node(node) {
+      Some(node) => node,
+      None => return false,
+    };
+
+    let (attribute, script) = match to_str(name) {
+      Some("class") => (Attribute::Class, false),
+      Some(":class") => (Attribute::Class, true),
+      Some("id") => (Attribute::Id, false),
+      Some(":id") => (Attribute::Id, true),
+      _ => return false,
+    };
+
+    let value = if value.is_null() {
+      None
+    } else {
+      match to_str(value) {
+        Some(value) => Some(value),
+        None => return false,
+      }
+    };
+
+    self.set_attribute(node, attribute, script, value).is_ok()
+  }
+
+  /// Appends an element to `parent`, returning the id it will have once the transaction is
+  /// committed, or `UINT32_MAX` if `parent` doesn't exist. The new id can be used in the same transaction.
+  #[no_mangle]
+  #[doc = "module=dom,index=6"]
+  pub unsafe extern "C" fn Transaction_append(&mut self, parent: u32) -> u32 {
+    match self.node(parent) {
+      Some(parent) => self.append(parent).index() as u32,
+      None => NO_NODE,
+    }
+  }
+
+  /// Removes `node` and its subtree. Returns false if `node` doesn't exist or is the root.
+  #[no_mangle]
+  #[doc = "module=dom,index=7"]
+  pub unsafe extern "C" fn Transaction_remove(&mut self, node: u32) -> bool {
+    match self.node(node) {
+      Some(node) if node.index() != 0 => {
+        self.remove(node);
+        true
+      }
+      _ => false,
+    }
+  }
+}
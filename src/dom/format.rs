@@ -0,0 +1,294 @@
+//! The on-disk layout of a `.cframe` file.
+//!
+//! ```text
+//! offset  size  field
+//!      0     5  MAGIC_BYTES (the last byte is the format version)
+//!      5     3  padding
+//!      8     8  strings offset
+//!     16     8  strings length
+//!     24     8  body offset
+//!     32     8  body length
+//!     40     8  nodes offset
+//!     48     8  nodes length
+//!     56        sections
+//! ```
+//!
+//! All integers are little endian and every section starts on an 8 byte boundary, so the
+//! file can be mmapped (or embedded with `include_bytes!`) and read in place. The strings
+//! section is the UTF-8 string table every `StrRef` in the document points into, and the
+//! body is the bincode encoded `StyleSheet`. Only the strings are read in place for now, the
+//! nodes and the body are deserialized into memory the document owns when it's loaded.
+//!
+//! The nodes section is a bincode encoded `(Option<NodeId>, Element)` per node, the parent and
+//! the element, in `NodeId` order. Children always come after their parent and are appended in
+//! order, so that is enough to rebuild the tree. It also means elements can be written as soon
+//! as they're read, which is what `DocumentWriter` does. The sections are written in the order
+//! nodes, strings, body, and the header is filled in last.
+//!
+//! Loading checks the same rules, a nodes section that has bytes left over which don't decode
+//! to a record, or a record whose parent comes after it, is an `InvalidData` error.
+
+use std::{
+  convert::TryInto,
+  io::{self, Seek, SeekFrom, Write},
+  ops::Range,
+};
+
+use serde::Serialize;
+
+use super::{tree::NodeId, ElementData, RawElementAttributes, RootElement, MAGIC_BYTES};
+
+pub const HEADER_LEN: usize = 56;
+pub const ALIGNMENT: usize = 8;
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Header {
+  pub strings: Range<usize>,
+  pub body: Range<usize>,
+  pub nodes: Range<usize>,
+}
+
+#[must_use]
+pub fn align(offset: usize) -> usize {
+  (offset + ALIGNMENT - 1) & !(ALIGNMENT - 1)
+}
+
+impl Header {
+  pub fn write<W: io::Write>(&self, mut writer: W) -> io::Result<()> {
+    let mut header = [0; HEADER_LEN];
+    header[..MAGIC_BYTES.len()].copy_from_slice(MAGIC_BYTES);
+    header[8..16].copy_from_slice(&(self.strings.start as u64).to_le_bytes());
+    header[16..24].copy_from_slice(&(self.strings.len() as u64).to_le_bytes());
+    header[24..32].copy_from_slice(&(self.body.start as u64).to_le_bytes());
+    header[32..40].copy_from_slice(&(self.body.len() as u64).to_le_bytes());
+    header[40..48].copy_from_slice(&(self.nodes.start as u64).to_le_bytes());
+    header[48..56].copy_from_slice(&(self.nodes.len() as u64).to_le_bytes());
+    writer.write_all(&header)
+  }
+
+  /// Reads and validates the header at the start of `data`.
+  pub fn read(data: &[u8]) -> io::Result<Self> {
+    let invalid = |msg: String| io::Error::new(io::ErrorKind::InvalidData, msg);
+
+    if data.len() < HEADER_LEN {
+      return Err(invalid(format!("file is too short ({} bytes)", data.len())));
+    }
+
+    let magic_bytes = &data[..MAGIC_BYTES.len()];
+    if magic_bytes != MAGIC_BYTES {
+      return Err(invalid(format!(
+        "magic bytes don't match {:?} == {:?}",
+        magic_bytes, MAGIC_BYTES
+      )));
+    }
+
+    let field = |offset: usize| u64::from_le_bytes(data[offset..offset + 8].try_into().unwrap()) as usize;
+    let section = |offset: usize| -> io::Result<Range<usize>> {
+      let start = field(offset);
+      let end = start
+        .checked_add(field(offset + 8))
+        .filter(|&end| end <= data.len())
+        .ok_or_else(|| invalid("section is out of bounds".to_string()))?;
+
+      if start % ALIGNMENT != 0 {
+        return Err(invalid("section is not aligned".to_string()));
+      }
+
+      Ok(start..end)
+    };
+
+    Ok(Self {
+      strings: section(8)?,
+      body: section(24)?,
+      nodes: section(40)?,
+    })
+  }
+}
+
+/// Counts the bytes written, so sections know where they start and end.
+struct Counted<W> {
+  inner: W,
+  position: usize,
+}
+
+impl<W: Write> Write for Counted<W> {
+  fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+    let written = self.inner.write(buf)?;
+    self.position += written;
+    Ok(written)
+  }
+
+  fn flush(&mut self) -> io::Result<()> {
+    self.inner.flush()
+  }
+}
+
+impl<W: Write> Counted<W> {
+  /// Pads the output to the next section boundary and returns where the section starts.
+  fn start_section(&mut self) -> io::Result<usize> {
+    let start = align(self.position);
+    self.write_all(&[0; ALIGNMENT][..start - self.position])?;
+    Ok(start)
+  }
+}
+
+/// How an element is laid out in the nodes section, the same as `Element`'s `Serialize` impl.
+#[derive(Serialize)]
+struct ElementRecord<'a> {
+  data: &'a ElementData,
+  raw_attributes: &'a RawElementAttributes,
+  style: &'a [style::StyleRule],
+}
+
+/// Writes a `.cframe` one element at a time.
+///
+/// Elements go straight to the writer, so a document never has to exist in memory as a tree
+/// (or be serialized twice to find out how big it is). The root element is written by `new`.
+pub struct DocumentWriter<W: Write + Seek> {
+  out: Counted<W>,
+  len: usize,
+}
+
+impl<W: Write + Seek> DocumentWriter<W> {
+  /// Starts a document at the current position of `writer`.
+  pub fn new(writer: W) -> io::Result<Self> {
+    let mut doc = Self::without_root(writer)?;
+    doc.append_record(None, ElementData::Root(RootElement), &RawElementAttributes::default())?;
+    Ok(doc)
+  }
+
+  /// Starts a document whose root is written with `push`, for saving an existing tree.
+  pub(crate) fn without_root(writer: W) -> io::Result<Self> {
+    let mut out = Counted {
+      inner: writer,
+      position: 0,
+    };
+    // Filled in by `finish`, once the sections are known.
+    out.write_all(&[0; HEADER_LEN])?;
+
+    Ok(Self { out, len: 0 })
+  }
+
+  fn append_record(
+    &mut self,
+    parent: Option<NodeId>,
+    data: ElementData,
+    raw_attributes: &RawElementAttributes,
+  ) -> io::Result<NodeId> {
+    self.push(
+      parent,
+      &ElementRecord {
+        data: &data,
+        raw_attributes,
+        style: &[],
+      },
+    )
+  }
+
+  /// Writes one node, `element` is an `Element` or an `ElementRecord`.
+  ///
+  /// Returns an `InvalidInput` error without writing anything if `parent` hasn't been written yet.
+  pub(crate) fn push<T: Serialize>(&mut self, parent: Option<NodeId>, element: &T) -> io::Result<NodeId> {
+    if let Some(parent) = parent.filter(|parent| parent.index() >= self.len) {
+      let msg = format!("{:?} hasn't been written", parent);
+      return Err(io::Error::new(io::ErrorKind::InvalidInput, msg));
+    }
+
+    bincode::serialize_into(&mut self.out, &(parent, element)).map_err(|e| io::Error::new(io::ErrorKind::Other, e))?;
+    let id = NodeId::from_index(self.len);
+    self.len += 1;
+    Ok(id)
+  }
+
+  /// Appends an element to `parent`, returning its id.
+  ///
+  /// Every `StrRef` in `raw_attributes` must point into the string table passed to `finish`.
+  pub fn append(
+    &mut self,
+    parent: NodeId,
+    data: ElementData,
+    raw_attributes: &RawElementAttributes,
+  ) -> io::Result<NodeId> {
+    self.append_record(Some(parent), data, raw_attributes)
+  }
+
+  /// Writes the strings and the stylesheet, then the header, and returns the writer.
+  pub fn finish(mut self, stylesheet: &style::StyleSheet, strings: &style::StringTable) -> io::Result<W> {
+    let nodes = HEADER_LEN..self.out.position;
+
+    let start = self.out.start_section()?;
+    self.out.write_all(strings.as_str().as_bytes())?;
+    let strings = start..self.out.position;
+
+    let start = self.out.start_section()?;
+    bincode::serialize_into(&mut self.out, stylesheet).map_err(|e| io::Error::new(io::ErrorKind::Other, e))?;
+    let end = self.out.position;
+    let body = start..end;
+
+    // Seek relative to the end, the document doesn't have to start at the start of the stream.
+    let mut writer = self.out.inner;
+    writer.seek(SeekFrom::Current(-(end as i64)))?;
+    Header { strings, body, nodes }.write(&mut writer)?;
+    writer.seek(SeekFrom::Current((end - HEADER_LEN) as i64))?;
+    Ok(writer)
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::{CompiledDocument, UnstyledElement};
+
+  fn writer() -> DocumentWriter<io::Cursor<Vec<u8>>> {
+    DocumentWriter::new(io::Cursor::new(Vec::new())).unwrap()
+  }
+
+  fn finish(doc: DocumentWriter<io::Cursor<Vec<u8>>>) -> Vec<u8> {
+    doc
+      .finish(&style::StyleSheet::new(), &style::StringTable::new())
+      .unwrap()
+      .into_inner()
+  }
+
+  fn unstyled() -> ElementData {
+    ElementData::Unstyled(UnstyledElement)
+  }
+
+  #[test]
+  fn written_documents_load() {
+    let mut doc = writer();
+    let attrs = RawElementAttributes::default();
+    let a = doc.append(NodeId::from_index(0), unstyled(), &attrs).unwrap();
+    doc.append(a, unstyled(), &attrs).unwrap();
+    doc.append(NodeId::from_index(0), unstyled(), &attrs).unwrap();
+
+    let doc = CompiledDocument::load(&finish(doc)).unwrap();
+    let tree = doc.tree.read().unwrap();
+    let parents: Vec<_> = tree.nodes().map(|node| node.parent()).collect();
+    assert_eq!(parents, [None, Some(tree.root()), Some(a), Some(tree.root())]);
+  }
+
+  #[test]
+  fn parents_must_be_written_first() {
+    let mut doc = writer();
+    let attrs = RawElementAttributes::default();
+    let err = doc.append(NodeId::from_index(1), unstyled(), &attrs).unwrap_err();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidInput);
+
+    // Nothing was written, so the next element still gets the id after the root.
+    assert_eq!(
+      doc.append(NodeId::from_index(0), unstyled(), &attrs).unwrap(),
+      NodeId::from_index(1)
+    );
+    assert!(CompiledDocument::load(&finish(doc)).is_ok());
+  }
+
+  #[test]
+  fn trailing_bytes_fail_to_load() {
+    let mut doc = writer();
+    doc.out.write_all(&[0xff; 3]).unwrap();
+
+    let err = CompiledDocument::load(&finish(doc)).unwrap_err();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+  }
+}
@@ -0,0 +1,123 @@
+use style::Overflow;
+
+use super::{
+  tree::{NodeId, Tree},
+  Element,
+};
+
+/// The index `LayoutCache::index_of` doesn't return, for nodes that aren't in the document.
+const NONE: u32 = u32::MAX;
+
+/// The final boxes of a document's elements, in document order, one array per field.
+///
+/// Rebuilt by `CompiledDocument::compute_style` after every yoga pass, so consumers walk flat
+/// arrays instead of the tree, and don't ask yoga for each box through FFI. Positions are
+/// absolute (yoga's are relative to the parent). Every array has one entry per element that
+/// is attached to the document, detached subtrees are left out.
+#[derive(Debug, Default)]
+pub struct LayoutCache {
+  pub nodes: Vec<NodeId>,
+  /// The position of each element's parent, `u32::MAX` for the root.
+  pub parent: Vec<u32>,
+  /// The position after each element's last descendant, skipping a subtree jumps there.
+  pub subtree_end: Vec<u32>,
+  pub x: Vec<f32>,
+  pub y: Vec<f32>,
+  pub width: Vec<f32>,
+  pub height: Vec<f32>,
+  pub background_color: Vec<(u8, u8, u8, u8)>,
+  pub overflow: Vec<Overflow>,
+  /// The position of every node, indexed by `NodeId`.
+  index: Vec<u32>,
+}
+
+impl LayoutCache {
+  #[must_use]
+  pub fn len(&self) -> usize {
+    self.nodes.len()
+  }
+
+  #[must_use]
+  pub fn is_empty(&self) -> bool {
+    self.nodes.is_empty()
+  }
+
+  /// Returns the position of `node` in the arrays, or `None` if it isn't in the document.
+  #[must_use]
+  pub fn index_of(&self, node: NodeId) -> Option<usize> {
+    match self.index.get(node.index()) {
+      Some(&index) if index != NONE => Some(index as usize),
+      _ => None,
+    }
+  }
+
+  /// The memory the arrays take up, in bytes.
+  #[must_use]
+  pub fn allocated_bytes(&self) -> usize {
+    use std::mem::size_of;
+
+    self.nodes.capacity() * size_of::<NodeId>()
+      + (self.parent.capacity() + self.subtree_end.capacity() + self.index.capacity()) * size_of::<u32>()
+      + (self.x.capacity() + self.y.capacity() + self.width.capacity() + self.height.capacity()) * size_of::<f32>()
+      + self.background_color.capacity() * size_of::<(u8, u8, u8, u8)>()
+      + self.overflow.capacity() * size_of::<Overflow>()
+  }
+
+  /// Reads the layout yoga computed for every element of `tree`.
+  pub(crate) fn update(&mut self, tree: &Tree<Element>) {
+    self.nodes.clear();
+    self.parent.clear();
+    self.subtree_end.clear();
+    self.x.clear();
+    self.y.clear();
+    self.width.clear();
+    self.height.clear();
+    self.background_color.clear();
+    self.overflow.clear();
+    self.index.clear();
+    self.index.resize(tree.len(), NONE);
+
+    let root = tree.root();
+    let mut current = Some(root);
+    while let Some(id) = current {
+      current = tree.next_descendant(root, id);
+
+      let el = &tree[id];
+      let position = self.nodes.len() as u32;
+      // Parents come before their children, so their position is already known.
+      let parent = el.parent().map_or(NONE, |parent| self.index[parent.index()]);
+      let (x, y) = match parent {
+        NONE => (0.0, 0.0),
+        parent => (self.x[parent as usize], self.y[parent as usize]),
+      };
+
+      unsafe {
+        self.x.push(x + el.yg.get_left());
+        self.y.push(y + el.yg.get_top());
+        self.width.push(el.yg.get_width());
+        self.height.push(el.yg.get_height());
+      }
+      self.nodes.push(id);
+      self.parent.push(parent);
+      self.subtree_end.push(position + 1);
+      self.background_color.push(el.computed.background_color);
+      self.overflow.push(el.computed.overflow);
+      self.index[id.index()] = position;
+    }
+
+    // Descendants come after their ancestors, so walking backwards sees every subtree before its root.
+    for position in (1..self.nodes.len()).rev() {
+      let parent = self.parent[position] as usize;
+      self.subtree_end[parent] = self.subtree_end[parent].max(self.subtree_end[position]);
+    }
+  }
+
+  /// Patches the colors of `nodes` after a style pass that didn't need a layout.
+  pub(crate) fn update_colors(&mut self, tree: &Tree<Element>, nodes: &[NodeId]) {
+    for &id in nodes {
+      if let Some(index) = self.index_of(id) {
+        self.background_color[index] = tree[id].computed.background_color;
+      }
+    }
+  }
+}
@@ -1,19 +1,49 @@
-use std::sync::RwLock;
-
+use std::{
+  fs::File,
+  io,
+  path::Path,
+  sync::{Arc, RwLock},
+  time::Instant,
+};
+
+use once_cell::sync::Lazy;
+use rayon::prelude::*;
 use serde::{Deserialize, Serialize};
+use style::{Atom, StrRef, StringTable};
 
 //                               [F]rame
 //                                     [U]
 //                                           [i]
 //                                                 [S]tandard
 //                                                       Version
-pub const MAGIC_BYTES: &[u8] = &[0x46, 0x55, 0x69, 0x53, 0];
-
+pub const MAGIC_BYTES: &[u8] = &[0x46, 0x55, 0x69, 0x53, 6];
+
+#[cfg(feature = "c-dom")]
+pub mod c_api;
+pub mod format;
+pub mod layout;
+pub mod memory;
+pub mod mutation;
+pub mod observer;
+pub mod sharing;
 pub mod tree;
-use tree::Node;
-
-fn safe_yoga_node_new() -> yoga::Node {
-  unsafe { yoga::Node::new() }
+pub use layout::LayoutCache;
+pub use memory::DocumentMemoryReport;
+pub use mutation::{Attribute, Transaction};
+pub use observer::{Observers, TreeChange};
+use sharing::StyleSharingCache;
+use tree::{Node, NodeId, Tree};
+
+bitflags::bitflags! {
+  /// Tracks which parts of an element are stale and need to be recomputed on the next style pass.
+  pub struct Dirty: u8 {
+    /// The raw attributes (or the scope they depend on) changed, so `classes` and `id` need to be recomputed.
+    const ATTRIBUTES = 1;
+    /// Something selectors can observe changed, so the stylesheet needs to be matched again.
+    const STYLE = 2;
+    /// The computed style changed in a way that affects yoga.
+    const LAYOUT = 4;
+  }
 }
 
 #[derive(Debug, Serialize, Deserialize)]
@@ -22,15 +52,21 @@ pub struct Element {
 
   pub raw_attributes: RawElementAttributes,
 
-  pub classes: Vec<String>,
-  pub id: Option<String>,
+  #[serde(skip)]
+  pub classes: Vec<Atom>,
+  #[serde(skip)]
+  pub id: Option<Atom>,
   pub style: Vec<style::StyleRule>,
 
-  #[serde(skip, default = "safe_yoga_node_new")]
+  /// Null until the element is part of a `CompiledDocument`, which allocates the nodes of all its elements at once.
+  #[serde(skip, default = "yoga::Node::null")]
   pub yg: yoga::Node,
 
   #[serde(skip)]
   pub computed: style::ComputedStyle,
+
+  #[serde(skip, default = "Dirty::all")]
+  pub dirty: Dirty,
 }
 
 impl PartialEq for Element {
@@ -44,23 +80,48 @@ impl PartialEq for Element {
 #[derive(Debug, Serialize, Deserialize)]
 pub enum RawAttributeValue {
   Raw {
-    value: String,
+    value: StrRef,
 
     #[serde(skip)]
     up_to_date: bool,
   },
 
   Script {
-    script: String,
-
-    #[serde(skip)]
-    up_to_date: bool,
+    script: StrRef,
 
+    /// Compiled when the document is created or loaded, see `CompiledDocument::compile_scripts`.
     #[serde(skip)]
     ast: Option<rhai::AST>,
   },
 }
 
+impl RawAttributeValue {
+  /// Compiles the script if this is a script attribute that hasn't been compiled yet, and returns the AST.
+  ///
+  /// A script that doesn't compile gets an empty AST, which evaluates like a script that fails.
+  pub fn compile(&mut self, engine: &rhai::Engine, strings: &StringTable) -> &rhai::AST {
+    match self {
+      Self::Script { script, ast } => {
+        ast.get_or_insert_with(|| engine.compile_expression(strings.get(*script)).unwrap_or_default())
+      }
+
+      Self::Raw { .. } => panic!("raw attributes can't be compiled"),
+    }
+  }
+
+  /// Returns true if `other` is the same kind of attribute with the same string, at the same
+  /// place of its string table.
+  fn same_source(&self, strings: &StringTable, other: &Self, other_strings: &StringTable) -> bool {
+    match (self, other) {
+      (Self::Raw { value: a, .. }, Self::Raw { value: b, .. })
+      | (Self::Script { script: a, .. }, Self::Script { script: b, .. }) => {
+        a == b && strings.get(*a) == other_strings.get(*b)
+      }
+      _ => false,
+    }
+  }
+}
+
 #[derive(Debug, Default, Serialize, Deserialize)]
 pub struct RawElementAttributes {
   pub class: Option<RawAttributeValue>,
@@ -68,6 +129,17 @@ pub struct RawElementAttributes {
   pub style: Option<RawAttributeValue>,
 }
 
+impl RawElementAttributes {
+  /// The number of attributes that are evaluated as scripts by `Element::compute_attributes`.
+  #[must_use]
+  pub fn script_count(&self) -> u32 {
+    [&self.class, &self.id]
+      .iter()
+      .filter(|attr| matches!(attr, Some(RawAttributeValue::Script { .. })))
+      .count() as u32
+  }
+}
+
 impl Element {
   #[must_use]
   pub fn new(data: ElementData, attrs: RawElementAttributes) -> Self {
@@ -79,11 +151,26 @@ impl Element {
       id: None,
       style: Vec::new(),
 
-      yg: unsafe { yoga::Node::new() },
+      yg: yoga::Node::null(),
       computed: style::ComputedStyle::default(),
+      dirty: Dirty::all(),
     }
   }
 
+  pub fn mark_dirty(&mut self, flags: Dirty) {
+    self.dirty |= flags;
+  }
+
+  /// Returns true if any of this element's attributes are scripts that reference `name`.
+  #[must_use]
+  pub fn references_variable(&self, name: &str, strings: &StringTable) -> bool {
+    let attrs = &self.raw_attributes;
+    [&attrs.class, &attrs.id, &attrs.style].iter().any(|attr| match attr {
+      Some(RawAttributeValue::Script { script, .. }) => script_references(strings.get(*script), name),
+      _ => false,
+    })
+  }
+
   pub fn prepare_yoga(&mut self) {
     unsafe {
       self.yg.set_width(self.computed.width);
@@ -92,63 +179,90 @@ impl Element {
       self.yg.set_margin(yoga::Edge::Bottom, self.computed.margin_bottom);
       self.yg.set_margin(yoga::Edge::Left, self.computed.margin_left);
       self.yg.set_margin(yoga::Edge::Right, self.computed.margin_right);
+      self.yg.set_overflow(self.computed.overflow.into());
     }
   }
 
-  pub fn compute_attributes(&mut self, engine: &rhai::Engine, scope: &mut rhai::Scope) {
+  /// Compiles any script attributes that haven't been compiled yet.
+  pub fn compile_scripts(&mut self, engine: &rhai::Engine, strings: &StringTable) {
+    let attrs = &mut self.raw_attributes;
+    for attr in [&mut attrs.class, &mut attrs.id, &mut attrs.style].iter_mut() {
+      if let Some(attr @ RawAttributeValue::Script { .. }) = attr {
+        attr.compile(engine, strings);
+      }
+    }
+  }
+
+  /// Recomputes `classes` and `id` from the raw attributes.
+  ///
+  /// Script results are compared against the previous values, and the existing strings are
+  /// reused, so bindings that didn't change don't allocate. Returns true if either of them changed.
+  pub fn compute_attributes(&mut self, engine: &rhai::Engine, scope: &mut rhai::Scope, strings: &StringTable) -> bool {
+    let mut changed = false;
+
     if let Some(class) = &mut self.raw_attributes.class {
       match class {
         RawAttributeValue::Raw { value, up_to_date } => {
           if !*up_to_date {
-            self.classes = value.split_ascii_whitespace().map(|s| s.to_string()).collect()
-          }
-        }
-
-        RawAttributeValue::Script {
-          script,
-          up_to_date,
-          ast,
-        } => {
-          if ast.is_none() || !*up_to_date {
-            *ast = Some(engine.compile_expression_with_scope(scope, script).unwrap());
+            changed |= update_atoms(&mut self.classes, strings.get(*value).split_ascii_whitespace());
             *up_to_date = true;
           }
+        }
 
-          let dynamic_classes: Vec<rhai::Dynamic> = engine.eval_ast_with_scope(scope, ast.as_ref().unwrap()).unwrap();
-          self.classes.clear();
-          for class in dynamic_classes {
-            self.classes.push(class.take_string().unwrap());
-          }
+        // Scripts that fail or don't return strings leave the element without those classes.
+        RawAttributeValue::Script { .. } => {
+          let ast = class.compile(engine, strings);
+          let classes: rhai::Array = engine.eval_ast_with_scope(scope, ast).unwrap_or_default();
+          let classes = classes.iter().filter_map(|class| class.as_str().ok());
+          changed |= update_atoms(&mut self.classes, classes);
         }
       }
-    } else {
+    } else if !self.classes.is_empty() {
       self.classes.clear();
+      changed = true;
     }
 
     if let Some(id) = &mut self.raw_attributes.id {
       match id {
         RawAttributeValue::Raw { value, up_to_date } => {
           if !*up_to_date {
-            self.id = Some(value.clone());
+            changed |= update_atom(&mut self.id, strings.get(*value));
+            *up_to_date = true;
           }
         }
 
-        RawAttributeValue::Script {
-          script,
-          up_to_date,
-          ast,
-        } => {
-          if ast.is_none() || !*up_to_date {
-            *ast = Some(engine.compile_expression_with_scope(scope, script).unwrap());
-            *up_to_date = true;
+        RawAttributeValue::Script { .. } => {
+          let ast = id.compile(engine, strings);
+          match engine.eval_ast_with_scope::<rhai::ImmutableString>(scope, ast) {
+            Ok(id) => changed |= update_atom(&mut self.id, &id),
+            Err(_) => changed |= self.id.take().is_some(),
           }
-
-          self.id = Some(engine.eval_ast_with_scope(scope, ast.as_ref().unwrap()).unwrap());
         }
       }
-    } else {
+    } else if self.id.is_some() {
       self.id = None;
+      changed = true;
     }
+
+    changed
+  }
+
+  /// Returns true if `other` was compiled from the same markup, so every string it refers to
+  /// is the same and at the same place of its string table.
+  fn same_source(&self, strings: &StringTable, other: &Self, other_strings: &StringTable) -> bool {
+    let same_attribute = |a: &Option<RawAttributeValue>, b: &Option<RawAttributeValue>| match (a, b) {
+      (Some(a), Some(b)) => a.same_source(strings, b, other_strings),
+      (a, b) => a.is_none() && b.is_none(),
+    };
+
+    std::mem::discriminant(&self.data) == std::mem::discriminant(&other.data)
+      && same_attribute(&self.raw_attributes.class, &other.raw_attributes.class)
+      && same_attribute(&self.raw_attributes.id, &other.raw_attributes.id)
+      && same_attribute(&self.raw_attributes.style, &other.raw_attributes.style)
+      && self.style.len() == other.style.len()
+      && self.style.iter().zip(&other.style).all(|(a, b)| {
+        a.source == b.source && strings.get(a.source) == other_strings.get(b.source) && a.delta == b.delta
+      })
   }
 
   #[must_use]
@@ -160,6 +274,7 @@ impl Element {
         top: self.yg.get_top(),
         left: self.yg.get_left(),
         background_color: self.computed.background_color,
+        overflow: self.computed.overflow,
       }
     }
   }
@@ -172,12 +287,90 @@ impl Element {
     }
   }
 
+  /// The interned version of `get_local_name`.
+  #[must_use]
+  pub fn local_name(&self) -> Atom {
+    static ROOT: Lazy<Atom> = Lazy::new(|| Atom::from("#root"));
+    static UNSTYLED: Lazy<Atom> = Lazy::new(|| Atom::from("Unstyled"));
+
+    match self.data {
+      ElementData::Root(..) => *ROOT,
+      ElementData::Unstyled(..) => *UNSTYLED,
+    }
+  }
+
   #[must_use]
   pub fn get_namespace(&self) -> Option<&str> {
     None
   }
 }
 
+/// Sets `current` to the atoms for `new`, in place.
+///
+/// Strings that don't fit in the atom table are left out, no selector can match them, see
+/// `Atom::try_new`. Returns true if anything changed.
+fn update_atoms<'a, I: IntoIterator<Item = &'a str>>(current: &mut Vec<Atom>, new: I) -> bool {
+  let mut changed = false;
+  let mut len = 0;
+
+  for atom in new.into_iter().filter_map(Atom::try_new) {
+    match current.get_mut(len) {
+      Some(existing) if *existing == atom => {}
+      Some(existing) => {
+        *existing = atom;
+        changed = true;
+      }
+      None => {
+        current.push(atom);
+        changed = true;
+      }
+    }
+
+    len += 1;
+  }
+
+  if current.len() != len {
+    current.truncate(len);
+    changed = true;
+  }
+
+  changed
+}
+
+/// Sets `current` to the atom for `new`, or `None` if it doesn't fit in the atom table.
+///
+/// Returns true if it changed.
+fn update_atom(current: &mut Option<Atom>, new: &str) -> bool {
+  let atom = Atom::try_new(new);
+  if *current == atom {
+    false
+  } else {
+    *current = atom;
+    true
+  }
+}
+
+fn atom_eq(a: Atom, b: Atom, case_sensitivity: selectors::attr::CaseSensitivity) -> bool {
+  match case_sensitivity {
+    selectors::attr::CaseSensitivity::CaseSensitive => a == b,
+    selectors::attr::CaseSensitivity::AsciiCaseInsensitive => a.eq_ignore_ascii_case(b),
+  }
+}
+
+/// Returns true if `name` appears as an identifier in `script`.
+///
+/// This is a purely lexical check, so it may report variables that only appear
+/// inside string literals, but it never misses a real reference.
+fn script_references(script: &str, name: &str) -> bool {
+  let is_ident = |c: char| c.is_ascii_alphanumeric() || c == '_';
+
+  script.match_indices(name).any(|(start, _)| {
+    let before = script[..start].chars().next_back();
+    let after = script[start + name.len()..].chars().next();
+    !before.map_or(false, is_ident) && !after.map_or(false, is_ident)
+  })
+}
+
 #[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
 pub enum ElementData {
   Root(RootElement),
@@ -190,95 +383,511 @@ pub struct RootElement;
 #[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
 pub struct UnstyledElement;
 
-#[derive(Debug, Serialize, Deserialize)]
+/// The script variables of a document, and the scope its scripts are evaluated in.
+///
+/// A `Scope<'static>` can only update a variable through a `'static` name, so the variables
+/// are kept here with their own names and the scope is rebuilt from them when they change.
+#[derive(Debug, Default)]
+pub struct Variables {
+  values: Vec<(String, rhai::Dynamic)>,
+  scope: rhai::Scope<'static>,
+}
+
+impl Variables {
+  #[must_use]
+  pub fn len(&self) -> usize {
+    self.values.len()
+  }
+
+  #[must_use]
+  pub fn is_empty(&self) -> bool {
+    self.values.is_empty()
+  }
+
+  /// Sets `name`, pushing it if it doesn't exist yet. The scope only sees it after `update_scope`.
+  pub fn set(&mut self, name: String, value: rhai::Dynamic) {
+    match self.values.iter_mut().find(|(existing, _)| *existing == name) {
+      Some((_, existing)) => *existing = value,
+      None => self.values.push((name, value)),
+    }
+  }
+
+  pub fn update_scope(&mut self) {
+    self.scope = rhai::Scope::new();
+    for (name, value) in &self.values {
+      self.scope.push_dynamic(name.clone(), value.clone());
+    }
+  }
+
+  pub fn scope(&mut self) -> &mut rhai::Scope<'static> {
+    &mut self.scope
+  }
+}
+
+/// A document and everything needed to style it, see `format` for how it is saved.
+///
+/// The atoms for its class names, ids and selectors live in a table shared by every document
+/// in the process, and stay there when the document is dropped, see `style::Atom`.
+#[derive(Debug)]
 pub struct CompiledDocument {
-  pub root: Node<Element>,
-  pub stylesheet: style::StyleSheet,
+  pub tree: RwLock<Tree<Element>>,
+  pub stylesheet: RwLock<style::StyleSheet>,
+
+  /// The string table every `StrRef` in the document points into.
+  pub strings: RwLock<StringTable>,
 
-  #[serde(skip)]
   pub engine: rhai::Engine,
-  #[serde(skip)]
-  pub scope: RwLock<rhai::Scope<'static>>,
+  pub variables: RwLock<Variables>,
+
+  /// The boxes from the last layout pass, see `LayoutCache`.
+  pub layout: RwLock<LayoutCache>,
+
+  /// Told about every element that is inserted, removed or gets a different `class` or `id`.
+  pub observers: Observers<TreeChange>,
+
+  viewport: RwLock<Option<Viewport>>,
+
+  style_pool: RwLock<Option<rayon::ThreadPool>>,
+}
+
+/// Below this many dirty elements restyling on one thread is faster than splitting the work up.
+const PARALLEL_STYLE_THRESHOLD: usize = 64;
+
+/// What a style pass changed, so renderers can decide how much of their output to rebuild.
+#[derive(Debug, Clone, Default)]
+pub struct StyleChanges {
+  /// Yoga layout was recalculated, so any element may have moved or resized.
+  pub layout: bool,
+  /// Elements whose background color changed.
+  pub repaint: Vec<NodeId>,
+  /// How much work the pass did.
+  pub stats: StyleStats,
+}
+
+/// Counters for a single style pass.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct StyleStats {
+  /// Elements whose style was recomputed, including the ones that shared a style.
+  pub nodes_restyled: u32,
+  /// Elements that reused a sibling's style instead of matching selectors.
+  pub styles_shared: u32,
+  pub matching: style::MatchStats,
+  /// Script attributes that were evaluated.
+  pub script_evals: u32,
+  /// Time spent in yoga, in microseconds.
+  pub layout_us: u64,
+}
+
+impl StyleChanges {
+  #[must_use]
+  pub fn is_empty(&self) -> bool {
+    !self.layout && self.repaint.is_empty()
+  }
+}
+
+/// The inputs of the last yoga layout pass.
+#[derive(Debug, Copy, Clone, PartialEq)]
+struct Viewport {
+  width: f32,
+  height: f32,
+  direction: yoga::Direction,
 }
 
 use std::io::prelude::*;
 
 impl CompiledDocument {
-  pub fn new(root: Node<Element>, stylesheet: style::StyleSheet) -> Self {
-    Self {
-      root,
-      stylesheet,
+  pub fn new(mut tree: Tree<Element>, stylesheet: style::StyleSheet, strings: StringTable) -> Self {
+    let missing = tree.nodes().filter(|el| el.yg.is_null()).count();
+    let mut nodes = unsafe { yoga::Node::alloc(missing) }.into_iter();
+    for el in tree.nodes_mut().filter(|el| el.yg.is_null()) {
+      el.yg = nodes.next().unwrap();
+    }
+
+    let mut doc = Self {
+      tree: RwLock::new(tree),
+      stylesheet: RwLock::new(stylesheet),
+      strings: RwLock::new(strings),
       engine: rhai::Engine::default(),
-      scope: RwLock::new(rhai::Scope::default()),
+      variables: RwLock::new(Variables::default()),
+      layout: RwLock::new(LayoutCache::default()),
+      observers: Observers::default(),
+      viewport: RwLock::new(None),
+      style_pool: RwLock::new(None),
+    };
+    doc.compile_scripts();
+    doc
+  }
+
+  /// Compiles every script attribute in the document in one go, so the first style pass
+  /// doesn't have to.
+  pub fn compile_scripts(&mut self) {
+    let engine = &self.engine;
+    let strings = self.strings.get_mut().unwrap();
+    for el in self.tree.get_mut().unwrap().nodes_mut() {
+      el.compile_scripts(engine, strings);
     }
   }
 
+  /// Sets a script variable, pushing it if it doesn't exist yet.
+  ///
+  /// Only elements with scripts that reference `name` are recomputed on the next style pass.
+  /// Use a `Transaction` to set several variables at once.
+  pub fn set_variable<T: rhai::Variant + Clone>(&self, name: &str, value: T) {
+    let mut txn = self.transaction();
+    txn.set_variable(name, value);
+    // Transactions that don't append anything always commit.
+    let _ = self.commit(txn);
+  }
+
+  /// Takes over the stylesheet of `other` if both documents were compiled from the same markup,
+  /// so a stylesheet that changed can be applied without replacing the document.
+  ///
+  /// The elements keep their yoga nodes and script variables, and renderers keep what they
+  /// retained for the document. Every element is restyled on the next style pass, layout only
+  /// runs if a style that feeds into yoga changed. Returns false without changing anything if
+  /// the markup (or a committed `Transaction`) made the trees differ.
   #[must_use]
-  pub fn save(&self) -> Vec<u8> {
-    let mut buf = Vec::with_capacity(bincode::serialized_size(self).unwrap() as usize + MAGIC_BYTES.len());
-    self.save_into(&mut buf);
-    buf
+  pub fn adopt_stylesheet(&self, other: &CompiledDocument) -> bool {
+    if std::ptr::eq(self, other) {
+      return true;
+    }
+
+    let mut tree = self.tree.write().unwrap();
+    {
+      let mut strings = self.strings.write().unwrap();
+      let other_tree = other.tree.read().unwrap();
+      let other_strings = other.strings.read().unwrap();
+
+      let same = tree.len() == other_tree.len()
+        && tree
+          .nodes()
+          .zip(other_tree.nodes())
+          .all(|(a, b)| a.parent() == b.parent() && a.same_source(&strings, b, &other_strings));
+      if !same {
+        return false;
+      }
+
+      // Everything the elements refer to is at the same place, only the stylesheet's strings differ.
+      *strings = other_strings.clone();
+    }
+    *self.stylesheet.write().unwrap() = other.stylesheet.read().unwrap().clone();
+
+    for el in tree.nodes_mut() {
+      el.mark_dirty(Dirty::STYLE);
+    }
+    true
   }
 
-  pub fn save_into<W: Write>(&self, mut writer: W) {
-    writer.write_all(MAGIC_BYTES).unwrap();
-    bincode::serialize_into(writer, self).unwrap();
+  /// Marks everything `node` could affect through selectors as needing a restyle, that is the
+  /// node itself and its descendants, and if `siblings` is true its later siblings (and their
+  /// descendants) too.
+  ///
+  /// Pass `RuleIndex::has_sibling_sensitive` for `siblings`, stylesheets without sibling
+  /// combinators or structural pseudo-classes can't see an element from its siblings, and
+  /// walking them on every change makes restyling long lists quadratic.
+  pub fn invalidate_style(tree: &mut Tree<Element>, node: NodeId, siblings: bool) {
+    let mut current = Some(node);
+    while let Some(sibling) = current {
+      let mut descendant = Some(sibling);
+      while let Some(id) = descendant {
+        tree[id].mark_dirty(Dirty::STYLE);
+        descendant = tree.next_descendant(sibling, id);
+      }
+
+      current = if siblings { tree[sibling].next_sibling() } else { None };
+    }
   }
 
   #[must_use]
-  pub fn load(data: &[u8]) -> Self {
-    Self::load_from(data)
+  pub fn save(&self) -> Vec<u8> {
+    self.save_into(io::Cursor::new(Vec::new())).unwrap().into_inner()
+  }
+
+  /// Writes the document to `writer` in one pass, returning the writer.
+  ///
+  /// Only the elements reachable from the root are written, in document order, so the saved
+  /// document has no free slots or removed subtrees but its ids can differ from this one's.
+  pub fn save_into<W: Write + Seek>(&self, writer: W) -> io::Result<W> {
+    let tree = self.tree.read().unwrap();
+    let mut out = format::DocumentWriter::without_root(writer)?;
+    let mut ids = vec![None; tree.len()];
+    for node in tree.descendants(tree.root()) {
+      let parent = node.parent().and_then(|parent| ids[parent.index()]);
+      ids[node.id().index()] = Some(out.push(parent, &node.data)?);
+    }
+    out.finish(&self.stylesheet.read().unwrap(), &self.strings.read().unwrap())
+  }
+
+  /// Loads a document from `data`, copying its string table.
+  ///
+  /// Prefer `load_static` or `load_mmap` when the data outlives the document. Returns an
+  /// `InvalidData` error if `data` isn't a valid document.
+  pub fn load(data: &[u8]) -> io::Result<Self> {
+    let header = format::Header::read(data)?;
+    let strings =
+      std::str::from_utf8(&data[header.strings.clone()]).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+
+    let mut table = StringTable::new();
+    table.push(strings);
+
+    Self::load_sections(&data[header.nodes], &data[header.body], table)
+  }
+
+  pub fn load_from<R: Read>(mut reader: R) -> io::Result<Self> {
+    let mut data = Vec::new();
+    reader.read_to_end(&mut data)?;
+    Self::load_shared(Arc::new(data))
   }
 
+  /// Loads a document that was embedded in the binary.
+  ///
+  /// Only the string table is read in place, the elements and the stylesheet are still
+  /// deserialized into the document's own memory.
+  ///
+  /// Panics if `data` isn't a valid document, embedded documents are checked when they're built.
   #[must_use]
-  pub fn load_from<R: Read>(mut reader: R) -> Self {
-    let mut magic_bytes = [0; MAGIC_BYTES.len()];
-    reader.read_exact(&mut magic_bytes).unwrap();
+  pub fn load_static(data: &'static [u8]) -> Self {
+    Self::load_shared(Arc::new(data)).unwrap()
+  }
+
+  /// Memory maps the file at `path` and loads the document from it.
+  ///
+  /// Only the string table is read in place, so the strings are only paged in when they are
+  /// used. The elements and the stylesheet are still deserialized into the document's own
+  /// memory, which is most of the loading time of large documents.
+  ///
+  /// The file must not be modified while the document is alive.
+  pub fn load_mmap<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+    let file = File::open(path)?;
+    let map = unsafe { memmap::Mmap::map(&file)? };
+    Self::load_shared(Arc::new(map))
+  }
+
+  fn load_shared(data: style::strings::SharedBytes) -> io::Result<Self> {
+    let bytes: &[u8] = (*data).as_ref();
+    let header = format::Header::read(bytes)?;
+    let (nodes, body) = (header.nodes.clone(), header.body.clone());
+
+    let strings = StringTable::from_shared(Arc::clone(&data), header.strings)
+      .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+
+    Self::load_sections(&bytes[nodes], &bytes[body], strings)
+  }
 
-    if magic_bytes != MAGIC_BYTES {
-      panic!("magic bytes don't match {:?} == {:?}", magic_bytes, MAGIC_BYTES);
+  /// Deserializes the elements and the stylesheet, which own their data unlike `strings`.
+  ///
+  /// Sections that don't decode, and elements whose parent doesn't come before them, are
+  /// `InvalidData` errors.
+  fn load_sections(mut nodes: &[u8], body: &[u8], strings: StringTable) -> io::Result<Self> {
+    let invalid = |e: bincode::Error| io::Error::new(io::ErrorKind::InvalidData, e);
+
+    let (_, root): (Option<NodeId>, Element) = bincode::deserialize_from(&mut nodes).map_err(invalid)?;
+    let mut tree = Tree::new(root);
+    while !nodes.is_empty() {
+      let (parent, el): (Option<NodeId>, Element) = bincode::deserialize_from(&mut nodes).map_err(invalid)?;
+      match parent {
+        Some(parent) if parent.index() < tree.len() && !tree.is_free(parent) => tree.append(parent, el),
+        Some(parent) => {
+          let id = NodeId::from_index(tree.len());
+          let msg = format!("{:?} comes before its parent {:?}", id, parent);
+          return Err(io::Error::new(io::ErrorKind::InvalidData, msg));
+        }
+        None => tree.push_detached(el),
+      };
     }
 
-    let doc: CompiledDocument = bincode::deserialize_from(reader).unwrap();
+    let stylesheet = bincode::deserialize(body).map_err(invalid)?;
+    let doc = Self::new(tree, stylesheet, strings);
     doc.init_yoga();
-    doc
+    Ok(doc)
   }
 
+  /// Attaches the yoga node of every element to its parent's, with one call per parent.
   pub fn init_yoga(&self) {
     // Even though we don't need mutable access from the rust side,
     // we still want to make sure we are the only one with access to the
     // yoga nodes.
-    for node in self.root.descendants().skip(1) {
-      let inner = node.inner();
-      let parent = inner.parent().unwrap().inner();
+    let tree = self.tree.write().unwrap();
+    let mut children = Vec::new();
+    for node in tree.descendants(tree.root()) {
+      children.clear();
+      children.extend(node.children().map(|child| *child.yg));
+      if !children.is_empty() {
+        unsafe {
+          node.yg.set_children(&children);
+        }
+      }
+    }
+  }
+
+  /// Detaches every yoga node from its parent, undoing `init_yoga`.
+  #[doc(hidden)]
+  pub fn reset_yoga(&self) {
+    let tree = self.tree.write().unwrap();
+    for node in tree.nodes().filter(|node| !node.yg.is_null()) {
       unsafe {
-        parent.yg.insert_child(*node.inner().yg, parent.yg.child_count());
+        node.yg.remove_all_children();
       }
     }
   }
 
-  pub fn compute_style(&self, width: f32, height: f32, direction: yoga::Direction) {
-    for node in self.root.descendants() {
-      node
-        .inner_mut()
-        .compute_attributes(&self.engine, &mut self.scope.write().unwrap());
+  /// Brings the computed styles and yoga layout up to date.
+  ///
+  /// Only dirty elements are restyled, and layout only runs if a style that feeds into
+  /// yoga changed or the viewport is different from the last pass.
+  pub fn compute_style(&self, width: f32, height: f32, direction: yoga::Direction) -> StyleChanges {
+    let viewport = Viewport {
+      width,
+      height,
+      direction,
+    };
+    let mut needs_layout = *self.viewport.read().unwrap() != Some(viewport);
+    let mut repaint = Vec::new();
+    let mut stats = StyleStats::default();
+
+    let mut tree = self.tree.write().unwrap();
+    let strings = self.strings.read().unwrap();
+    let siblings = self.stylesheet.read().unwrap().index.has_sibling_sensitive();
+    let root = tree.root();
+
+    // Scripts need mutable access to the scope, so attributes are always computed on this thread.
+    let mut restyle = Vec::new();
+    {
+      let mut variables = self.variables.write().unwrap();
+      let scope = variables.scope();
+
+      let mut current = Some(root);
+      while let Some(id) = current {
+        current = tree.next_descendant(root, id);
+
+        if tree[id].dirty.contains(Dirty::ATTRIBUTES) {
+          stats.script_evals += tree[id].raw_attributes.script_count();
+          let changed = tree[id].compute_attributes(&self.engine, scope, &strings);
+
+          if changed {
+            Self::invalidate_style(&mut tree, id, siblings);
+            self.observers.notify(TreeChange::Attributes { node: id });
+          }
+        }
 
-      let mut computed = node.inner().computed;
+        if tree[id].dirty.contains(Dirty::STYLE) {
+          restyle.push(id);
+        }
+      }
+    }
 
-      self.stylesheet.apply(&node, &mut computed);
+    let styles = self.match_styles(&tree, &strings, &restyle);
+    stats.nodes_restyled = restyle.len() as u32;
+    for (&id, (computed, matching)) in restyle.iter().zip(styles) {
+      match matching {
+        Some(matching) => stats.matching += matching,
+        None => stats.styles_shared += 1,
+      }
 
-      let mut el = node.inner_mut();
+      let el = &mut tree[id];
+      if el.computed.layout_differs(&computed) {
+        el.mark_dirty(Dirty::LAYOUT);
+      }
+      if el.computed.background_color != computed.background_color {
+        repaint.push(id);
+      }
       el.computed = computed;
-      el.prepare_yoga();
     }
 
-    let mut root = self.root.inner_mut();
-    unsafe {
-      root.yg.calculate_layout(width, height, direction);
+    let layout_start = Instant::now();
+    for el in tree.nodes_mut() {
+      if el.dirty.contains(Dirty::LAYOUT) {
+        el.prepare_yoga();
+        needs_layout = true;
+      }
+      el.dirty = Dirty::empty();
+    }
+
+    if needs_layout {
+      unsafe {
+        tree[root].yg.calculate_layout(width, height, direction);
+      }
+      self.layout.write().unwrap().update(&tree);
+      *self.viewport.write().unwrap() = Some(viewport);
+    } else if !repaint.is_empty() {
+      self.layout.write().unwrap().update_colors(&tree, &repaint);
+    }
+    stats.layout_us = layout_start.elapsed().as_micros() as u64;
+
+    StyleChanges {
+      layout: needs_layout,
+      repaint,
+      stats,
     }
   }
 
-  pub fn query_selector(&self, selector: &str) -> Option<Node<Element>> {
+  /// Matches the stylesheet against every node in `nodes`, returning their computed styles in the same order.
+  ///
+  /// Siblings that can share a style (see `StyleSharingCache`) skip selector matching,
+  /// those are returned without `MatchStats`.
+  ///
+  /// Computed styles don't inherit, so every node can be matched independently. With a style
+  /// thread pool (see `set_style_threads`) `nodes` is split into contiguous ranges that are
+  /// matched on the pool with work stealing. Nodes are in document order, so each range is
+  /// roughly a run of sibling subtrees.
+  fn match_styles(
+    &self,
+    tree: &Tree<Element>,
+    strings: &StringTable,
+    nodes: &[NodeId],
+  ) -> Vec<(style::ComputedStyle, Option<style::MatchStats>)> {
+    let stylesheet = self.stylesheet.read().unwrap();
+    let stylesheet = &*stylesheet;
+    let match_style = |cache: &mut StyleSharingCache, &id: &NodeId| {
+      let node = tree.get(id);
+      if let Some(computed) = cache.lookup(node) {
+        return (computed, None);
+      }
+
+      let mut computed = style::ComputedStyle::default();
+      let mut stats = style::MatchStats::default();
+      if stylesheet.apply(&node, &mut computed, strings, &mut stats) {
+        cache.insert(id, computed);
+      }
+      (computed, Some(stats))
+    };
+
+    match &*self.style_pool.read().unwrap() {
+      Some(pool) if nodes.len() >= PARALLEL_STYLE_THRESHOLD => pool.install(|| {
+        nodes
+          .par_iter()
+          .with_min_len(PARALLEL_STYLE_THRESHOLD / 2)
+          .map_init(StyleSharingCache::new, match_style)
+          .collect()
+      }),
+
+      _ => {
+        let mut cache = StyleSharingCache::new();
+        nodes.iter().map(|id| match_style(&mut cache, id)).collect()
+      }
+    }
+  }
+
+  /// Sets the number of threads used to match styles.
+  ///
+  /// `0` and `1` both restyle on the calling thread, which is the default.
+  pub fn set_style_threads(&self, threads: usize) {
+    let pool = if threads > 1 {
+      Some(
+        rayon::ThreadPoolBuilder::new()
+          .num_threads(threads)
+          .thread_name(|i| format!("style-{}", i))
+          .build()
+          .unwrap(),
+      )
+    } else {
+      None
+    };
+
+    *self.style_pool.write().unwrap() = pool;
+  }
+
+  pub fn query_selector(&self, selector: &str) -> Option<NodeId> {
     let mut input = cssparser::ParserInput::new(selector);
     let list = selectors::SelectorList::parse(
       &style::selectors::SelectorParser,
@@ -293,9 +902,10 @@ impl CompiledDocument {
       selectors::matching::QuirksMode::NoQuirks,
     );
 
-    for node in self.root.descendants() {
+    let tree = self.tree.read().unwrap();
+    for node in tree.descendants(tree.root()) {
       if selectors::matching::matches_selector_list(&list, &node, &mut context) {
-        return Some(node);
+        return Some(node.id());
       }
     }
 
@@ -305,17 +915,31 @@ impl CompiledDocument {
 
 impl Drop for CompiledDocument {
   fn drop(&mut self) {
+    let tree = self.tree.get_mut().unwrap();
+    // Every node goes back to the pool at once, including the ones of removed subtrees.
     unsafe {
-      self.root.inner_mut().yg.free_recursive();
+      yoga::Node::release(tree.nodes_mut().map(|el| el.yg.take()));
     }
   }
 }
 
-impl selectors::Element for Node<Element> {
+impl style::TElement for Node<'_, Element> {
+  fn with_rule_keys<R, F: FnOnce(style::RuleKeys<'_>) -> R>(&self, callback: F) -> R {
+    let el = self.inner();
+    callback(style::RuleKeys {
+      id: el.id,
+      classes: &el.classes,
+      local_name: el.local_name(),
+    })
+  }
+}
+
+impl selectors::Element for Node<'_, Element> {
   type Impl = style::selectors::SelectorImpl;
 
   fn opaque(&self) -> ::selectors::OpaqueElement {
-    selectors::OpaqueElement::new(self)
+    // Handles are created on the fly, so use the address of the node in the tree instead.
+    selectors::OpaqueElement::new(self.inner())
   }
 
   fn is_html_slot_element(&self) -> bool {
@@ -331,15 +955,15 @@ impl selectors::Element for Node<Element> {
   }
 
   fn parent_element(&self) -> Option<Self> {
-    self.inner().parent().cloned()
+    self.parent()
   }
 
   fn prev_sibling_element(&self) -> Option<Self> {
-    self.inner().previous_sibling().cloned()
+    self.previous_sibling()
   }
 
   fn next_sibling_element(&self) -> Option<Self> {
-    self.inner().next_sibling().cloned()
+    self.next_sibling()
   }
 
   fn is_empty(&self) -> bool {
@@ -354,8 +978,8 @@ impl selectors::Element for Node<Element> {
     false
   }
 
-  fn has_local_name(&self, local_name: &str) -> bool {
-    self.inner().get_local_name() == local_name
+  fn has_local_name(&self, local_name: &Atom) -> bool {
+    self.inner().local_name() == *local_name
   }
 
   fn has_namespace(&self, ns: &str) -> bool {
@@ -382,27 +1006,26 @@ impl selectors::Element for Node<Element> {
     let el = self.inner();
     let other = other.inner();
 
-    el.get_local_name() == other.get_local_name() && el.get_namespace() == other.get_namespace()
+    el.local_name() == other.local_name() && el.get_namespace() == other.get_namespace()
   }
 
   fn is_link(&self) -> bool {
     false
   }
 
-  fn has_id(&self, id: &String, case_sensitivity: selectors::attr::CaseSensitivity) -> bool {
+  fn has_id(&self, id: &Atom, case_sensitivity: selectors::attr::CaseSensitivity) -> bool {
     self
       .inner()
       .id
-      .as_ref()
-      .map_or(false, |id_attr| case_sensitivity.eq(id.as_bytes(), id_attr.as_bytes()))
+      .map_or(false, |id_attr| atom_eq(id_attr, *id, case_sensitivity))
   }
 
-  fn has_class(&self, name: &String, case_sensitivity: selectors::attr::CaseSensitivity) -> bool {
+  fn has_class(&self, name: &Atom, case_sensitivity: selectors::attr::CaseSensitivity) -> bool {
     self
       .inner()
       .classes
       .iter()
-      .any(|class| case_sensitivity.eq(class.as_bytes(), name.as_bytes()))
+      .any(|class| atom_eq(*class, *name, case_sensitivity))
   }
 
   fn attr_matches(
@@ -435,9 +1058,79 @@ impl selectors::Element for Node<Element> {
   }
 }
 
+#[cfg(test)]
+mod tests {
+  use super::*;
+
+  /// A saved document with a root and one child.
+  fn saved() -> Vec<u8> {
+    let root = Element::new(ElementData::Root(RootElement), RawElementAttributes::default());
+    let doc = CompiledDocument::new(Tree::new(root), style::StyleSheet::new(), StringTable::new());
+    let mut txn = doc.transaction();
+    txn.append(NodeId::from_index(0));
+    assert!(doc.commit(txn));
+    doc.save()
+  }
+
+  fn set_field(data: &mut [u8], offset: usize, value: usize) {
+    data[offset..offset + 8].copy_from_slice(&(value as u64).to_le_bytes());
+  }
+
+  #[test]
+  fn saved_documents_load() {
+    let doc = CompiledDocument::load(&saved()).unwrap();
+    let tree = doc.tree.read().unwrap();
+    assert_eq!(tree.len(), 2);
+    assert_eq!(tree[NodeId::from_index(1)].parent(), Some(tree.root()));
+  }
+
+  #[test]
+  fn truncated_files_fail_to_load() {
+    let data = saved();
+    let path = std::env::temp_dir().join(format!("dom-truncated-{}.cframe", std::process::id()));
+    std::fs::write(&path, &data[..data.len() - 1]).unwrap();
+    let err = CompiledDocument::load_mmap(&path).unwrap_err();
+    std::fs::remove_file(&path).unwrap();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+  }
+
+  #[test]
+  fn truncated_sections_fail_to_load() {
+    let data = saved();
+    let header = format::Header::read(&data).unwrap();
+
+    // The last element is cut off.
+    let mut nodes = data.clone();
+    set_field(&mut nodes, 48, header.nodes.len() - 1);
+    let err = CompiledDocument::load(&nodes).unwrap_err();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+
+    let mut body = data;
+    set_field(&mut body, 32, header.body.len() / 2);
+    let err = CompiledDocument::load(&body).unwrap_err();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+  }
+
+  #[test]
+  fn parents_must_come_first() {
+    let mut data = saved();
+    let header = format::Header::read(&data).unwrap();
+    let root = Element::new(ElementData::Root(RootElement), RawElementAttributes::default());
+    let root_len = bincode::serialized_size(&(None::<NodeId>, &root)).unwrap() as usize;
+
+    // The child's parent, after the `Some` tag.
+    let parent = header.nodes.start + root_len + 1;
+    assert_eq!(data[parent..parent + 4], 0u32.to_le_bytes());
+    data[parent..parent + 4].copy_from_slice(&7u32.to_le_bytes());
+
+    let err = CompiledDocument::load(&data).unwrap_err();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+  }
+}
+
 #[macro_export]
 macro_rules! include_document {
   ($file:expr) => {
-    ::std::sync::Arc::new(::project_a::dom::CompiledDocument::load(include_bytes!($file)))
+    ::std::sync::Arc::new(::project_a::dom::CompiledDocument::load_static(include_bytes!($file)))
   };
 }
@@ -0,0 +1,119 @@
+use std::mem::size_of;
+
+use super::{CompiledDocument, RawAttributeValue};
+
+/// The memory a `CompiledDocument` holds on to, in bytes, see `CompiledDocument::memory_report`.
+///
+/// Sizes are what the document allocated rather than what the allocator handed out for it,
+/// so the process' heap is usually somewhat larger than the total.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+#[doc = "module=dom"]
+pub struct DocumentMemoryReport {
+  /// Elements in the tree, not counting the free slots of removed subtrees.
+  pub nodes: u32,
+  /// The tree's nodes, and the classes and rules of each element.
+  pub tree: u64,
+  /// Strings the document copied into its own memory.
+  pub strings: u64,
+  /// Strings read in place from the file or binary the document was loaded from. These are
+  /// pages the process maps rather than heap, and can be evicted while the document isn't used.
+  pub mapped_strings: u64,
+  /// The stylesheet's rules, parsed selectors, rule index and merged deltas.
+  pub stylesheet: u64,
+  /// Script attributes that are compiled, see `CompiledDocument::trim`.
+  pub compiled_scripts: u32,
+  /// The script engine, scope and compiled scripts. Rhai doesn't say how much it allocates,
+  /// so this only counts the structures themselves and not what they point to.
+  pub scripts: u64,
+  /// The elements' yoga nodes.
+  pub yoga: u64,
+  /// The boxes of the last layout pass, see `LayoutCache`.
+  pub layout: u64,
+}
+
+impl DocumentMemoryReport {
+  /// Every size added up, `mapped_strings` aside.
+  #[must_use]
+  pub fn total(&self) -> u64 {
+    self.tree + self.strings + self.stylesheet + self.scripts + self.yoga + self.layout
+  }
+}
+
+impl CompiledDocument {
+  /// Measures what the document holds on to.
+  ///
+  /// Takes each of the document's locks for reading, walking every element once.
+  #[must_use]
+  pub fn memory_report(&self) -> DocumentMemoryReport {
+    let tree = self.tree.read().unwrap();
+    let strings = self.strings.read().unwrap();
+
+    let mut report = DocumentMemoryReport {
+      nodes: (tree.len() - tree.free_slots().len()) as u32,
+      tree: tree.allocated_bytes() as u64,
+      stylesheet: self.stylesheet.read().unwrap().allocated_bytes() as u64,
+      scripts: (size_of::<rhai::Engine>() + size_of::<rhai::Scope<'static>>()) as u64,
+      layout: self.layout.read().unwrap().allocated_bytes() as u64,
+      ..DocumentMemoryReport::default()
+    };
+
+    if strings.is_shared() {
+      report.mapped_strings = strings.as_str().len() as u64;
+    } else {
+      report.strings = strings.allocated_bytes() as u64;
+    }
+
+    // Every variable is in the scope too, under a copy of its name.
+    let variables = self.variables.read().unwrap();
+    report.scripts += (variables.len() * 2 * size_of::<(String, rhai::Dynamic)>()) as u64;
+
+    for el in tree.nodes() {
+      let rules = el.style.capacity() * size_of::<style::StyleRule>()
+        + el.style.iter().map(style::StyleRule::allocated_bytes).sum::<usize>();
+      report.tree += (el.classes.capacity() * size_of::<style::Atom>() + rules) as u64;
+
+      let attrs = &el.raw_attributes;
+      let compiled = [&attrs.class, &attrs.id, &attrs.style]
+        .iter()
+        .filter(|attr| matches!(attr, Some(RawAttributeValue::Script { ast: Some(..), .. })))
+        .count();
+      report.compiled_scripts += compiled as u32;
+      report.scripts += (compiled * size_of::<rhai::AST>()) as u64;
+
+      if !el.yg.is_null() {
+        report.yoga += unsafe { el.yg.allocated_bytes() } as u64;
+      }
+    }
+
+    report
+  }
+
+  /// Frees what the document can rebuild on its own, for documents that aren't being shown.
+  ///
+  /// Compiled scripts are compiled again the first time they are evaluated, selectors are parsed
+  /// again the first time they are matched. The yoga nodes pooled for documents that haven't been
+  /// created yet are freed too, since a process trimming its documents likely won't create more soon.
+  pub fn trim(&self) {
+    let mut tree = self.tree.write().unwrap();
+    for el in tree.nodes_mut() {
+      let attrs = &mut el.raw_attributes;
+      for attr in [&mut attrs.class, &mut attrs.id, &mut attrs.style].iter_mut() {
+        if let Some(RawAttributeValue::Script { ast, .. }) = attr {
+          *ast = None;
+        }
+      }
+
+      el.classes.shrink_to_fit();
+      for rule in &mut el.style {
+        rule.trim();
+      }
+    }
+    tree.shrink_to_fit();
+
+    self.stylesheet.write().unwrap().trim();
+    unsafe {
+      yoga::Node::trim_pool();
+    }
+  }
+}
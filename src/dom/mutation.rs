@@ -0,0 +1,412 @@
+use once_cell::sync::Lazy;
+
+use super::{
+  tree::{NodeId, Tree},
+  CompiledDocument, Dirty, Element, ElementData, RawAttributeValue, RawElementAttributes, TreeChange, UnstyledElement,
+};
+
+/// An attribute that can be set through a `Transaction`.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum Attribute {
+  Class,
+  Id,
+}
+
+/// Compiles the scripts of transactions, which are built without the document at hand. It is set
+/// up like the engine of every document, so its ASTs can be evaluated by any of them.
+static ENGINE: Lazy<rhai::Engine> = Lazy::new(rhai::Engine::default);
+
+#[derive(Debug)]
+enum Value {
+  Raw(String),
+  Script(String, rhai::AST),
+}
+
+#[derive(Debug)]
+enum Mutation {
+  SetVariable {
+    name: String,
+    value: rhai::Dynamic,
+  },
+  SetAttribute {
+    node: NodeId,
+    attribute: Attribute,
+    value: Option<Value>,
+  },
+  Append {
+    parent: NodeId,
+  },
+  Remove {
+    node: NodeId,
+  },
+}
+
+/// A batch of changes to a document, applied all at once by `CompiledDocument::commit`.
+///
+/// Building a transaction doesn't touch the document, so it can be filled in on any
+/// thread without blocking rendering. Committing takes each of the document's locks once,
+/// and only marks the elements that were changed (and whatever selectors can see them
+/// from) as dirty, so the next style pass only restyles those.
+#[derive(Debug)]
+#[doc = "module=dom"]
+pub struct Transaction {
+  /// The tree's generation when the transaction was started, see `Tree::generation`.
+  generation: u64,
+  /// How many slots the tree will have once the transaction is committed.
+  len: usize,
+  /// The free slots of the tree that appended nodes haven't taken yet, appended nodes get
+  /// these ids first and the ones after `len` once they run out, like `Tree::append`.
+  free: Vec<NodeId>,
+  appended: usize,
+  mutations: Vec<Mutation>,
+}
+
+impl Transaction {
+  pub(crate) fn new(tree: &Tree<Element>) -> Self {
+    Self {
+      generation: tree.generation(),
+      len: tree.len(),
+      free: tree.free_slots().to_vec(),
+      appended: 0,
+      mutations: Vec::new(),
+    }
+  }
+
+  /// Returns true if `node` exists in the document, or will once this transaction is committed.
+  #[must_use]
+  pub fn contains(&self, node: NodeId) -> bool {
+    node.index() < self.len && self.free.binary_search_by(|probe| node.cmp(probe)).is_err()
+  }
+
+  #[must_use]
+  pub fn is_empty(&self) -> bool {
+    self.mutations.is_empty()
+  }
+
+  /// Sets a script variable, pushing it if it doesn't exist yet.
+  pub fn set_variable<T: rhai::Variant + Clone>(&mut self, name: &str, value: T) {
+    self.mutations.push(Mutation::SetVariable {
+      name: name.to_string(),
+      value: rhai::Dynamic::from(value),
+    });
+  }
+
+  /// Sets an attribute, or removes it if `value` is `None`.
+  ///
+  /// If `script` is true `value` is evaluated like a `:class` or `:id` attribute. It is compiled
+  /// right away, if it doesn't compile the error is returned and the transaction is left as it was.
+  pub fn set_attribute(
+    &mut self,
+    node: NodeId,
+    attribute: Attribute,
+    script: bool,
+    value: Option<&str>,
+  ) -> Result<(), rhai::ParseError> {
+    assert!(self.contains(node), "{:?} is not in the document", node);
+    let value = match value {
+      Some(value) if script => Some(Value::Script(value.to_string(), ENGINE.compile_expression(value)?)),
+      Some(value) => Some(Value::Raw(value.to_string())),
+      None => None,
+    };
+
+    self.mutations.push(Mutation::SetAttribute { node, attribute, value });
+    Ok(())
+  }
+
+  /// Appends an unstyled element to `parent`, returning the id it will have once the transaction is committed.
+  pub fn append(&mut self, parent: NodeId) -> NodeId {
+    assert!(self.contains(parent), "{:?} is not in the document", parent);
+    self.mutations.push(Mutation::Append { parent });
+
+    self.appended += 1;
+    self.free.pop().unwrap_or_else(|| {
+      self.len += 1;
+      NodeId::from_index(self.len - 1)
+    })
+  }
+
+  /// Removes `node` and its subtree from the document.
+  ///
+  /// Their ids are freed once the transaction is committed, and may be handed out to
+  /// elements appended by later transactions.
+  pub fn remove(&mut self, node: NodeId) {
+    assert!(self.contains(node), "{:?} is not in the document", node);
+    assert_ne!(node.index(), 0, "the root can't be removed");
+    self.mutations.push(Mutation::Remove { node });
+  }
+}
+
+impl CompiledDocument {
+  /// Starts a transaction against the current state of the document.
+  #[must_use]
+  pub fn transaction(&self) -> Transaction {
+    Transaction::new(&self.tree.read().unwrap())
+  }
+
+  /// Applies every change in `txn`.
+  ///
+  /// Returns false without changing anything if `txn` appends elements and someone else
+  /// appended or removed elements since it was started, since the ids it handed out would
+  /// be wrong. Changes to elements that were removed in the meantime are skipped, even if
+  /// their ids were given to elements appended since.
+  #[must_use]
+  pub fn commit(&self, txn: Transaction) -> bool {
+    let mut tree = self.tree.write().unwrap();
+    if txn.appended > 0 && tree.generation() != txn.generation {
+      return false;
+    }
+
+    let siblings = self.stylesheet.read().unwrap().index.has_sibling_sensitive();
+    let mut strings = self.strings.write().unwrap();
+    let mut variables = self.variables.write().unwrap();
+    let mut set_variables = Vec::new();
+    let mut removed = Vec::new();
+
+    for mutation in txn.mutations {
+      match mutation {
+        Mutation::SetVariable { name, value } => {
+          variables.set(name.clone(), value);
+          set_variables.push(name);
+        }
+
+        Mutation::SetAttribute { node, attribute, value } => {
+          if tree.freed_since(node, txn.generation) {
+            continue;
+          }
+
+          // Hosts tend to set the same few values over and over, each of them is only stored once.
+          let value = value.map(|value| match value {
+            Value::Raw(value) => RawAttributeValue::Raw {
+              value: strings.intern(&value),
+              up_to_date: false,
+            },
+            Value::Script(script, ast) => RawAttributeValue::Script {
+              script: strings.intern(&script),
+              ast: Some(ast),
+            },
+          });
+
+          let el = &mut tree[node];
+          match attribute {
+            Attribute::Class => el.raw_attributes.class = value,
+            Attribute::Id => el.raw_attributes.id = value,
+          }
+          el.mark_dirty(Dirty::ATTRIBUTES);
+        }
+
+        Mutation::Append { parent } => {
+          let previous_sibling = tree[parent].last_child();
+          let node = Self::append_element(&mut tree, parent, siblings);
+          self.observers.notify(TreeChange::Inserted {
+            parent,
+            previous_sibling,
+            node,
+          });
+        }
+
+        Mutation::Remove { node } => {
+          if tree.freed_since(node, txn.generation) {
+            continue;
+          }
+
+          if let Some(parent) = tree[node].parent() {
+            Self::remove_element(&mut tree, node, siblings);
+            self.observers.notify(TreeChange::Removed { parent, node });
+            removed.push(node);
+          }
+        }
+      }
+    }
+
+    // Freed last, so the ids appended nodes get are the ones the transaction handed out.
+    Self::free_elements(&mut tree, removed);
+
+    if !set_variables.is_empty() {
+      variables.update_scope();
+      for el in tree.nodes_mut() {
+        if set_variables.iter().any(|name| el.references_variable(name, &strings)) {
+          el.mark_dirty(Dirty::ATTRIBUTES);
+        }
+      }
+    }
+
+    true
+  }
+
+  /// `siblings` is `RuleIndex::has_sibling_sensitive`, see `invalidate_style`.
+  fn append_element(tree: &mut Tree<Element>, parent: NodeId, siblings: bool) -> NodeId {
+    let previous_sibling = tree[parent].last_child();
+
+    let id = tree.append(
+      parent,
+      Element::new(ElementData::Unstyled(UnstyledElement), RawElementAttributes::default()),
+    );
+
+    tree[id].yg = unsafe { yoga::Node::alloc(1).pop().unwrap() };
+    let child = *tree[id].yg;
+    unsafe {
+      let parent_yg = &tree[parent].yg;
+      parent_yg.insert_child(child, parent_yg.child_count());
+    }
+
+    // The previous last child is no longer `:last-child`, and the parent is no longer `:empty`.
+    if siblings {
+      match previous_sibling {
+        Some(previous_sibling) => Self::invalidate_style(tree, previous_sibling, true),
+        None => tree[parent].mark_dirty(Dirty::STYLE),
+      }
+    }
+    id
+  }
+
+  fn remove_element(tree: &mut Tree<Element>, node: NodeId, siblings: bool) {
+    let parent = match tree[node].parent() {
+      Some(parent) => parent,
+      // Already removed.
+      None => return,
+    };
+
+    let previous_sibling = tree[node].previous_sibling();
+    let next_sibling = tree[node].next_sibling();
+
+    tree.detach(node);
+
+    let child = *tree[node].yg;
+    unsafe {
+      tree[parent].yg.remove_child(child);
+    }
+
+    // Sibling selectors and structural pseudo-classes of the remaining siblings may match
+    // differently, invalidating the previous sibling covers the ones after it too.
+    if siblings {
+      match previous_sibling.or(next_sibling) {
+        Some(sibling) => Self::invalidate_style(tree, sibling, true),
+        None => tree[parent].mark_dirty(Dirty::STYLE),
+      }
+    }
+    // Yoga only runs when an element's layout inputs changed, the parent stands in for the removed child.
+    tree[parent].mark_dirty(Dirty::LAYOUT);
+  }
+
+  /// Frees the subtrees of `removed`, giving their yoga nodes back to the pool at once.
+  fn free_elements(tree: &mut Tree<Element>, removed: Vec<NodeId>) {
+    let mut yoga_nodes = Vec::new();
+    for node in removed {
+      tree.remove(node, |el| {
+        yoga_nodes.push(el.yg.take());
+        *el = Element::new(ElementData::Unstyled(UnstyledElement), RawElementAttributes::default());
+        el.dirty = Dirty::empty();
+      });
+    }
+
+    unsafe {
+      yoga::Node::release(yoga_nodes);
+    }
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::RootElement;
+
+  fn document() -> CompiledDocument {
+    let root = Element::new(ElementData::Root(RootElement), RawElementAttributes::default());
+    CompiledDocument::new(Tree::new(root), style::StyleSheet::new(), style::StringTable::new())
+  }
+
+  fn class(doc: &CompiledDocument, node: NodeId) -> Option<String> {
+    let tree = doc.tree.read().unwrap();
+    let strings = doc.strings.read().unwrap();
+    match &tree[node].raw_attributes.class {
+      Some(RawAttributeValue::Raw { value, .. }) => Some(strings.get(*value).to_string()),
+      Some(RawAttributeValue::Script { script, .. }) => Some(strings.get(*script).to_string()),
+      None => None,
+    }
+  }
+
+  #[test]
+  fn appended_ids_are_the_ones_handed_out() {
+    let doc = document();
+    let mut txn = doc.transaction();
+    let a = txn.append(NodeId::from_index(0));
+    let b = txn.append(a);
+    txn.set_attribute(b, Attribute::Class, false, Some("b")).unwrap();
+    assert!(doc.commit(txn));
+
+    let tree = doc.tree.read().unwrap();
+    assert_eq!(tree[a].parent(), Some(tree.root()));
+    assert_eq!(tree[b].parent(), Some(a));
+    drop(tree);
+    assert_eq!(class(&doc, b).as_deref(), Some("b"));
+  }
+
+  #[test]
+  fn removed_slots_are_reused() {
+    let doc = document();
+    let mut txn = doc.transaction();
+    let a = txn.append(NodeId::from_index(0));
+    txn.append(a);
+    assert!(doc.commit(txn));
+
+    let mut txn = doc.transaction();
+    txn.remove(a);
+    assert!(doc.commit(txn));
+    assert!(!doc.transaction().contains(a));
+
+    let mut txn = doc.transaction();
+    assert_eq!(txn.append(NodeId::from_index(0)), a);
+    assert!(doc.commit(txn));
+    assert_eq!(doc.tree.read().unwrap().len(), 3);
+  }
+
+  #[test]
+  fn appending_after_a_concurrent_change_fails() {
+    let doc = document();
+    let mut txn = doc.transaction();
+    let a = txn.append(NodeId::from_index(0));
+    assert!(doc.commit(txn));
+
+    let mut stale = doc.transaction();
+    stale.append(a);
+
+    let mut txn = doc.transaction();
+    txn.append(a);
+    assert!(doc.commit(txn));
+
+    assert!(!doc.commit(stale));
+    assert_eq!(doc.tree.read().unwrap().len(), 3);
+  }
+
+  #[test]
+  fn changes_to_reused_slots_are_skipped() {
+    let doc = document();
+    let mut txn = doc.transaction();
+    let a = txn.append(NodeId::from_index(0));
+    let b = txn.append(NodeId::from_index(0));
+    assert!(doc.commit(txn));
+
+    // Started while `a` still exists.
+    let mut stale = doc.transaction();
+    stale.set_attribute(a, Attribute::Class, false, Some("stale")).unwrap();
+    stale.remove(a);
+    stale.set_attribute(b, Attribute::Class, false, Some("b")).unwrap();
+
+    let mut txn = doc.transaction();
+    txn.remove(a);
+    assert!(doc.commit(txn));
+
+    let mut txn = doc.transaction();
+    let c = txn.append(NodeId::from_index(0));
+    txn.set_attribute(c, Attribute::Class, false, Some("c")).unwrap();
+    assert!(doc.commit(txn));
+    assert_eq!(c, a);
+
+    assert!(doc.commit(stale));
+    let tree = doc.tree.read().unwrap();
+    assert_eq!(tree[c].parent(), Some(tree.root()));
+    drop(tree);
+    assert_eq!(class(&doc, c).as_deref(), Some("c"));
+    assert_eq!(class(&doc, b).as_deref(), Some("b"));
+  }
+}
@@ -0,0 +1,68 @@
+use std::sync::{
+  atomic::{AtomicUsize, Ordering},
+  mpsc, Mutex,
+};
+
+use super::tree::NodeId;
+
+/// A change to a document's tree, see `CompiledDocument::observers`.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum TreeChange {
+  /// `node` was appended to `parent`, after `previous_sibling`.
+  Inserted {
+    parent: NodeId,
+    previous_sibling: Option<NodeId>,
+    node: NodeId,
+  },
+  /// `node` and its subtree were removed from `parent`. Their ids are handed out again to
+  /// elements appended later.
+  Removed { parent: NodeId, node: NodeId },
+  /// The computed `class` or `id` of `node` changed.
+  Attributes { node: NodeId },
+}
+
+/// Sends values to everyone who subscribed, like an inspector following a document.
+///
+/// Without subscribers `notify` is a single atomic load, so nothing pays for observers that
+/// aren't there. Receivers are drained on the subscriber's own thread.
+#[derive(Debug)]
+pub struct Observers<T> {
+  /// `senders.len()`, so `notify` doesn't lock without subscribers.
+  count: AtomicUsize,
+  senders: Mutex<Vec<mpsc::Sender<T>>>,
+}
+
+impl<T> Default for Observers<T> {
+  fn default() -> Self {
+    Self {
+      count: AtomicUsize::new(0),
+      senders: Mutex::new(Vec::new()),
+    }
+  }
+}
+
+impl<T: Clone> Observers<T> {
+  /// Returns a receiver for every value from now on, the subscription ends once it's dropped.
+  pub fn subscribe(&self) -> mpsc::Receiver<T> {
+    let (sender, receiver) = mpsc::channel();
+    let mut senders = self.senders.lock().unwrap();
+    senders.push(sender);
+    self.count.store(senders.len(), Ordering::Release);
+    receiver
+  }
+
+  #[must_use]
+  pub fn is_observed(&self) -> bool {
+    self.count.load(Ordering::Acquire) > 0
+  }
+
+  pub fn notify(&self, value: T) {
+    if !self.is_observed() {
+      return;
+    }
+
+    let mut senders = self.senders.lock().unwrap();
+    senders.retain(|sender| sender.send(value.clone()).is_ok());
+    self.count.store(senders.len(), Ordering::Release);
+  }
+}
@@ -0,0 +1,65 @@
+use super::{
+  tree::{Node, NodeId},
+  Element,
+};
+
+/// How many recently styled elements are remembered, lists and tables usually
+/// only need one entry per distinct row or cell type.
+const CACHE_SIZE: usize = 16;
+
+#[derive(Debug)]
+struct Entry {
+  node: NodeId,
+  style: style::ComputedStyle,
+}
+
+/// A cache of recently computed styles that siblings can reuse without matching selectors.
+///
+/// Two elements can share a style if they have the same parent (so all ancestor
+/// selectors match the same way), the same local name, the same id and the same classes.
+/// The stylesheet decides if a style can be shared at all, see `StyleSheet::apply`.
+#[derive(Debug, Default)]
+pub struct StyleSharingCache {
+  entries: Vec<Entry>,
+  next: usize,
+}
+
+impl StyleSharingCache {
+  #[must_use]
+  pub fn new() -> Self {
+    Self::default()
+  }
+
+  fn can_share(a: Node<'_, Element>, b: Node<'_, Element>) -> bool {
+    let (a, b) = (a.inner(), b.inner());
+
+    a.parent().is_some()
+      && a.parent() == b.parent()
+      && a.local_name() == b.local_name()
+      && a.id == b.id
+      && a.classes == b.classes
+  }
+
+  /// Returns a style computed for an element that `node` can share with.
+  #[must_use]
+  pub fn lookup(&self, node: Node<'_, Element>) -> Option<style::ComputedStyle> {
+    let tree = node.tree();
+    self
+      .entries
+      .iter()
+      .find(|entry| Self::can_share(node, tree.get(entry.node)))
+      .map(|entry| entry.style)
+  }
+
+  /// Remembers the style computed for `node`, evicting the oldest entry if the cache is full.
+  pub fn insert(&mut self, node: NodeId, style: style::ComputedStyle) {
+    let entry = Entry { node, style };
+
+    if self.entries.len() < CACHE_SIZE {
+      self.entries.push(entry);
+    } else {
+      self.entries[self.next] = entry;
+      self.next = (self.next + 1) % CACHE_SIZE;
+    }
+  }
+}
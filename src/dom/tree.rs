@@ -1,55 +1,74 @@
-use std::sync::{Arc, RwLock, RwLockReadGuard, RwLockWriteGuard};
+use std::ops::{Deref, DerefMut, Index, IndexMut};
 
-#[derive(Debug)]
-pub struct Node<T>(Arc<RwLock<NodeInner<T>>>);
+use serde::{Deserialize, Serialize};
 
-impl<T> Clone for Node<T> {
-  fn clone(&self) -> Self {
-    Node(Arc::clone(&self.0))
+/// The index of a node inside of a `Tree`.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize)]
+pub struct NodeId(u32);
+
+impl NodeId {
+  #[must_use]
+  pub fn from_index(index: usize) -> Self {
+    Self(index as u32)
+  }
+
+  #[must_use]
+  pub fn index(self) -> usize {
+    self.0 as usize
   }
 }
 
-impl<T> PartialEq for Node<T> {
-  fn eq(&self, other: &Self) -> bool {
-    Arc::ptr_eq(&self.0, &other.0)
+impl From<NodeId> for usize {
+  fn from(id: NodeId) -> usize {
+    id.index()
   }
 }
-impl<T> Eq for Node<T> {}
 
-#[derive(Debug)]
+#[derive(Debug, Serialize, Deserialize)]
 pub struct NodeInner<T> {
-  parent: Option<Node<T>>,
-  previous_sibling: Option<Node<T>>,
-  next_sibling: Option<Node<T>>,
-  first_child: Option<Node<T>>,
-  last_child: Option<Node<T>>,
+  parent: Option<NodeId>,
+  previous_sibling: Option<NodeId>,
+  next_sibling: Option<NodeId>,
+  first_child: Option<NodeId>,
+  last_child: Option<NodeId>,
 
   pub data: T,
 }
 
 impl<T> NodeInner<T> {
-  pub fn parent(&self) -> Option<&Node<T>> {
-    self.parent.as_ref()
+  fn new(parent: Option<NodeId>, previous_sibling: Option<NodeId>, data: T) -> Self {
+    Self {
+      parent,
+      previous_sibling,
+      next_sibling: None,
+      first_child: None,
+      last_child: None,
+      data,
+    }
+  }
+
+  pub fn parent(&self) -> Option<NodeId> {
+    self.parent
   }
 
-  pub fn previous_sibling(&self) -> Option<&Node<T>> {
-    self.previous_sibling.as_ref()
+  pub fn previous_sibling(&self) -> Option<NodeId> {
+    self.previous_sibling
   }
 
-  pub fn next_sibling(&self) -> Option<&Node<T>> {
-    self.next_sibling.as_ref()
+  pub fn next_sibling(&self) -> Option<NodeId> {
+    self.next_sibling
   }
 
-  pub fn first_child(&self) -> Option<&Node<T>> {
-    self.first_child.as_ref()
+  pub fn first_child(&self) -> Option<NodeId> {
+    self.first_child
   }
 
-  pub fn last_child(&self) -> Option<&Node<T>> {
-    self.last_child.as_ref()
+  pub fn last_child(&self) -> Option<NodeId> {
+    self.last_child
   }
 }
 
-impl<T> std::ops::Deref for NodeInner<T> {
+impl<T> Deref for NodeInner<T> {
   type Target = T;
 
   fn deref(&self) -> &Self::Target {
@@ -57,374 +76,488 @@ impl<T> std::ops::Deref for NodeInner<T> {
   }
 }
 
-impl<T> std::ops::DerefMut for NodeInner<T> {
+impl<T> DerefMut for NodeInner<T> {
   fn deref_mut(&mut self) -> &mut Self::Target {
     &mut self.data
   }
 }
 
-impl<T> Node<T> {
-  pub fn new(data: T) -> Self {
-    Self(Arc::new(RwLock::new(NodeInner {
-      parent: None,
-      previous_sibling: None,
-      next_sibling: None,
-      first_child: None,
-      last_child: None,
-      data,
-    })))
+/// An index based tree.
+///
+/// All nodes live in a single `Vec` and link to each other by index, so walking the
+/// tree doesn't need any locking or reference counting. Nodes appended in pre-order
+/// (which is how the compiler and deserializer build trees) end up in document order.
+///
+/// The slots of removed subtrees are kept on a free list and handed out again by `append`,
+/// so trees that keep changing don't keep growing.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct Tree<T> {
+  nodes: Vec<NodeInner<T>>,
+
+  /// Slots of removed nodes, sorted from the highest to the lowest so `append` reuses the lowest first.
+  #[serde(skip)]
+  free: Vec<NodeId>,
+  /// Bumped whenever a node is added or freed, see `generation`.
+  #[serde(skip)]
+  generation: u64,
+  /// The generation each slot was last freed in, only as long as the last slot that was freed.
+  #[serde(skip)]
+  freed_at: Vec<u64>,
+}
+
+impl<T> Tree<T> {
+  pub fn new(root: T) -> Self {
+    Self {
+      nodes: vec![NodeInner::new(None, None, root)],
+      free: Vec::new(),
+      generation: 0,
+      freed_at: Vec::new(),
+    }
+  }
+
+  #[must_use]
+  pub fn root(&self) -> NodeId {
+    NodeId(0)
+  }
+
+  /// The number of slots in the tree, free ones included. Every `NodeId` is below this.
+  #[must_use]
+  pub fn len(&self) -> usize {
+    self.nodes.len()
+  }
+
+  /// The slots of removed nodes that `append` will reuse, in the order it reuses them (last first).
+  #[must_use]
+  pub fn free_slots(&self) -> &[NodeId] {
+    &self.free
+  }
+
+  /// Returns true if `id` is the slot of a removed node.
+  #[must_use]
+  pub fn is_free(&self, id: NodeId) -> bool {
+    self.free.binary_search_by(|probe| id.cmp(probe)).is_ok()
   }
 
-  pub fn inner(&self) -> RwLockReadGuard<'_, NodeInner<T>> {
-    self.0.read().unwrap()
+  /// Changes every time a node is added or freed, so the ids `append` hands out are only
+  /// predictable while the generation stays the same.
+  #[must_use]
+  pub fn generation(&self) -> u64 {
+    self.generation
   }
 
-  pub fn inner_mut(&self) -> RwLockWriteGuard<'_, NodeInner<T>> {
-    self.0.write().unwrap()
+  /// Returns true if the slot of `id` was freed after `generation`, even if it has been reused
+  /// since. Ids handed out before then no longer refer to the node in that slot.
+  #[must_use]
+  pub fn freed_since(&self, id: NodeId, generation: u64) -> bool {
+    self.freed_at.get(id.index()).map_or(false, |&freed| freed > generation)
   }
 
-  pub fn append(&self, data: T) -> Node<T> {
-    let mut inner = self.0.write().unwrap();
-    match inner.last_child.as_ref() {
-      Some(last) => {
-        let node = Node(Arc::new(RwLock::new(NodeInner {
-          parent: Some(self.clone()),
-          previous_sibling: Some(last.clone()),
-          next_sibling: None,
-          first_child: None,
-          last_child: None,
-          data,
-        })));
+  #[must_use]
+  pub fn is_empty(&self) -> bool {
+    self.nodes.is_empty()
+  }
+
+  /// The memory the nodes take up, in bytes, not counting what their data owns.
+  #[must_use]
+  pub fn allocated_bytes(&self) -> usize {
+    self.nodes.capacity() * std::mem::size_of::<NodeInner<T>>()
+      + self.free.capacity() * std::mem::size_of::<NodeId>()
+      + self.freed_at.capacity() * std::mem::size_of::<u64>()
+  }
+
+  pub fn shrink_to_fit(&mut self) {
+    self.nodes.shrink_to_fit();
+  }
+
+  pub fn get(&self, id: NodeId) -> Node<'_, T> {
+    Node { tree: self, id }
+  }
+
+  /// Appends a node to `parent`, in the lowest free slot if there is one.
+  pub fn append(&mut self, parent: NodeId, data: T) -> NodeId {
+    let previous_sibling = self[parent].last_child;
+    let id = self.insert(NodeInner::new(Some(parent), previous_sibling, data));
+
+    if let Some(previous_sibling) = previous_sibling {
+      self[previous_sibling].next_sibling = Some(id);
+    } else {
+      self[parent].first_child = Some(id);
+    }
+    self[parent].last_child = Some(id);
+
+    id
+  }
+
+  /// Adds a node without a parent or siblings, like the root of a detached subtree.
+  pub fn push_detached(&mut self, data: T) -> NodeId {
+    self.insert(NodeInner::new(None, None, data))
+  }
 
-        last.0.write().unwrap().next_sibling = Some(node.clone());
-        inner.last_child = Some(node.clone());
+  fn insert(&mut self, node: NodeInner<T>) -> NodeId {
+    self.generation += 1;
+    match self.free.pop() {
+      Some(id) => {
+        self[id] = node;
+        id
+      }
+      None => {
+        self.nodes.push(node);
+        NodeId::from_index(self.nodes.len() - 1)
+      }
+    }
+  }
 
-        node
+  /// Unlinks `id` and its subtree from its parent and siblings.
+  ///
+  /// The nodes stay in the arena so existing `NodeId`s remain valid, they just aren't
+  /// reachable from the root anymore. Detached subtrees have no parent, see `remove` to
+  /// free them.
+  pub fn detach(&mut self, id: NodeId) {
+    let (parent, previous_sibling, next_sibling) = {
+      let node = &self[id];
+      (node.parent, node.previous_sibling, node.next_sibling)
+    };
+
+    match previous_sibling {
+      Some(previous_sibling) => self[previous_sibling].next_sibling = next_sibling,
+      None => {
+        if let Some(parent) = parent {
+          self[parent].first_child = next_sibling;
+        }
       }
+    }
 
+    match next_sibling {
+      Some(next_sibling) => self[next_sibling].previous_sibling = previous_sibling,
       None => {
-        let node = Node(Arc::new(RwLock::new(NodeInner {
-          parent: Some(self.clone()),
-          previous_sibling: None,
-          next_sibling: None,
-          first_child: None,
-          last_child: None,
-          data,
-        })));
-
-        inner.first_child = Some(node.clone());
-        inner.last_child = Some(node.clone());
-
-        node
+        if let Some(parent) = parent {
+          self[parent].last_child = previous_sibling;
+        }
+      }
+    }
+
+    let node = &mut self[id];
+    node.parent = None;
+    node.previous_sibling = None;
+    node.next_sibling = None;
+  }
+
+  /// Detaches `id` and frees the slots of its subtree, so `append` can reuse them.
+  ///
+  /// `release` is called with the data of every node of the subtree, which stays in its slot
+  /// until the slot is reused. `NodeId`s of the subtree must not be used after this, see
+  /// `freed_since` to tell whether an old id still refers to the same node.
+  pub fn remove<F: FnMut(&mut T)>(&mut self, id: NodeId, mut release: F) {
+    assert_ne!(id, self.root(), "the root can't be removed");
+    self.detach(id);
+
+    let start = self.free.len();
+    let mut current = Some(id);
+    while let Some(node) = current {
+      current = self.next_descendant(id, node);
+      self.free.push(node);
+    }
+
+    for &node in &self.free[start..] {
+      let node = &mut self.nodes[node.index()];
+      node.parent = None;
+      node.previous_sibling = None;
+      node.next_sibling = None;
+      node.first_child = None;
+      node.last_child = None;
+      release(&mut node.data);
+    }
+
+    self.generation += 1;
+    for &node in &self.free[start..] {
+      if self.freed_at.len() <= node.index() {
+        self.freed_at.resize(node.index() + 1, 0);
       }
+      self.freed_at[node.index()] = self.generation;
     }
+
+    self.free.sort_unstable_by(|a, b| b.cmp(a));
   }
 
-  pub fn children(&self) -> Children<T> {
+  /// Returns the node after `current` in a pre-order walk of the subtree rooted at `root`.
+  ///
+  /// This is what `descendants` uses internally, it is exposed so the tree can be walked
+  /// while it's being mutated.
+  #[must_use]
+  pub fn next_descendant(&self, root: NodeId, current: NodeId) -> Option<NodeId> {
+    if let Some(first_child) = self[current].first_child {
+      return Some(first_child);
+    }
+
+    let mut node = current;
+    while node != root {
+      if let Some(next_sibling) = self[node].next_sibling {
+        return Some(next_sibling);
+      }
+
+      // `parent` here can only be `None` if the tree has been modified during
+      // iteration, but silently stoping iteration seems a more sensible
+      // behavior than panicking.
+      node = self[node].parent?;
+    }
+
+    None
+  }
+
+  pub fn nodes(&self) -> impl Iterator<Item = &NodeInner<T>> {
+    self.nodes.iter()
+  }
+
+  pub fn nodes_mut(&mut self) -> impl Iterator<Item = &mut NodeInner<T>> {
+    self.nodes.iter_mut()
+  }
+
+  pub fn children(&self, id: NodeId) -> Children<'_, T> {
     Children {
-      current: self.inner().first_child().cloned(),
+      tree: self,
+      current: self[id].first_child,
     }
   }
 
-  pub fn traverse(&self) -> Traverse<T> {
-    Traverse::new(self.clone())
+  pub fn traverse(&self, id: NodeId) -> Traverse<'_, T> {
+    Traverse::new(self, id)
+  }
+
+  pub fn descendants(&self, id: NodeId) -> Descendants<'_, T> {
+    Descendants {
+      tree: self,
+      root: id,
+      next: Some(id),
+    }
+  }
+}
+
+impl<T> Index<NodeId> for Tree<T> {
+  type Output = NodeInner<T>;
+
+  fn index(&self, id: NodeId) -> &Self::Output {
+    &self.nodes[id.index()]
+  }
+}
+
+impl<T> IndexMut<NodeId> for Tree<T> {
+  fn index_mut(&mut self, id: NodeId) -> &mut Self::Output {
+    &mut self.nodes[id.index()]
+  }
+}
+
+/// A borrowed handle to a node in a `Tree`.
+pub struct Node<'a, T> {
+  tree: &'a Tree<T>,
+  id: NodeId,
+}
+
+impl<T> Clone for Node<'_, T> {
+  fn clone(&self) -> Self {
+    *self
+  }
+}
+
+impl<T> Copy for Node<'_, T> {}
+
+impl<T> PartialEq for Node<'_, T> {
+  fn eq(&self, other: &Self) -> bool {
+    std::ptr::eq(self.tree, other.tree) && self.id == other.id
   }
+}
+impl<T> Eq for Node<'_, T> {}
 
-  pub fn descendants(&self) -> Descendants<T> {
-    Descendants::new(self.clone())
+impl<T> std::fmt::Debug for Node<'_, T> {
+  fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+    f.debug_tuple("Node").field(&self.id).finish()
   }
 }
 
-pub struct Children<T> {
-  current: Option<Node<T>>,
+impl<'a, T> Node<'a, T> {
+  #[must_use]
+  pub fn id(&self) -> NodeId {
+    self.id
+  }
+
+  #[must_use]
+  pub fn tree(&self) -> &'a Tree<T> {
+    self.tree
+  }
+
+  #[must_use]
+  pub fn inner(&self) -> &'a NodeInner<T> {
+    &self.tree[self.id]
+  }
+
+  fn link(&self, id: Option<NodeId>) -> Option<Self> {
+    id.map(|id| self.tree.get(id))
+  }
+
+  pub fn parent(&self) -> Option<Self> {
+    self.link(self.inner().parent)
+  }
+
+  pub fn previous_sibling(&self) -> Option<Self> {
+    self.link(self.inner().previous_sibling)
+  }
+
+  pub fn next_sibling(&self) -> Option<Self> {
+    self.link(self.inner().next_sibling)
+  }
+
+  pub fn first_child(&self) -> Option<Self> {
+    self.link(self.inner().first_child)
+  }
+
+  pub fn last_child(&self) -> Option<Self> {
+    self.link(self.inner().last_child)
+  }
+
+  pub fn children(&self) -> Children<'a, T> {
+    self.tree.children(self.id)
+  }
+
+  pub fn traverse(&self) -> Traverse<'a, T> {
+    self.tree.traverse(self.id)
+  }
+
+  pub fn descendants(&self) -> Descendants<'a, T> {
+    self.tree.descendants(self.id)
+  }
 }
 
-impl<T> std::iter::Iterator for Children<T> {
-  type Item = Node<T>;
+impl<T> Deref for Node<'_, T> {
+  type Target = NodeInner<T>;
 
-  fn next(&mut self) -> Option<Node<T>> {
-    let current = self.current.clone();
-    self.current = current.as_ref().and_then(|x| x.inner().next_sibling().cloned());
-    current
+  fn deref(&self) -> &Self::Target {
+    self.inner()
   }
 }
 
-#[derive(Clone)]
-/// An iterator of the IDs of a given node and its descendants, as a pre-order depth-first search where children are visited in insertion order.
+pub struct Children<'a, T> {
+  tree: &'a Tree<T>,
+  current: Option<NodeId>,
+}
+
+impl<'a, T> Iterator for Children<'a, T> {
+  type Item = Node<'a, T>;
+
+  fn next(&mut self) -> Option<Node<'a, T>> {
+    let current = self.tree.get(self.current?);
+    self.current = current.inner().next_sibling;
+    Some(current)
+  }
+}
+
+/// An iterator of a given node and its descendants, as a pre-order depth-first search where children are visited in insertion order.
 ///
 /// i.e. node -> first child -> second child
-pub struct Descendants<T>(Traverse<T>);
+pub struct Descendants<'a, T> {
+  tree: &'a Tree<T>,
+  root: NodeId,
+  next: Option<NodeId>,
+}
 
-impl<'a, T> Descendants<T> {
-  pub(crate) fn new(current: Node<T>) -> Self {
-    Self(Traverse::new(current))
+impl<T> Clone for Descendants<'_, T> {
+  fn clone(&self) -> Self {
+    Self {
+      tree: self.tree,
+      root: self.root,
+      next: self.next,
+    }
   }
 }
 
-impl<'a, T> Iterator for Descendants<T> {
-  type Item = Node<T>;
+impl<'a, T> Iterator for Descendants<'a, T> {
+  type Item = Node<'a, T>;
 
-  fn next(&mut self) -> Option<Node<T>> {
-    self.0.find_map(|edge| match edge {
-      NodeEdge::Start(node) => Some(node),
-      NodeEdge::End(_) => None,
-    })
+  fn next(&mut self) -> Option<Node<'a, T>> {
+    let current = self.next?;
+    self.next = self.tree.next_descendant(self.root, current);
+    Some(self.tree.get(current))
   }
 }
 
 #[derive(Debug)]
 /// Indicator if the node is at a start or endpoint of the tree
-pub enum NodeEdge<T> {
+pub enum NodeEdge<'a, T> {
   /// Indicates that start of a node that has children.
   ///
   /// Yielded by `Traverse::next()` before the node’s descendants. In HTML or
   /// XML, this corresponds to an opening tag like `<div>`.
-  Start(Node<T>),
+  Start(Node<'a, T>),
 
   /// Indicates that end of a node that has children.
   ///
   /// Yielded by `Traverse::next()` after the node’s descendants. In HTML or
   /// XML, this corresponds to a closing tag like `</div>`
-  End(Node<T>),
+  End(Node<'a, T>),
 }
 
-impl<T> Clone for NodeEdge<T> {
+impl<T> Clone for NodeEdge<'_, T> {
   fn clone(&self) -> Self {
-    match self {
-      Self::Start(n) => Self::Start(n.clone()),
-      Self::End(n) => Self::End(n.clone()),
-    }
+    *self
   }
 }
 
-#[derive(Clone)]
+impl<T> Copy for NodeEdge<'_, T> {}
+
 /// An iterator of the "sides" of a node visited during a depth-first pre-order traversal,
 /// where node sides are visited start to end and children are visited in insertion order.
 ///
 /// i.e. node.start -> first child -> second child -> node.end
-pub struct Traverse<T> {
-  root: Node<T>,
-  next: Option<NodeEdge<T>>,
+pub struct Traverse<'a, T> {
+  root: Node<'a, T>,
+  next: Option<NodeEdge<'a, T>>,
+}
+
+impl<T> Clone for Traverse<'_, T> {
+  fn clone(&self) -> Self {
+    Self {
+      root: self.root,
+      next: self.next,
+    }
+  }
 }
 
-impl<T> Traverse<T> {
-  pub(crate) fn new(current: Node<T>) -> Self {
+impl<'a, T> Traverse<'a, T> {
+  pub(crate) fn new(tree: &'a Tree<T>, current: NodeId) -> Self {
+    let current = tree.get(current);
     Self {
-      root: current.clone(),
+      root: current,
       next: Some(NodeEdge::Start(current)),
     }
   }
 
   /// Calculates the next node.
-  fn next_of_next(&self, next: NodeEdge<T>) -> Option<NodeEdge<T>> {
+  fn next_of_next(&self, next: NodeEdge<'a, T>) -> Option<NodeEdge<'a, T>> {
     match next {
-      NodeEdge::Start(node) => match node.inner().first_child() {
-        Some(first_child) => Some(NodeEdge::Start(first_child.clone())),
-        None => Some(NodeEdge::End(node.clone())),
+      NodeEdge::Start(node) => match node.first_child() {
+        Some(first_child) => Some(NodeEdge::Start(first_child)),
+        None => Some(NodeEdge::End(node)),
       },
       NodeEdge::End(node) => {
         if node == self.root {
           return None;
         }
-        match node.inner().next_sibling.clone() {
+        match node.next_sibling() {
           Some(next_sibling) => Some(NodeEdge::Start(next_sibling)),
           // `node.parent()` here can only be `None` if the tree has
           // been modified during iteration, but silently stoping
           // iteration seems a more sensible behavior than panicking.
-          None => node.inner().parent.clone().map(NodeEdge::End),
+          None => node.parent().map(NodeEdge::End),
         }
       }
     }
   }
 }
 
-impl<T> Iterator for Traverse<T> {
-  type Item = NodeEdge<T>;
+impl<'a, T> Iterator for Traverse<'a, T> {
+  type Item = NodeEdge<'a, T>;
 
-  fn next(&mut self) -> Option<NodeEdge<T>> {
+  fn next(&mut self) -> Option<NodeEdge<'a, T>> {
     let next = self.next.take()?;
-    self.next = self.next_of_next(next.clone());
+    self.next = self.next_of_next(next);
     Some(next)
   }
 }
-
-mod serde {
-  use super::{Node, NodeInner};
-
-  use std::{
-    fmt,
-    marker::PhantomData,
-    sync::{Arc, RwLock},
-  };
-
-  use serde::{
-    de::{self, Deserialize, Deserializer, MapAccess, SeqAccess, Visitor},
-    ser::{Serialize, SerializeSeq, SerializeStruct, Serializer},
-  };
-
-  impl<T: Serialize> Serialize for Node<T> {
-    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
-    where
-      S: Serializer,
-    {
-      let mut state = serializer.serialize_struct("Node", 2)?;
-      state.serialize_field("data", &self.inner().data)?;
-      state.serialize_field("children", &NodeSerializeChildren(self))?;
-      state.end()
-    }
-  }
-
-  struct NodeSerializeChildren<'a, T>(&'a Node<T>);
-
-  impl<T: Serialize> Serialize for NodeSerializeChildren<'_, T> {
-    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
-    where
-      S: Serializer,
-    {
-      let mut seq = serializer.serialize_seq(Some(self.0.children().count()))?;
-      for node in self.0.children() {
-        seq.serialize_element(&node)?;
-      }
-      seq.end()
-    }
-  }
-
-  struct PartialParent<T> {
-    first_child: Option<Node<T>>,
-    last_child: Option<Node<T>>,
-  }
-
-  impl<'de, T: Deserialize<'de>> Deserialize<'de> for PartialParent<T> {
-    fn deserialize<D>(deserializer: D) -> Result<Self, D::Error>
-    where
-      D: Deserializer<'de>,
-    {
-      struct ChildVisitor<T> {
-        last_node: Option<Node<T>>,
-      }
-
-      impl<'de, T: Deserialize<'de>> Visitor<'de> for ChildVisitor<T> {
-        type Value = PartialParent<T>;
-
-        fn expecting(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
-          formatter.write_str("struct Duration")
-        }
-
-        fn visit_seq<V>(mut self, mut seq: V) -> Result<PartialParent<T>, V::Error>
-        where
-          V: SeqAccess<'de>,
-        {
-          let mut first_child = None;
-
-          while let Some(node) = seq.next_element::<Node<T>>()? {
-            if first_child.is_none() {
-              first_child = Some(node.clone());
-            }
-
-            if let Some(last_node) = self.last_node {
-              last_node.inner_mut().next_sibling = Some(node.clone());
-              node.inner_mut().previous_sibling = Some(last_node.clone());
-            }
-
-            self.last_node = Some(node);
-          }
-
-          Ok(PartialParent {
-            first_child,
-            last_child: self.last_node,
-          })
-        }
-      }
-
-      deserializer.deserialize_seq(ChildVisitor { last_node: None })
-    }
-  }
-
-  impl<'de, T: Deserialize<'de>> Deserialize<'de> for Node<T> {
-    fn deserialize<D>(deserializer: D) -> Result<Self, D::Error>
-    where
-      D: Deserializer<'de>,
-    {
-      #[derive(serde::Deserialize)]
-      #[serde(field_identifier, rename_all = "lowercase")]
-      enum Field {
-        Data,
-        Children,
-      }
-
-      struct NodeVisitor<T> {
-        _phantom: PhantomData<T>,
-      }
-
-      impl<T> NodeVisitor<T> {
-        fn construct(data: T, partial: PartialParent<T>) -> Node<T> {
-          let parent = Node(Arc::new(RwLock::new(NodeInner {
-            parent: None,
-            previous_sibling: None,
-            next_sibling: None,
-            first_child: partial.first_child,
-            last_child: partial.last_child,
-
-            data,
-          })));
-
-          for child in parent.children() {
-            child.inner_mut().parent = Some(parent.clone());
-          }
-
-          parent
-        }
-      }
-
-      impl<'de, T: Deserialize<'de>> Visitor<'de> for NodeVisitor<T> {
-        type Value = Node<T>;
-
-        fn expecting(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
-          formatter.write_str("struct Node")
-        }
-
-        fn visit_seq<V>(self, mut seq: V) -> Result<Node<T>, V::Error>
-        where
-          V: SeqAccess<'de>,
-        {
-          let data = seq.next_element()?.ok_or_else(|| de::Error::invalid_length(0, &self))?;
-          let partial = seq.next_element()?.ok_or_else(|| de::Error::invalid_length(1, &self))?;
-          Ok(Self::construct(data, partial))
-        }
-
-        fn visit_map<V>(self, mut map: V) -> Result<Node<T>, V::Error>
-        where
-          V: MapAccess<'de>,
-        {
-          let mut data = None;
-          let mut partial = None;
-          while let Some(key) = map.next_key()? {
-            match key {
-              Field::Data => {
-                if data.is_some() {
-                  return Err(de::Error::duplicate_field("data"));
-                }
-                data = Some(map.next_value()?);
-              }
-
-              Field::Children => {
-                if partial.is_some() {
-                  return Err(de::Error::duplicate_field("children"));
-                }
-                partial = Some(map.next_value()?);
-              }
-            }
-          }
-
-          let data = data.ok_or_else(|| de::Error::missing_field("data"))?;
-          let partial = partial.ok_or_else(|| de::Error::missing_field("children"))?;
-
-          Ok(Self::construct(data, partial))
-        }
-      }
-
-      const FIELDS: &[&str] = &["data", "children"];
-      deserializer.deserialize_struct("NodeInner", FIELDS, NodeVisitor::<T> { _phantom: PhantomData })
-    }
-  }
-}
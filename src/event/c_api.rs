@@ -9,6 +9,49 @@ pub type EventHandler = super::EventHandler<CWindowing>;
 #[doc = "module=event"]
 pub type EmptyCallback = extern "C" fn(user: *mut c_void);
 
+/// An event for `EventHandler_handle_events`, `tag` says which of the fields is set.
+///
+/// Pointer positions are in device pixels of the framebuffer.
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+#[doc = "module=event"]
+pub enum Event {
+  Resized { size: DeviceSize },
+  ScaleFactorChanged { scale: f32 },
+  Redraw,
+  Empty,
+  PointerMoved { x: f32, y: f32 },
+  PointerDown,
+  PointerUp,
+  PointerLeft,
+}
+
+impl From<Event> for super::Event {
+  fn from(event: Event) -> Self {
+    match event {
+      Event::Resized { size } => Self::Resized(size),
+      Event::ScaleFactorChanged { scale } => Self::ScaleFactorChanged(scale),
+      Event::Redraw => Self::Redraw,
+      Event::Empty => Self::Empty,
+      Event::PointerMoved { x, y } => Self::PointerMoved(DevicePoint::new(x, y)),
+      Event::PointerDown => Self::PointerDown,
+      Event::PointerUp => Self::PointerUp,
+      Event::PointerLeft => Self::PointerLeft,
+    }
+  }
+}
+
+/// Returned instead of a node when there is none.
+const NO_NODE: u32 = u32::MAX;
+
+/// Splits a hit into the node it returns and the view it writes to `view`, if that isn't null.
+unsafe fn write_hit(hit: Option<(usize, dom::tree::NodeId)>, view: *mut u32) -> u32 {
+  if let Some(view_out) = view.as_mut() {
+    *view_out = hit.map_or(0, |(view, _)| view as u32);
+  }
+  hit.map_or(NO_NODE, |(_, node)| node.index() as u32)
+}
+
 pub struct CWindowing {
   user: *mut c_void,
   swap_buffers: EmptyCallback,
@@ -32,11 +75,18 @@ impl Windowing for CWindowing {
 
 #[allow(non_snake_case)]
 impl EventHandler {
+  /// Takes ownership of `renderer` and `doc`.
+  ///
+  /// If `threaded` is true style, layout and display list building run on a worker thread,
+  /// and the handler only composites the scene that is ready.
+  /// Threaded hosts have to pass `RendererOptions::wake_up` to the renderer to
+  /// find out when the next scene is ready.
   #[no_mangle]
   #[doc = "module=event,index=0"]
   pub unsafe extern "C" fn EventHandler_new(
     renderer: *mut render::Renderer,
     doc: *const dom::CompiledDocument,
+    threaded: bool,
     swap_buffers: EmptyCallback,
     make_current: EmptyCallback,
     make_not_current: EmptyCallback,
@@ -49,7 +99,13 @@ impl EventHandler {
       make_not_current,
     };
 
-    let event_handler = EventHandler::new(windowing, *Box::from_raw(renderer), Arc::from_raw(doc));
+    let renderer = *Box::from_raw(renderer);
+    let doc = Arc::from_raw(doc);
+    let event_handler = if threaded {
+      EventHandler::new_threaded(windowing, renderer, doc)
+    } else {
+      EventHandler::new(windowing, renderer, doc)
+    };
 
     Box::into_raw(Box::new(event_handler))
   }
@@ -67,25 +123,38 @@ impl EventHandler {
   #[no_mangle]
   #[doc = "module=event,index=2"]
   pub unsafe extern "C" fn EventHandler_handle_resize(&mut self, size: DeviceSize) {
-    self.handle_event(Event::Resized(size))
+    self.handle_event(super::Event::Resized(size))
   }
 
   #[no_mangle]
   #[doc = "module=event,index=3"]
   pub unsafe extern "C" fn EventHandler_handle_scale_factor_change(&mut self, scale: f32) {
-    self.handle_event(Event::ScaleFactorChanged(scale))
+    self.handle_event(super::Event::ScaleFactorChanged(scale))
   }
 
   #[no_mangle]
   #[doc = "module=event,index=4"]
   pub unsafe extern "C" fn EventHandler_handle_redraw(&mut self) {
-    self.handle_event(Event::Redraw)
+    self.handle_event(super::Event::Redraw)
   }
 
   #[no_mangle]
   #[doc = "module=event,index=5"]
   pub unsafe extern "C" fn EventHandler_handle_empty(&mut self) {
-    self.handle_event(Event::Empty)
+    self.handle_event(super::Event::Empty)
+  }
+
+  /// Handles `count` events and renders at most one frame afterwards, where calling
+  /// `EventHandler_handle_redraw` for each redraw renders every time.
+  #[no_mangle]
+  #[doc = "module=event,index=9"]
+  pub unsafe extern "C" fn EventHandler_handle_events(&mut self, events: *const Event, count: usize) {
+    let events = if count == 0 {
+      &[]
+    } else {
+      std::slice::from_raw_parts(events, count)
+    };
+    self.handle_events(events.iter().map(|&event| event.into()));
   }
 
   #[no_mangle]
@@ -94,9 +163,60 @@ impl EventHandler {
     self.windowing.user
   }
 
+  /// Takes ownership of `doc` and shows it from the next frame on.
+  ///
+  /// If only the stylesheets differ from the current document's, the current document takes
+  /// them over and keeps its layout, script variables and scroll positions.
+  #[no_mangle]
+  #[doc = "module=event,index=13"]
+  pub unsafe extern "C" fn EventHandler_set_document(&mut self, doc: *const dom::CompiledDocument) {
+    self.set_document(Arc::from_raw(doc));
+  }
+
   #[no_mangle]
   #[doc = "module=event,index=7"]
   pub unsafe extern "C" fn EventHandler_set_user(&mut self, user: *mut c_void) {
     self.windowing.user = user;
   }
+
+  /// Returns the element at `x`, `y` (in device pixels of the framebuffer), or `UINT32_MAX` if
+  /// there is none, and writes the view it is in to `view` unless it is null.
+  ///
+  /// This uses a grid built along with the last display list, so it is cheap enough to call
+  /// for every pointer move.
+  #[no_mangle]
+  #[doc = "module=event,index=10"]
+  pub unsafe extern "C" fn EventHandler_hit_test(&mut self, x: f32, y: f32, view: *mut u32) -> u32 {
+    write_hit(self.hit_test(DevicePoint::new(x, y)), view)
+  }
+
+  /// Returns the element under the pointer as of the last pointer event, like `EventHandler_hit_test`.
+  #[no_mangle]
+  #[doc = "module=event,index=11"]
+  pub unsafe extern "C" fn EventHandler_get_hovered(&mut self, view: *mut u32) -> u32 {
+    write_hit(self.hovered(), view)
+  }
+
+  /// Returns the element a button was pressed on until it is released, like `EventHandler_hit_test`.
+  #[no_mangle]
+  #[doc = "module=event,index=12"]
+  pub unsafe extern "C" fn EventHandler_get_pressed(&mut self, view: *mut u32) -> u32 {
+    write_hit(self.pressed(), view)
+  }
+
+  /// Returns true if something changed since the last frame or WebRender has a new frame ready.
+  ///
+  /// Hosts can use this to decide if they need to call `EventHandler_handle_redraw`.
+  #[no_mangle]
+  #[doc = "module=event,index=8"]
+  pub unsafe extern "C" fn EventHandler_needs_frame(&mut self) -> bool {
+    self.needs_frame()
+  }
+
+  /// Frees the caches of the renderer and the document, call it when the window is hidden.
+  #[no_mangle]
+  #[doc = "module=event,index=14"]
+  pub unsafe extern "C" fn EventHandler_trim(&mut self) {
+    self.trim();
+  }
 }
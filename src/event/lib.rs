@@ -4,11 +4,15 @@
 
 #[cfg(feature = "c-event")]
 pub mod c_api;
+mod scene_thread;
+mod scheduler;
 
-use dom::CompiledDocument;
+use dom::{tree::NodeId, CompiledDocument};
+use scene_thread::SceneThread;
+use scheduler::{FrameRequest, FrameScheduler};
 use std::sync::Arc;
 
-pub use render::DeviceSize;
+pub use render::{DevicePoint, DeviceSize, RenderMode};
 
 #[derive(Debug, Clone)]
 pub enum Event {
@@ -16,6 +20,13 @@ pub enum Event {
   ScaleFactorChanged(f32),
   Redraw,
   Empty,
+  /// The pointer moved to a point of the framebuffer, in device pixels.
+  PointerMoved(DevicePoint),
+  /// A button was pressed where the pointer last moved to.
+  PointerDown,
+  PointerUp,
+  /// The pointer left the window.
+  PointerLeft,
 }
 
 pub trait Windowing {
@@ -28,7 +39,12 @@ pub struct EventHandler<W: Windowing> {
   pub renderer: render::Renderer,
   pub windowing: W,
   pub doc: Arc<CompiledDocument>,
-  render_inner: bool,
+  scheduler: FrameScheduler,
+  /// Builds scenes off of the windowing thread, see `new_threaded`.
+  scene_thread: Option<SceneThread>,
+  pointer: Option<DevicePoint>,
+  hovered: Option<(usize, NodeId)>,
+  pressed: Option<(usize, NodeId)>,
 }
 
 impl<W: Windowing> EventHandler<W> {
@@ -38,33 +54,188 @@ impl<W: Windowing> EventHandler<W> {
       windowing,
       renderer,
       doc,
-      render_inner: true,
+      scheduler: FrameScheduler::new(),
+      scene_thread: None,
+      pointer: None,
+      hovered: None,
+      pressed: None,
+    }
+  }
+
+  /// Like `new`, but style, layout and display list building run on a worker thread.
+  ///
+  /// The windowing thread only composites whatever scene is ready, so a slow restyle
+  /// doesn't block input handling or compositing. The renderer's notifier is called
+  /// whenever a new scene is ready.
+  #[must_use]
+  pub fn new_threaded(windowing: W, mut renderer: render::Renderer, doc: Arc<CompiledDocument>) -> Self {
+    let scene_thread = SceneThread::spawn(renderer.take_scene_builder(), Arc::clone(&doc));
+
+    Self {
+      scene_thread: Some(scene_thread),
+      ..Self::new(windowing, renderer, doc)
     }
   }
 
   pub fn deinit(mut self) {
+    // Stop building scenes before the renderer goes away.
+    self.scene_thread = None;
+
     self.windowing.make_current();
     self.renderer.deinit();
     self.windowing.make_not_current();
   }
 
+  /// Returns true if the next redraw or wake up would produce a frame, either because something
+  /// changed since the last frame or because WebRender has a new frame ready.
+  ///
+  /// Hosts that drive their own loop can use this to skip calling `handle_event` entirely.
+  #[must_use]
+  pub fn needs_frame(&self) -> bool {
+    self.scheduler.is_dirty()
+      || self.renderer.has_new_frame()
+      || self.scene_thread.as_ref().map_or(false, SceneThread::has_pending)
+  }
+
+  /// Shows `doc` instead of the current document from the next frame on.
+  ///
+  /// If `doc` was compiled from the same markup (only its stylesheets changed), the current
+  /// document takes over its stylesheet instead, see `CompiledDocument::adopt_stylesheet`.
+  /// Its yoga tree, script variables and scroll positions are kept, and the renderer only
+  /// rebuilds what the new styles changed. Otherwise the documents are swapped, in threaded
+  /// mode the scene being built finishes with the old one.
+  pub fn set_document(&mut self, doc: Arc<CompiledDocument>) {
+    if !self.doc.adopt_stylesheet(&doc) {
+      self.doc = doc;
+      if let Some(scene_thread) = &mut self.scene_thread {
+        scene_thread.set_document(Arc::clone(&self.doc));
+      }
+
+      // The elements belong to the previous document.
+      self.hovered = None;
+      self.pressed = None;
+    }
+
+    self.scheduler.request(FrameRequest {
+      mode: RenderMode::Incremental,
+      ..FrameRequest::EMPTY
+    });
+  }
+
+  /// Frees the caches of the renderer and the document, for when the window is hidden.
+  ///
+  /// See `render::Renderer::trim` and `CompiledDocument::trim`, the next frame rebuilds what it needs.
+  pub fn trim(&mut self) {
+    self.doc.trim();
+
+    self.windowing.make_current();
+    self.renderer.trim();
+    self.windowing.make_not_current();
+  }
+
+  /// Returns the view and element at `point`, in device pixels of the framebuffer, as of the
+  /// last display list. View `0` shows `doc`, see `render::Renderer::add_view` for the others.
+  #[must_use]
+  pub fn hit_test(&self, point: DevicePoint) -> Option<(usize, NodeId)> {
+    self.renderer.hit_test(point)
+  }
+
+  /// Returns the view and element under the pointer, as of the last pointer event.
+  #[must_use]
+  pub fn hovered(&self) -> Option<(usize, NodeId)> {
+    self.hovered
+  }
+
+  /// Returns the view and element a button was pressed on, until it is released.
+  #[must_use]
+  pub fn pressed(&self) -> Option<(usize, NodeId)> {
+    self.pressed
+  }
+
   pub fn handle_event(&mut self, event: Event) {
+    self.handle_events(std::iter::once(event));
+  }
+
+  /// Handles a batch of events and renders at most one frame for all of them.
+  ///
+  /// Hosts that get several events per wake up should pass them all at once, calling
+  /// `handle_event` for each renders a frame for every redraw.
+  pub fn handle_events<I: IntoIterator<Item = Event>>(&mut self, events: I) {
+    let mut wants_frame = false;
+    for event in events {
+      wants_frame |= self.queue_event(event);
+    }
+
+    if wants_frame && self.needs_frame() {
+      self.render_frame();
+    }
+  }
+
+  /// Adds what `event` changes to the next frame, returns true if it asks for that frame now.
+  fn queue_event(&mut self, event: Event) -> bool {
     match event {
+      // These are coalesced into the next frame, a live resize sends many of them per vsync.
       Event::Resized(size) => {
-        self.renderer.set_device_size(size);
-        self.render_inner = true;
+        self.scheduler.request(FrameRequest {
+          mode: RenderMode::Incremental,
+          device_size: Some(size),
+          ..FrameRequest::EMPTY
+        });
+        false
       }
 
       Event::ScaleFactorChanged(scale) => {
-        self.renderer.set_scale_factor(scale);
-        self.render_inner = true;
+        self.scheduler.request(FrameRequest {
+          mode: RenderMode::Incremental,
+          scale_factor: Some(scale),
+          ..FrameRequest::EMPTY
+        });
+        false
       }
 
       Event::Redraw => {
-        self.render_inner = true;
+        self.scheduler.request(FrameRequest {
+          mode: RenderMode::Incremental,
+          ..FrameRequest::EMPTY
+        });
+        true
+      }
+
+      Event::Empty => true,
+
+      // Hit testing uses the grid built with the last display list, so moving the pointer
+      // around never walks the tree.
+      Event::PointerMoved(point) => {
+        self.pointer = Some(point);
+        self.hovered = self.hit_test(point);
+        false
       }
 
-      Event::Empty => {}
+      Event::PointerDown => {
+        self.pressed = self.pointer.and_then(|point| self.hit_test(point));
+        false
+      }
+
+      Event::PointerUp => {
+        self.pressed = None;
+        false
+      }
+
+      Event::PointerLeft => {
+        self.pointer = None;
+        self.hovered = None;
+        false
+      }
+    }
+  }
+
+  fn render_frame(&mut self) {
+    let request = self.scheduler.take();
+    if let Some(size) = request.device_size {
+      self.renderer.set_device_size(size);
+    }
+    if let Some(scale) = request.scale_factor {
+      self.renderer.set_scale_factor(scale);
     }
 
     // if self.debug_flags != old_flags {
@@ -72,10 +243,15 @@ impl<W: Windowing> EventHandler<W> {
     // }
 
     self.windowing.make_current();
-    self.renderer.render(self.render_inner, &self.doc);
+    match &mut self.scene_thread {
+      Some(scene_thread) => {
+        scene_thread.request(request);
+        self.renderer.composite();
+      }
+
+      None => self.renderer.render(request.mode, &self.doc),
+    }
     self.windowing.swap_buffers();
     self.windowing.make_not_current();
-
-    self.render_inner = false;
   }
 }
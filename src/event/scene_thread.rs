@@ -0,0 +1,105 @@
+use std::{
+  sync::{
+    mpsc::{self, SyncSender, TrySendError},
+    Arc, Mutex,
+  },
+  thread::JoinHandle,
+};
+
+use dom::CompiledDocument;
+use render::SceneBuilder;
+
+use crate::scheduler::FrameRequest;
+
+/// How many frame requests can be waiting for the worker before new ones are coalesced.
+const QUEUE_LEN: usize = 2;
+
+/// Runs style, layout and display list building on a worker thread.
+///
+/// WebRender's notifier fires once a scene is ready, the thread that owns the GL
+/// context then only has to composite it.
+pub struct SceneThread {
+  sender: Option<SyncSender<FrameRequest>>,
+  handle: Option<JoinHandle<()>>,
+  /// A request that didn't fit in the queue, sent along with the next one.
+  pending: Option<FrameRequest>,
+  /// The document the next scene is built from.
+  doc: Arc<Mutex<Arc<CompiledDocument>>>,
+}
+
+impl SceneThread {
+  pub fn spawn(mut scene_builder: SceneBuilder, doc: Arc<CompiledDocument>) -> Self {
+    let (sender, receiver) = mpsc::sync_channel::<FrameRequest>(QUEUE_LEN);
+    let doc = Arc::new(Mutex::new(doc));
+    let current = Arc::clone(&doc);
+
+    let handle = std::thread::Builder::new()
+      .name("scene-builder".to_string())
+      .spawn(move || {
+        for mut request in receiver.iter() {
+          // Requests that queued up while the last scene was building only need one scene.
+          while let Ok(next) = receiver.try_recv() {
+            request = request.merge(next);
+          }
+
+          if let Some(size) = request.device_size {
+            scene_builder.set_device_size(size);
+          }
+          if let Some(scale) = request.scale_factor {
+            scene_builder.set_scale_factor(scale);
+          }
+
+          // Only held long enough to clone, so swapping documents never waits for a scene.
+          let doc = Arc::clone(&current.lock().unwrap());
+          scene_builder.build(request.mode, &doc);
+        }
+      })
+      .unwrap();
+
+    Self {
+      sender: Some(sender),
+      handle: Some(handle),
+      pending: None,
+      doc,
+    }
+  }
+
+  /// Builds the next scene from `doc`, a scene that is being built keeps the document it started with.
+  pub fn set_document(&mut self, doc: Arc<CompiledDocument>) {
+    *self.doc.lock().unwrap() = doc;
+  }
+
+  fn send(&mut self, request: FrameRequest) {
+    let request = match self.pending.take() {
+      Some(pending) => pending.merge(request),
+      None => request,
+    };
+
+    match self.sender.as_ref().unwrap().try_send(request) {
+      Ok(()) => {}
+      Err(TrySendError::Full(request)) => self.pending = Some(request),
+      Err(TrySendError::Disconnected(..)) => panic!("the scene thread exited"),
+    }
+  }
+
+  pub fn request(&mut self, request: FrameRequest) {
+    if request.is_dirty() || self.pending.is_some() {
+      self.send(request);
+    }
+  }
+
+  /// Returns true if a request is waiting for room in the queue.
+  pub fn has_pending(&self) -> bool {
+    self.pending.is_some()
+  }
+}
+
+impl Drop for SceneThread {
+  fn drop(&mut self) {
+    // Closing the channel ends the worker's loop.
+    self.sender = None;
+    if let Some(handle) = self.handle.take() {
+      let _ = handle.join();
+    }
+  }
+}
@@ -0,0 +1,72 @@
+use render::{DeviceSize, RenderMode};
+
+/// Everything that has to happen in the next frame.
+#[derive(Debug, Copy, Clone)]
+pub(crate) struct FrameRequest {
+  pub mode: RenderMode,
+  pub device_size: Option<DeviceSize>,
+  pub scale_factor: Option<f32>,
+}
+
+impl FrameRequest {
+  pub const EMPTY: Self = Self {
+    mode: RenderMode::Composite,
+    device_size: None,
+    scale_factor: None,
+  };
+
+  /// Returns true if the document has to be looked at to produce this frame.
+  pub fn is_dirty(&self) -> bool {
+    self.mode != RenderMode::Composite || self.device_size.is_some() || self.scale_factor.is_some()
+  }
+
+  /// Combines two requests into one that does the work of both, `newer` wins on conflicts.
+  pub fn merge(self, newer: Self) -> Self {
+    let mode = match (self.mode, newer.mode) {
+      (RenderMode::Full, _) | (_, RenderMode::Full) => RenderMode::Full,
+      (RenderMode::Incremental, _) | (_, RenderMode::Incremental) => RenderMode::Incremental,
+      _ => RenderMode::Composite,
+    };
+
+    Self {
+      mode,
+      device_size: newer.device_size.or(self.device_size),
+      scale_factor: newer.scale_factor.or(self.scale_factor),
+    }
+  }
+}
+
+/// Collects what changed between frames, so a burst of events (like a live resize) turns into a single frame.
+///
+/// Size and scale changes are only recorded, the frame is produced on the next redraw or
+/// wake up. `swap_buffers` blocks until vsync, so everything that arrives while a frame is
+/// being presented ends up in the one after it.
+#[derive(Debug)]
+pub(crate) struct FrameScheduler {
+  pending: FrameRequest,
+}
+
+impl FrameScheduler {
+  pub fn new() -> Self {
+    Self {
+      // Nothing has been built yet.
+      pending: FrameRequest {
+        mode: RenderMode::Full,
+        ..FrameRequest::EMPTY
+      },
+    }
+  }
+
+  pub fn request(&mut self, request: FrameRequest) {
+    self.pending = self.pending.merge(request);
+  }
+
+  pub fn is_dirty(&self) -> bool {
+    self.pending.is_dirty()
+  }
+
+  /// Returns everything that was requested since the last call.
+  pub fn take(&mut self) -> FrameRequest {
+    std::mem::replace(&mut self.pending, FrameRequest::EMPTY)
+  }
+}
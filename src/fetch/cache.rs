@@ -0,0 +1,212 @@
+use std::{
+  fs,
+  hash::Hasher,
+  io::{self, BufReader, BufWriter, Write},
+  path::PathBuf,
+  time::{Duration, SystemTime, UNIX_EPOCH},
+};
+
+use reqwest::header::{HeaderMap, CACHE_CONTROL, ETAG, LAST_MODIFIED};
+use serde::{Deserialize, Serialize};
+use url::Url;
+
+/// A response that was stored by `DiskCache`.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub(crate) struct Entry {
+  pub etag: Option<String>,
+  pub last_modified: Option<String>,
+  /// Seconds since the epoch until which the body can be used without asking the server again.
+  fresh_until: Option<u64>,
+  pub body: Vec<u8>,
+}
+
+/// What the `Cache-Control` header of a response allows.
+#[derive(Debug, PartialEq, Eq)]
+enum Policy {
+  /// The response must not be stored.
+  NoStore,
+  /// The response can be used for this long without revalidating it.
+  MaxAge(Duration),
+  /// The response has to be revalidated every time it is used.
+  Revalidate,
+}
+
+fn policy(headers: &HeaderMap) -> Policy {
+  let cache_control = match headers.get(CACHE_CONTROL).and_then(|value| value.to_str().ok()) {
+    Some(cache_control) => cache_control,
+    None => return Policy::Revalidate,
+  };
+
+  let (mut no_cache, mut max_age) = (false, None);
+  for directive in cache_control.split(',').map(str::trim) {
+    if directive.eq_ignore_ascii_case("no-store") {
+      return Policy::NoStore;
+    } else if directive.eq_ignore_ascii_case("no-cache") {
+      no_cache = true;
+    } else if let Some(seconds) = directive.strip_prefix("max-age=").and_then(|s| s.parse().ok()) {
+      max_age = Some(Duration::from_secs(seconds));
+    }
+  }
+
+  // `no-cache` wins over `max-age` wherever it is in the header.
+  match max_age {
+    Some(max_age) if !no_cache => Policy::MaxAge(max_age),
+    _ => Policy::Revalidate,
+  }
+}
+
+fn now() -> u64 {
+  SystemTime::now()
+    .duration_since(UNIX_EPOCH)
+    .map_or(0, |now| now.as_secs())
+}
+
+impl Entry {
+  /// Creates an entry for a response, or returns `None` if it must not be stored.
+  pub fn new(headers: &HeaderMap, body: Vec<u8>) -> Option<Self> {
+    let header = |name| {
+      headers
+        .get(name)
+        .and_then(|value| value.to_str().ok())
+        .map(ToString::to_string)
+    };
+
+    let mut entry = Self {
+      etag: header(ETAG),
+      last_modified: header(LAST_MODIFIED),
+      fresh_until: None,
+      body,
+    };
+    if entry.refresh(headers) {
+      Some(entry)
+    } else {
+      None
+    }
+  }
+
+  /// Updates how long the entry is fresh from the headers of a `304 Not Modified`, returns
+  /// false if it must not be stored anymore.
+  pub fn refresh(&mut self, headers: &HeaderMap) -> bool {
+    self.fresh_until = match policy(headers) {
+      Policy::NoStore => return false,
+      Policy::MaxAge(max_age) => Some(now() + max_age.as_secs()),
+      Policy::Revalidate => None,
+    };
+    true
+  }
+
+  /// Returns true if the body can be used without asking the server.
+  #[must_use]
+  pub fn is_fresh(&self) -> bool {
+    self.fresh_until.map_or(false, |fresh_until| now() < fresh_until)
+  }
+}
+
+/// Keeps HTTP responses in a directory, one file per URL.
+///
+/// Errors are ignored, a broken cache only means resources are downloaded again.
+#[derive(Debug, Clone)]
+pub(crate) struct DiskCache {
+  dir: PathBuf,
+}
+
+impl DiskCache {
+  pub fn open(dir: PathBuf) -> io::Result<Self> {
+    fs::create_dir_all(&dir)?;
+    Ok(Self { dir })
+  }
+
+  fn path(&self, url: &Url) -> PathBuf {
+    let mut hasher = seahash::SeaHasher::new();
+    hasher.write(url.as_str().as_bytes());
+    self.dir.join(format!("{:016x}.bin", hasher.finish()))
+  }
+
+  pub fn get(&self, url: &Url) -> Option<Entry> {
+    let reader = BufReader::new(fs::File::open(self.path(url)).ok()?);
+    bincode::deserialize_from(reader).ok()
+  }
+
+  pub fn put(&self, url: &Url, entry: &Entry) {
+    let path = self.path(url);
+    // Write to a temporary file first, so other processes never see a truncated entry.
+    let tmp = path.with_extension(format!("{}.tmp", std::process::id()));
+
+    let written = fs::File::create(&tmp).map_err(bincode::Error::from).and_then(|file| {
+      let mut writer = BufWriter::new(file);
+      bincode::serialize_into(&mut writer, entry)?;
+      // Dropping a `BufWriter` flushes it but ignores errors, a short write must not be renamed into place.
+      writer.flush().map_err(bincode::Error::from)
+    });
+    if written.is_err() || fs::rename(&tmp, path).is_err() {
+      let _ = fs::remove_file(tmp);
+    }
+  }
+
+  pub fn remove(&self, url: &Url) {
+    let _ = fs::remove_file(self.path(url));
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use reqwest::header::HeaderValue;
+
+  use super::*;
+
+  fn policy_of(cache_control: Option<&'static str>) -> Policy {
+    let mut headers = HeaderMap::new();
+    if let Some(cache_control) = cache_control {
+      headers.insert(CACHE_CONTROL, HeaderValue::from_static(cache_control));
+    }
+    policy(&headers)
+  }
+
+  #[test]
+  fn responses_without_cache_control_are_revalidated() {
+    assert_eq!(policy_of(None), Policy::Revalidate);
+    assert_eq!(policy_of(Some("public")), Policy::Revalidate);
+  }
+
+  #[test]
+  fn max_age_is_parsed() {
+    assert_eq!(policy_of(Some("max-age=60")), Policy::MaxAge(Duration::from_secs(60)));
+    assert_eq!(
+      policy_of(Some("public, max-age=3600")),
+      Policy::MaxAge(Duration::from_secs(3600))
+    );
+    assert_eq!(policy_of(Some("max-age=soon")), Policy::Revalidate);
+  }
+
+  #[test]
+  fn no_store_wins() {
+    assert_eq!(policy_of(Some("no-store")), Policy::NoStore);
+    assert_eq!(policy_of(Some("max-age=60, No-Store")), Policy::NoStore);
+    assert_eq!(policy_of(Some("no-cache, no-store")), Policy::NoStore);
+  }
+
+  #[test]
+  fn no_cache_wins_over_max_age() {
+    assert_eq!(policy_of(Some("no-cache")), Policy::Revalidate);
+    assert_eq!(policy_of(Some("max-age=60, no-cache")), Policy::Revalidate);
+    assert_eq!(policy_of(Some("no-cache, max-age=60")), Policy::Revalidate);
+  }
+
+  #[test]
+  fn entries_are_fresh_for_their_max_age() {
+    let mut headers = HeaderMap::new();
+    headers.insert(CACHE_CONTROL, HeaderValue::from_static("max-age=3600"));
+    headers.insert(ETAG, HeaderValue::from_static("\"v1\""));
+    let mut entry = Entry::new(&headers, b"body".to_vec()).unwrap();
+    assert!(entry.is_fresh());
+    assert_eq!(entry.etag.as_deref(), Some("\"v1\""));
+
+    headers.insert(CACHE_CONTROL, HeaderValue::from_static("no-cache"));
+    assert!(entry.refresh(&headers));
+    assert!(!entry.is_fresh());
+
+    headers.insert(CACHE_CONTROL, HeaderValue::from_static("no-store"));
+    assert!(!entry.refresh(&headers));
+    assert!(Entry::new(&headers, Vec::new()).is_none());
+  }
+}
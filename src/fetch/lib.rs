@@ -0,0 +1,170 @@
+//! Asynchronous resource fetching with connection reuse and HTTP caching.
+//!
+//! Every request runs on the `Fetcher`'s own runtime, so callers never stall on the network:
+//! they either await the returned future, hand the fetcher a callback, or fetch many
+//! resources concurrently and wait once for all of them.
+
+use std::{error, fmt, future::Future, io, path::Path, sync::Arc};
+
+use futures_util::future::{join_all, FutureExt};
+use reqwest::{
+  header::{IF_MODIFIED_SINCE, IF_NONE_MATCH},
+  Client, StatusCode,
+};
+use tokio::runtime::{Builder, Runtime};
+use url::Url;
+
+mod cache;
+
+use cache::{DiskCache, Entry};
+
+/// Why a fetch failed.
+#[derive(Debug)]
+pub enum Error {
+  IO(io::Error),
+  Reqwest(reqwest::Error),
+}
+
+impl fmt::Display for Error {
+  fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+    match self {
+      Self::IO(e) => e.fmt(f),
+      Self::Reqwest(e) => e.fmt(f),
+    }
+  }
+}
+
+impl error::Error for Error {
+  fn source(&self) -> Option<&(dyn error::Error + 'static)> {
+    match self {
+      Self::IO(e) => Some(e),
+      Self::Reqwest(e) => Some(e),
+    }
+  }
+}
+
+impl From<io::Error> for Error {
+  fn from(e: io::Error) -> Error {
+    Error::IO(e)
+  }
+}
+
+impl From<reqwest::Error> for Error {
+  fn from(e: reqwest::Error) -> Error {
+    Error::Reqwest(e)
+  }
+}
+
+/// Fetches `file` and `http(s)` URLs on a small thread pool.
+///
+/// All requests share one `reqwest::Client`, so connections (and TLS sessions and proxy
+/// tunnels) are kept alive and reused instead of being set up for every resource. Responses
+/// can be kept in a directory: fresh ones (per `Cache-Control: max-age`) are used without
+/// asking the server, stale ones are revalidated with `If-None-Match` / `If-Modified-Since`.
+///
+/// Clones share the runtime, client and cache.
+#[derive(Debug, Clone)]
+pub struct Fetcher {
+  runtime: Arc<Runtime>,
+  client: Client,
+  cache: Option<DiskCache>,
+}
+
+impl Fetcher {
+  /// Creates a fetcher, which keeps responses in `cache_dir` if one is given.
+  pub fn new(cache_dir: Option<&Path>) -> io::Result<Self> {
+    let runtime = Builder::new()
+      .threaded_scheduler()
+      .enable_all()
+      .thread_name("fetch")
+      .build()?;
+    let client = Client::builder()
+      .build()
+      .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?;
+    let cache = cache_dir.map(|dir| DiskCache::open(dir.to_path_buf())).transpose()?;
+
+    Ok(Self {
+      runtime: Arc::new(runtime),
+      client,
+      cache,
+    })
+  }
+
+  /// Starts fetching `url`, the returned future resolves to its whole content.
+  ///
+  /// The request makes progress whether or not the future is polled.
+  pub fn fetch(&self, url: &Url) -> impl Future<Output = Result<Vec<u8>, Error>> + Send + 'static {
+    let task = fetch(self.client.clone(), self.cache.clone(), url.clone());
+    self.runtime.spawn(task).map(|result| match result {
+      Ok(result) => result,
+      Err(e) => Err(io::Error::new(io::ErrorKind::Other, e).into()),
+    })
+  }
+
+  /// Fetches `url` and calls `callback` with its content on one of the fetcher's threads.
+  pub fn fetch_with<F>(&self, url: &Url, callback: F)
+  where
+    F: FnOnce(Result<Vec<u8>, Error>) + Send + 'static,
+  {
+    self.runtime.spawn(self.fetch(url).map(callback));
+  }
+
+  /// Fetches `url`, blocking the current thread until it's done.
+  pub fn fetch_blocking(&self, url: &Url) -> Result<Vec<u8>, Error> {
+    futures_executor::block_on(self.fetch(url))
+  }
+
+  /// Fetches every URL concurrently, blocking the current thread until all of them are done.
+  pub fn fetch_all(&self, urls: &[Url]) -> Vec<Result<Vec<u8>, Error>> {
+    futures_executor::block_on(join_all(urls.iter().map(|url| self.fetch(url))))
+  }
+}
+
+async fn fetch(client: Client, cache: Option<DiskCache>, url: Url) -> Result<Vec<u8>, Error> {
+  if url.scheme() == "file" {
+    let path = url
+      .to_file_path()
+      .map_err(|()| io::Error::new(io::ErrorKind::InvalidInput, "not a local path"))?;
+    return Ok(tokio::fs::read(path).await?);
+  }
+
+  let cached = cache.as_ref().and_then(|cache| cache.get(&url));
+  let mut request = client.get(url.clone());
+  if let Some(entry) = &cached {
+    if entry.is_fresh() {
+      log::trace!("{} is fresh in the cache", url);
+      return Ok(entry.body.clone());
+    }
+
+    if let Some(etag) = &entry.etag {
+      request = request.header(IF_NONE_MATCH, etag.as_str());
+    }
+    if let Some(last_modified) = &entry.last_modified {
+      request = request.header(IF_MODIFIED_SINCE, last_modified.as_str());
+    }
+  }
+
+  let response = request.send().await?;
+  if response.status() == StatusCode::NOT_MODIFIED {
+    if let (Some(cache), Some(mut entry)) = (&cache, cached) {
+      log::trace!("{} was revalidated", url);
+      if entry.refresh(response.headers()) {
+        cache.put(&url, &entry);
+      } else {
+        cache.remove(&url);
+      }
+      return Ok(entry.body);
+    }
+  }
+
+  let response = response.error_for_status()?;
+  let headers = response.headers().clone();
+  let body = response.bytes().await?.to_vec();
+  if let Some(cache) = &cache {
+    match Entry::new(&headers, body.clone()) {
+      Some(entry) => cache.put(&url, &entry),
+      None => cache.remove(&url),
+    }
+  }
+  Ok(body)
+}
@@ -1,22 +1,55 @@
-use std::sync::Arc;
+use std::{path::Path, sync::Arc};
 
 use winit_adapter as window;
 
 use window::glutin;
 
-use project_a::dom;
+use project_a::compiler::{self, Diagnostic, Level};
 
-fn main() {
-  pretty_env_logger::init();
+/// Prints diagnostics to stderr, compiling fails if any of them is an error.
+#[derive(Default)]
+struct Reporter {
+  failed: bool,
+}
+
+impl compiler::DiagnosticReporter for Reporter {
+  type FileId = ();
+
+  fn add_file(&mut self, _: String, _: String) {}
 
-  // let f = std::fs::File::open("file.cframe").unwrap();
-  // let doc = dom::CompiledDocument::load_from(f);
+  fn add_diagnostic(&mut self, diagnostic: Diagnostic<()>) {
+    if let Level::Bug | Level::Error = diagnostic.min_level {
+      self.failed = true;
+    }
+    eprintln!("{}", diagnostic);
+  }
+
+  fn get_position(&mut self, _: &(), _: usize, _: usize) -> usize {
+    0
+  }
+
+  fn get_line(&mut self, _: &(), _: usize) -> usize {
+    0
+  }
+
+  fn checkpoint(&mut self) -> Result<(), ()> {
+    if self.failed {
+      Err(())
+    } else {
+      Ok(())
+    }
+  }
+}
 
-  // let doc = Arc::new(doc);
+fn main() {
+  pretty_env_logger::init();
 
-  let doc = dom::include_document!("../file.cframe");
+  // Compiled at startup rather than embedded as a `.cframe`, so the document always
+  // matches the format version this binary reads.
+  let path = Path::new(env!("CARGO_MANIFEST_DIR")).join("file.frame");
+  let doc = Arc::new(compiler::compile(&path, &mut Reporter::default()).expect("file.frame doesn't compile"));
 
-  doc.scope.write().unwrap().push("id", "id".to_string());
+  doc.set_variable("id", "id".to_string());
 
   // let mut devtools = chrome_devtools::DevTools::new("127.0.0.1:4000");
   // devtools.add_view(Arc::clone(&doc));
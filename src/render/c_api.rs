@@ -1,8 +1,9 @@
 #![allow(non_snake_case)]
 
 use std::{
-  ffi::CString,
+  ffi::{CStr, CString},
   os::raw::{c_char, c_void},
+  path::PathBuf,
 };
 
 use gleam::gl;
@@ -22,6 +23,60 @@ impl Into<super::DeviceSize> for DeviceSize {
   }
 }
 
+/// Options for `Renderer_new` and `Renderer_new_offscreen`, passing null uses the defaults (all zero).
+#[repr(C)]
+#[doc = "module=render"]
+pub struct RendererOptions {
+  /// A directory where compiled shader programs are kept between launches, or null to compile them every launch.
+  pub program_cache_dir: *const c_char,
+  /// Compile every shader while starting up instead of the first time each one is used.
+  pub precache_shaders: bool,
+  /// Called with `wake_up_user` from WebRender's threads when a new frame is ready, the host
+  /// should then call `EventHandler_handle_empty` (or `EventHandler_needs_frame`) on its own
+  /// thread, like after an event. Threaded `EventHandler`s need it to show the scenes their
+  /// worker thread builds, without it they only show up with the next event.
+  ///
+  /// It must be safe to call from any thread, `glfwPostEmptyEvent` is an example.
+  pub wake_up: Option<extern "C" fn(user: *mut c_void)>,
+  pub wake_up_user: *mut c_void,
+}
+
+impl RendererOptions {
+  unsafe fn to_options(options: *const Self) -> super::RendererOptions {
+    let options = match options.as_ref() {
+      Some(options) => options,
+      None => return super::RendererOptions::default(),
+    };
+
+    let program_cache_dir = if options.program_cache_dir.is_null() {
+      None
+    } else {
+      CStr::from_ptr(options.program_cache_dir)
+        .to_str()
+        .ok()
+        .map(PathBuf::from)
+    };
+
+    super::RendererOptions {
+      program_cache_dir,
+      precache_shaders: options.precache_shaders,
+    }
+  }
+
+  unsafe fn to_notifier(options: *const Self) -> Box<dyn RenderNotifier> {
+    match options.as_ref() {
+      Some(options) => Box::new(Notifier {
+        wake_up: options.wake_up,
+        user: options.wake_up_user,
+      }),
+      None => Box::new(Notifier {
+        wake_up: None,
+        user: std::ptr::null_mut(),
+      }),
+    }
+  }
+}
+
 #[doc = "module=render"]
 pub struct Gl;
 
@@ -50,25 +105,40 @@ impl Gl {
 
     Box::into_raw(Box::new(gl)) as *mut _
   }
+
+  /// Frees functions that were loaded but never passed to `Renderer_new` or `Renderer_new_offscreen`.
+  #[no_mangle]
+  #[doc = "module=render,index=2"]
+  pub unsafe extern "C" fn Gl_drop(&mut self) {
+    drop(Box::from_raw(self as *mut Self as *mut std::rc::Rc<dyn gl::Gl>));
+  }
 }
 
-pub struct Notifier;
+/// Calls `RendererOptions::wake_up`, if the host passed one.
+pub struct Notifier {
+  wake_up: Option<extern "C" fn(user: *mut c_void)>,
+  user: *mut c_void,
+}
+
+// The host promises `wake_up` can be called with `user` from any thread.
+unsafe impl Send for Notifier {}
 
 impl RenderNotifier for Notifier {
   fn clone(&self) -> Box<dyn RenderNotifier> {
-    Box::new(Notifier)
+    Box::new(Notifier {
+      wake_up: self.wake_up,
+      user: self.user,
+    })
   }
 
   fn wake_up(&self) {
-    // #[cfg(not(target_os = "android"))]
-    // let _ = self.events_proxy.wakeup();
-    // let _ = self.events_proxy.send_event(());
-    // panic!("foo");
+    if let Some(wake_up) = self.wake_up {
+      wake_up(self.user);
+    }
   }
 
   fn new_frame_ready(&self, _: DocumentId, _scrolled: bool, _composite_needed: bool, _render_time: Option<u64>) {
-    // self.wake_up();
-    // panic!("bar");
+    self.wake_up();
   }
 }
 
@@ -77,12 +147,40 @@ impl RenderNotifier for Notifier {
 
 #[allow(non_snake_case)]
 impl Renderer {
+  /// Threaded `EventHandler`s need `RendererOptions::wake_up`, see there.
   #[no_mangle]
   #[doc = "module=render,index=0"]
-  pub unsafe extern "C" fn Renderer_new(gl: *mut Gl, device_pixel_ratio: f32, device_size: DeviceSize) -> *mut Self {
+  pub unsafe extern "C" fn Renderer_new(
+    gl: *mut Gl,
+    device_pixel_ratio: f32,
+    device_size: DeviceSize,
+    options: *const RendererOptions,
+  ) -> *mut Self {
     let gl = *Box::from_raw(gl as *mut _);
+    let notifier = RendererOptions::to_notifier(options);
+    let options = RendererOptions::to_options(options);
 
-    let renderer = Renderer::new(gl, device_pixel_ratio, device_size.into(), Box::new(Notifier));
+    let renderer = Renderer::new(gl, device_pixel_ratio, device_size.into(), notifier, &options);
+
+    Box::into_raw(Box::new(renderer))
+  }
+
+  /// Creates a renderer that draws into a framebuffer instead of a window, for `Renderer_snapshot`.
+  ///
+  /// The GL context still has to be current, but it can be a pbuffer or surfaceless one.
+  #[no_mangle]
+  #[doc = "module=render,index=7"]
+  pub unsafe extern "C" fn Renderer_new_offscreen(
+    gl: *mut Gl,
+    device_pixel_ratio: f32,
+    device_size: DeviceSize,
+    options: *const RendererOptions,
+  ) -> *mut Self {
+    let gl = *Box::from_raw(gl as *mut _);
+    let notifier = RendererOptions::to_notifier(options);
+    let options = RendererOptions::to_options(options);
+
+    let renderer = Renderer::new_offscreen(gl, device_pixel_ratio, device_size.into(), notifier, &options);
 
     Box::into_raw(Box::new(renderer))
   }
@@ -106,11 +204,167 @@ impl Renderer {
     self.set_scale_factor(scale);
   }
 
+  /// Does nothing if the renderer belongs to a threaded `EventHandler`, which renders on its own.
   #[no_mangle]
   #[doc = "module=render,index=4"]
-  pub unsafe extern "C" fn Renderer_render(&mut self, inner: bool, doc: *const dom::CompiledDocument) {
+  pub unsafe extern "C" fn Renderer_render(&mut self, mode: RenderMode, doc: *const dom::CompiledDocument) {
+    if self.get_view_mut(0).is_none() {
+      return;
+    }
+
+    let doc = Arc::from_raw(doc);
+    self.render(mode, &doc);
+    Arc::into_raw(doc);
+  }
+
+  /// Returns the counters for the most recent frame.
+  #[no_mangle]
+  #[doc = "module=render,index=5"]
+  pub unsafe extern "C" fn Renderer_get_frame_stats(&self) -> FrameStats {
+    self.frame_stats()
+  }
+
+  /// Enables GPU timer queries, `FrameStats::webrender_gpu_us` is `0` while profiling is disabled.
+  #[no_mangle]
+  #[doc = "module=render,index=6"]
+  pub unsafe extern "C" fn Renderer_set_profiling(&mut self, enabled: bool) {
+    self.set_profiling(enabled);
+  }
+
+  /// Renders `doc` into the offscreen framebuffer and starts reading it back in the background.
+  ///
+  /// Several snapshots can be in flight at once, each one has to be freed with `Readback_drop`.
+  /// The renderer must have been created with `Renderer_new_offscreen`.
+  #[no_mangle]
+  #[doc = "module=render,index=8"]
+  pub unsafe extern "C" fn Renderer_snapshot(&mut self, doc: *const dom::CompiledDocument) -> *mut Readback {
+    let doc = Arc::from_raw(doc);
+    let readback = self.snapshot(&doc);
+    Arc::into_raw(doc);
+
+    Box::into_raw(Box::new(readback))
+  }
+
+  /// Adds a view that shows another document in the given part of the framebuffer,
+  /// drawn on top of the main view and earlier views. Returns the id for `Renderer_render_view`,
+  /// the main view is `0`.
+  #[no_mangle]
+  #[doc = "module=render,index=9"]
+  pub unsafe extern "C" fn Renderer_add_view(&mut self, x: i32, y: i32, size: DeviceSize) -> u32 {
+    self.add_view(DeviceIntRect::new(DeviceIntPoint::new(x, y), size.into())) as u32
+  }
+
+  /// Moves and resizes a view added with `Renderer_add_view`.
+  ///
+  /// Returns false without changing anything if there is no such view, or if it is the main
+  /// view and the renderer belongs to a threaded `EventHandler`.
+  #[no_mangle]
+  #[doc = "module=render,index=10"]
+  pub unsafe extern "C" fn Renderer_set_view_rect(&mut self, view: u32, x: i32, y: i32, size: DeviceSize) -> bool {
+    match self.get_view_mut(view as usize) {
+      Some(scene_builder) => {
+        scene_builder.set_device_rect(DeviceIntRect::new(DeviceIntPoint::new(x, y), size.into()));
+        true
+      }
+      None => false,
+    }
+  }
+
+  /// Like `Renderer_render`, but builds the scene of `view`.
+  ///
+  /// Returns false without rendering if there is no such view, or if it is the main view and
+  /// the renderer belongs to a threaded `EventHandler`.
+  #[no_mangle]
+  #[doc = "module=render,index=11"]
+  pub unsafe extern "C" fn Renderer_render_view(
+    &mut self,
+    view: u32,
+    mode: RenderMode,
+    doc: *const dom::CompiledDocument,
+  ) -> bool {
+    if self.get_view_mut(view as usize).is_none() {
+      return false;
+    }
+
     let doc = Arc::from_raw(doc);
-    self.render(inner, &doc);
+    self.render_view(view as usize, mode, &doc);
     Arc::into_raw(doc);
+    true
+  }
+
+  /// Scrolls an `overflow: scroll` element of a view to `x`, `y` and composites, `0` is the main view.
+  ///
+  /// Scrolling only moves things on the compositor as long as it stays within the content that
+  /// was built around the last position. Returns true once it doesn't, the view then needs
+  /// a `Renderer_render_view` to fill in the rest.
+  ///
+  /// Returns false without scrolling if there is no such view, or if it is the main view and
+  /// the renderer belongs to a threaded `EventHandler`.
+  #[no_mangle]
+  #[doc = "module=render,index=12"]
+  pub unsafe extern "C" fn Renderer_scroll_view(&mut self, view: u32, node: u32, x: f32, y: f32) -> bool {
+    if self.get_view_mut(view as usize).is_none() {
+      return false;
+    }
+
+    self.scroll_view(
+      view as usize,
+      NodeId::from_index(node as usize),
+      LayoutVector2D::new(x, y),
+    )
+  }
+
+  /// Measures what WebRender holds on to, across every view. Don't call it every frame.
+  #[no_mangle]
+  #[doc = "module=render,index=13"]
+  pub unsafe extern "C" fn Renderer_memory_report(&self) -> RenderMemoryReport {
+    self.memory_report()
+  }
+
+  /// Frees WebRender's caches and textures, for windows that are hidden. The GL context has to be current.
+  #[no_mangle]
+  #[doc = "module=render,index=14"]
+  pub unsafe extern "C" fn Renderer_trim(&mut self) {
+    self.trim();
+  }
+}
+
+#[allow(non_snake_case)]
+impl Readback {
+  #[no_mangle]
+  #[doc = "module=render,index=0"]
+  pub unsafe extern "C" fn Readback_drop(&mut self) {
+    drop(Box::from_raw(self as *mut Self));
+  }
+
+  #[no_mangle]
+  #[doc = "module=render,index=1"]
+  pub unsafe extern "C" fn Readback_get_size(&self) -> DeviceSize {
+    let size = self.size();
+    DeviceSize {
+      width: size.width,
+      height: size.height,
+    }
+  }
+
+  /// Returns true if the pixels have arrived, so `Readback_read` won't block.
+  #[no_mangle]
+  #[doc = "module=render,index=2"]
+  pub unsafe extern "C" fn Readback_is_ready(&self) -> bool {
+    self.is_ready()
+  }
+
+  /// Copies the snapshot into `buffer` as 8 bit RGBA, top row first, waiting for the GPU if needed.
+  ///
+  /// Returns false without copying anything if `len` is less than `width * height * 4`.
+  #[no_mangle]
+  #[doc = "module=render,index=3"]
+  pub unsafe extern "C" fn Readback_read(&self, buffer: *mut u8, len: usize) -> bool {
+    if len < self.len() {
+      return false;
+    }
+
+    self.read_into(std::slice::from_raw_parts_mut(buffer, len));
+    true
   }
 }
@@ -0,0 +1,327 @@
+use std::{
+  collections::HashMap,
+  sync::{Arc, RwLock},
+};
+
+use dom::tree::NodeId;
+use webrender::api::units::{DeviceIntRect, LayoutPoint, LayoutRect, LayoutSize, LayoutVector2D};
+
+use super::DevicePoint;
+
+/// The width and height of a grid cell, in layout pixels.
+const CELL_SIZE: f32 = 64.0;
+
+/// Like `Rect::contains`, half open so neighbouring boxes never both contain a point.
+fn contains(rect: &LayoutRect, point: LayoutPoint) -> bool {
+  point.x >= rect.min_x() && point.x < rect.max_x() && point.y >= rect.min_y() && point.y < rect.max_y()
+}
+
+/// A scroll frame, the boxes inside it move with its scroll offset.
+#[derive(Debug, Copy, Clone)]
+struct Frame {
+  node: NodeId,
+  parent: Option<u32>,
+  /// The part of the parent's space the content can be seen in.
+  clip: LayoutRect,
+  /// The part of the viewport the content can be seen in, whatever the scroll offsets are.
+  viewport_clip: LayoutRect,
+  /// How far the content can be moved by this frame and the ones it is in.
+  max_offset: LayoutVector2D,
+}
+
+#[derive(Debug, Copy, Clone)]
+struct Entry {
+  node: NodeId,
+  /// The part of the element's box that isn't clipped away, in the space of `frame`.
+  rect: LayoutRect,
+  frame: Option<u32>,
+}
+
+/// A uniform grid over the boxes of a display list, so finding the element under a point only
+/// looks at the boxes that touch its cell.
+///
+/// Positions are in unscrolled layout coordinates, like the display list. A box in a scroll frame
+/// is put in every cell it can reach at any scroll offset, so scrolling doesn't rebuild the grid.
+#[derive(Debug, Default)]
+pub(crate) struct HitTestGrid {
+  entries: Vec<Entry>,
+  frames: Vec<Frame>,
+  columns: usize,
+  rows: usize,
+  /// The indices into `entries` of the boxes that touch each cell, in paint order.
+  cells: Vec<Vec<u32>>,
+}
+
+impl HitTestGrid {
+  pub fn new(viewport: LayoutSize) -> Self {
+    let columns = (viewport.width / CELL_SIZE).ceil().max(0.0) as usize;
+    let rows = (viewport.height / CELL_SIZE).ceil().max(0.0) as usize;
+
+    Self {
+      entries: Vec::new(),
+      frames: Vec::new(),
+      columns,
+      rows,
+      cells: vec![Vec::new(); columns * rows],
+    }
+  }
+
+  /// Adds a scroll frame inside `parent` that shows its content in `clip`, returns its index.
+  pub fn push_frame(&mut self, node: NodeId, parent: Option<u32>, clip: LayoutRect, max_offset: LayoutVector2D) -> u32 {
+    let (viewport_clip, max_offset) = match parent {
+      Some(parent) => {
+        let parent = &self.frames[parent as usize];
+        (
+          self
+            .reach(clip, Some(parent))
+            .intersection(&parent.viewport_clip)
+            .unwrap_or_else(LayoutRect::zero),
+          parent.max_offset + max_offset,
+        )
+      }
+      None => (clip, max_offset),
+    };
+
+    self.frames.push(Frame {
+      node,
+      parent,
+      clip,
+      viewport_clip,
+      max_offset,
+    });
+    (self.frames.len() - 1) as u32
+  }
+
+  /// Where `rect` in the space of `frame` can end up in the viewport.
+  fn reach(&self, rect: LayoutRect, frame: Option<&Frame>) -> LayoutRect {
+    match frame {
+      Some(frame) => {
+        let max = frame.max_offset.to_size();
+        LayoutRect::new(rect.origin - frame.max_offset, rect.size + max)
+      }
+      None => rect,
+    }
+  }
+
+  /// Adds the visible part of an element's box, boxes pushed later are on top.
+  pub fn push(&mut self, node: NodeId, rect: LayoutRect, frame: Option<u32>) {
+    if rect.size.width <= 0.0 || rect.size.height <= 0.0 {
+      return;
+    }
+
+    let frame_info = frame.map(|frame| &self.frames[frame as usize]);
+    let reach = match frame_info {
+      Some(info) => match self.reach(rect, Some(info)).intersection(&info.viewport_clip) {
+        Some(reach) => reach,
+        None => return,
+      },
+      None => rect,
+    };
+
+    let index = self.entries.len() as u32;
+    self.entries.push(Entry { node, rect, frame });
+
+    let cell = |value: f32, len: usize| ((value / CELL_SIZE).floor().max(0.0) as usize).min(len.saturating_sub(1));
+    if reach.max_x() < 0.0 || reach.max_y() < 0.0 || self.columns == 0 || self.rows == 0 {
+      return;
+    }
+    let (x0, x1) = (cell(reach.min_x(), self.columns), cell(reach.max_x(), self.columns));
+    let (y0, y1) = (cell(reach.min_y(), self.rows), cell(reach.max_y(), self.rows));
+    for y in y0..=y1 {
+      for x in x0..=x1 {
+        self.cells[y * self.columns + x].push(index);
+      }
+    }
+  }
+
+  /// Moves `point` into the space of `frame`, or returns `None` if the frame's clip hides it there.
+  fn to_frame_space(
+    &self,
+    frame: Option<u32>,
+    point: LayoutPoint,
+    scroll_offsets: &HashMap<NodeId, LayoutVector2D>,
+  ) -> Option<LayoutPoint> {
+    let frame = match frame {
+      Some(frame) => &self.frames[frame as usize],
+      None => return Some(point),
+    };
+
+    let point = self.to_frame_space(frame.parent, point, scroll_offsets)?;
+    if !contains(&frame.clip, point) {
+      return None;
+    }
+    Some(
+      point
+        + scroll_offsets
+          .get(&frame.node)
+          .copied()
+          .unwrap_or_else(LayoutVector2D::zero),
+    )
+  }
+
+  /// Returns the topmost element whose visible box contains `point`.
+  pub fn hit_test(&self, point: LayoutPoint, scroll_offsets: &HashMap<NodeId, LayoutVector2D>) -> Option<NodeId> {
+    if point.x < 0.0 || point.y < 0.0 {
+      return None;
+    }
+    let (x, y) = ((point.x / CELL_SIZE) as usize, (point.y / CELL_SIZE) as usize);
+    if x >= self.columns || y >= self.rows {
+      return None;
+    }
+
+    self.cells[y * self.columns + x].iter().rev().find_map(|&index| {
+      let entry = &self.entries[index as usize];
+      self
+        .to_frame_space(entry.frame, point, scroll_offsets)
+        .filter(|&point| contains(&entry.rect, point))
+        .map(|_| entry.node)
+    })
+  }
+}
+
+#[derive(Debug, Default)]
+struct HitTestState {
+  grid: HitTestGrid,
+  scroll_offsets: HashMap<NodeId, LayoutVector2D>,
+  /// The part of the framebuffer the view covered when the grid was built.
+  device_rect: DeviceIntRect,
+  device_pixel_ratio: f32,
+}
+
+/// Finds the element under a point of a view, using the boxes of the view's current display list.
+///
+/// Clones share the grid the view's `SceneBuilder` built last, so hit testing works from the
+/// windowing thread while scenes are built on another one.
+#[derive(Debug, Clone, Default)]
+pub struct HitTester(Arc<RwLock<HitTestState>>);
+
+impl HitTester {
+  /// Replaces the grid with the one for a new display list.
+  pub(crate) fn update(
+    &self,
+    grid: HitTestGrid,
+    scroll_offsets: &HashMap<NodeId, LayoutVector2D>,
+    device_rect: DeviceIntRect,
+    device_pixel_ratio: f32,
+  ) {
+    let mut state = self.0.write().unwrap();
+    state.grid = grid;
+    state.scroll_offsets.clone_from(scroll_offsets);
+    state.device_rect = device_rect;
+    state.device_pixel_ratio = device_pixel_ratio;
+  }
+
+  pub(crate) fn set_scroll_offset(&self, node: NodeId, offset: LayoutVector2D) {
+    self.0.write().unwrap().scroll_offsets.insert(node, offset);
+  }
+
+  /// Returns true if the view covers `point`, in device pixels of the framebuffer.
+  #[must_use]
+  pub fn contains(&self, point: DevicePoint) -> bool {
+    let rect = self.0.read().unwrap().device_rect;
+    let (x, y) = (point.x - rect.origin.x as f32, point.y - rect.origin.y as f32);
+    x >= 0.0 && y >= 0.0 && x < rect.size.width as f32 && y < rect.size.height as f32
+  }
+
+  /// Returns the topmost element at `point`, in device pixels of the framebuffer.
+  #[must_use]
+  pub fn hit_test(&self, point: DevicePoint) -> Option<NodeId> {
+    let state = self.0.read().unwrap();
+    if state.device_pixel_ratio <= 0.0 {
+      return None;
+    }
+
+    let origin = state.device_rect.origin;
+    let point = LayoutPoint::new(
+      (point.x - origin.x as f32) / state.device_pixel_ratio,
+      (point.y - origin.y as f32) / state.device_pixel_ratio,
+    );
+    state.grid.hit_test(point, &state.scroll_offsets)
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+
+  fn rect(x: f32, y: f32, width: f32, height: f32) -> LayoutRect {
+    LayoutRect::new(LayoutPoint::new(x, y), LayoutSize::new(width, height))
+  }
+
+  fn node(index: usize) -> NodeId {
+    NodeId::from_index(index)
+  }
+
+  fn hit(grid: &HitTestGrid, x: f32, y: f32, scroll_offsets: &HashMap<NodeId, LayoutVector2D>) -> Option<NodeId> {
+    grid.hit_test(LayoutPoint::new(x, y), scroll_offsets)
+  }
+
+  #[test]
+  fn later_boxes_are_on_top() {
+    let mut grid = HitTestGrid::new(LayoutSize::new(256.0, 256.0));
+    grid.push(node(1), rect(0.0, 0.0, 200.0, 200.0), None);
+    grid.push(node(2), rect(50.0, 50.0, 100.0, 100.0), None);
+
+    let none = HashMap::new();
+    assert_eq!(hit(&grid, 10.0, 10.0, &none), Some(node(1)));
+    assert_eq!(hit(&grid, 100.0, 100.0, &none), Some(node(2)));
+    // Boxes are half open.
+    assert_eq!(hit(&grid, 150.0, 100.0, &none), Some(node(1)));
+    assert_eq!(hit(&grid, 200.0, 10.0, &none), None);
+    assert_eq!(hit(&grid, -1.0, 10.0, &none), None);
+    assert_eq!(hit(&grid, 300.0, 10.0, &none), None);
+  }
+
+  #[test]
+  fn scroll_frames_reach_every_cell_their_content_can_scroll_to() {
+    let mut grid = HitTestGrid::new(LayoutSize::new(256.0, 256.0));
+    let frame = grid.push_frame(
+      node(1),
+      None,
+      rect(0.0, 0.0, 100.0, 100.0),
+      LayoutVector2D::new(0.0, 200.0),
+    );
+    // Below the frame's clip until it is scrolled by more than 150.
+    grid.push(node(2), rect(0.0, 250.0, 100.0, 50.0), Some(frame));
+
+    let mut scroll_offsets = HashMap::new();
+    assert_eq!(hit(&grid, 10.0, 60.0, &scroll_offsets), None);
+
+    scroll_offsets.insert(node(1), LayoutVector2D::new(0.0, 200.0));
+    assert_eq!(hit(&grid, 10.0, 60.0, &scroll_offsets), Some(node(2)));
+    assert_eq!(hit(&grid, 10.0, 40.0, &scroll_offsets), None);
+  }
+
+  #[test]
+  fn scroll_frames_clip_their_content() {
+    let mut grid = HitTestGrid::new(LayoutSize::new(256.0, 256.0));
+    let outer = grid.push_frame(node(1), None, rect(0.0, 0.0, 100.0, 100.0), LayoutVector2D::zero());
+    grid.push(node(2), rect(0.0, 0.0, 200.0, 200.0), Some(outer));
+    let inner = grid.push_frame(
+      node(3),
+      Some(outer),
+      rect(50.0, 50.0, 150.0, 150.0),
+      LayoutVector2D::zero(),
+    );
+    grid.push(node(4), rect(50.0, 50.0, 150.0, 150.0), Some(inner));
+
+    let none = HashMap::new();
+    assert_eq!(hit(&grid, 10.0, 10.0, &none), Some(node(2)));
+    assert_eq!(hit(&grid, 75.0, 75.0, &none), Some(node(4)));
+    // The cell holds the outer box, but the point is outside of the frame's clip.
+    assert_eq!(hit(&grid, 110.0, 10.0, &none), None);
+    // Inside both boxes, but outside of the outer frame's clip.
+    assert_eq!(hit(&grid, 150.0, 150.0, &none), None);
+    assert_eq!(hit(&grid, 150.0, 10.0, &none), None);
+  }
+
+  #[test]
+  fn boxes_outside_of_their_frame_are_skipped() {
+    let mut grid = HitTestGrid::new(LayoutSize::new(256.0, 256.0));
+    let frame = grid.push_frame(node(1), None, rect(0.0, 0.0, 100.0, 100.0), LayoutVector2D::zero());
+    grid.push(node(2), rect(150.0, 150.0, 50.0, 50.0), Some(frame));
+
+    assert!(grid.entries.is_empty());
+    assert!(grid.cells.iter().all(Vec::is_empty));
+  }
+}
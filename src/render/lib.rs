@@ -10,11 +10,28 @@ use webrender::{
   DebugFlags, ShaderPrecacheFlags,
 };
 
-use dom::CompiledDocument;
-use std::sync::Arc;
+use dom::{tree::NodeId, CompiledDocument};
+use once_cell::sync::Lazy;
+use std::{
+  collections::HashMap,
+  path::PathBuf,
+  sync::{Arc, Condvar, Mutex},
+  time::Instant,
+};
+use style::Overflow;
 
 #[cfg(feature = "c-render")]
 pub mod c_api;
+mod hit_test;
+mod memory;
+mod offscreen;
+mod program_cache;
+
+use hit_test::HitTestGrid;
+pub use hit_test::HitTester;
+pub use memory::RenderMemoryReport;
+use offscreen::OffscreenTarget;
+pub use offscreen::Readback;
 
 // pub trait HandyDandyRectBuilder {
 //   fn to(&self, x2: i32, y2: i32) -> LayoutRect;
@@ -72,24 +89,414 @@ pub mod c_api;
 //   }
 // }
 
-const PRECACHE_SHADER_FLAGS: ShaderPrecacheFlags = ShaderPrecacheFlags::EMPTY;
+/// WebRender's glyph rasterization and blob rendering threads, shared by every renderer in the process.
+static WORKERS: Lazy<Arc<rayon::ThreadPool>> = Lazy::new(|| {
+  Arc::new(
+    rayon::ThreadPoolBuilder::new()
+      .thread_name(|i| format!("WRWorker#{}", i))
+      .build()
+      .unwrap(),
+  )
+});
+
+/// Options for `Renderer::new`.
+#[derive(Debug, Clone, Default)]
+pub struct RendererOptions {
+  /// Where compiled shader programs are kept between launches, `None` compiles them every launch.
+  pub program_cache_dir: Option<PathBuf>,
+  /// Compile every shader while starting up, on WebRender's threads where the driver allows it,
+  /// instead of the first time each one is used. Frames never hitch on a shader compile,
+  /// at the cost of a longer startup without a warm cache.
+  pub precache_shaders: bool,
+}
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
 #[repr(C)]
 pub struct DevicePixel;
 
 pub type DeviceSize = Size2D<i32, DevicePixel>;
+pub type DevicePoint = euclid::Point2D<f32, DevicePixel>;
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+#[doc = "module=render"]
+pub enum RenderMode {
+  /// Only composites the last frame, without looking at the document.
+  Composite,
+  /// Restyles the document and rebuilds the whole display list.
+  Full,
+  /// Restyles the document and only sends what changed since the last frame,
+  /// reusing the retained display list when layout didn't change.
+  Incremental,
+}
+
+/// Counters for the most recent frame.
+///
+/// The style and display list counters describe the last scene that was built,
+/// the WebRender counters the last frame that was composited.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default, PartialEq)]
+#[doc = "module=render"]
+pub struct FrameStats {
+  /// Elements whose style was recomputed.
+  pub nodes_restyled: u32,
+  /// Elements that reused a sibling's style instead of matching selectors.
+  pub styles_shared: u32,
+  /// Candidate rules that were matched against an element.
+  pub rules_tested: u32,
+  /// Candidate rules that matched.
+  pub rules_matched: u32,
+  /// Script attributes that were evaluated.
+  pub script_evals: u32,
+  /// Time spent in yoga, in microseconds.
+  pub layout_us: u64,
+  /// Time spent building the display list (or patching its colors), in microseconds.
+  pub display_list_us: u64,
+  /// Display items pushed, `0` if the retained display list was reused.
+  pub display_items: u32,
+  /// Elements that were skipped along with everything below them because they couldn't be seen.
+  pub subtrees_culled: u32,
+  /// Time WebRender spent on the CPU, in microseconds.
+  pub webrender_cpu_us: u64,
+  /// Time WebRender spent on the GPU, in microseconds. Only measured while profiling is enabled.
+  pub webrender_gpu_us: u64,
+  /// Draw calls WebRender issued.
+  pub draw_calls: u32,
+}
+
+impl FrameStats {
+  /// Every counter by name, durations in seconds, in the shape `chrome_devtools::DevTools::record_frame` takes.
+  #[must_use]
+  pub fn counters(&self) -> [(&'static str, f64); 12] {
+    let seconds = |us: u64| us as f64 / 1_000_000.0;
+    [
+      ("NodesRestyled", f64::from(self.nodes_restyled)),
+      ("StylesShared", f64::from(self.styles_shared)),
+      ("RulesTested", f64::from(self.rules_tested)),
+      ("RulesMatched", f64::from(self.rules_matched)),
+      ("ScriptEvals", f64::from(self.script_evals)),
+      ("LayoutDuration", seconds(self.layout_us)),
+      ("DisplayListDuration", seconds(self.display_list_us)),
+      ("DisplayItems", f64::from(self.display_items)),
+      ("SubtreesCulled", f64::from(self.subtrees_culled)),
+      ("WebRenderCpuDuration", seconds(self.webrender_cpu_us)),
+      ("WebRenderGpuDuration", seconds(self.webrender_gpu_us)),
+      ("DrawCalls", f64::from(self.draw_calls)),
+    ]
+  }
+}
+
+fn to_color_f(color: (u8, u8, u8, u8)) -> ColorF {
+  ColorU::new(color.0, color.1, color.2, color.3).into()
+}
+
+/// How much of a scroll frame's content is built beyond the part that can be seen, as a fraction
+/// of the frame's size on each side. Scrolling within it only moves the content on the compositor.
+const DISPLAY_PORT_MARGIN: f32 = 1.0;
+
+/// A scroll frame in the current display list, all rects are in unscrolled layout coordinates.
+#[derive(Debug, Copy, Clone)]
+struct ScrollFrame {
+  /// The box of the element, the part of the content that is visible at offset zero.
+  clip_rect: LayoutRect,
+  /// How far the content can be scrolled.
+  max_offset: LayoutVector2D,
+  /// The part of the content that has display items.
+  display_port: LayoutRect,
+}
+
+/// What `push_display_items` pushed.
+#[derive(Debug, Default)]
+struct DisplayItems {
+  pushed: u32,
+  subtrees_culled: u32,
+  scroll_frames: HashMap<NodeId, ScrollFrame>,
+  /// The boxes of the pushed elements, for finding the one under the pointer.
+  hit_test: HitTestGrid,
+}
+
+/// Like `Rect::intersects`, but boxes without an area still count if they touch `b`,
+/// their children can have one.
+fn overlaps(a: &LayoutRect, b: &LayoutRect) -> bool {
+  a.min_x() <= b.max_x() && a.max_x() >= b.min_x() && a.min_y() <= b.max_y() && a.max_y() >= b.min_y()
+}
+
+fn clamp_scroll_offset(offset: LayoutVector2D, max: LayoutVector2D) -> LayoutVector2D {
+  LayoutVector2D::new(offset.x.max(0.0).min(max.x), offset.y.max(0.0).min(max.y))
+}
+
+/// Pushes a rect for every element of `doc` that overlaps `viewport`, with its background
+/// color bound to the key `color_key` returns for it. The boxes come from the document's
+/// `LayoutCache`, so this never touches the tree or yoga.
+///
+/// Elements outside the viewport (or the display port of the scroll frame they're in) are
+/// skipped along with their subtree. Children normally stay inside their parent's box, the
+/// ones that overflow an `overflow: visible` element that can't be seen are skipped too.
+/// `overflow: scroll` elements get a WebRender scroll frame, scrolled to `scroll_offsets`.
+/// Every pushed element is added to the hit test grid along with the part of it that isn't clipped.
+fn push_display_items(
+  builder: &mut DisplayListBuilder,
+  doc: &CompiledDocument,
+  viewport: LayoutRect,
+  scroll_offsets: &HashMap<NodeId, LayoutVector2D>,
+  mut color_key: impl FnMut(NodeId) -> PropertyBindingKey<ColorF>,
+) -> DisplayItems {
+  let mut items = DisplayItems {
+    hit_test: HitTestGrid::new(viewport.size),
+    ..DisplayItems::default()
+  };
+  let layout = doc.layout.read().unwrap();
+  if layout.is_empty() {
+    return items;
+  }
+
+  // The layout cache is in document order, so the children of an element are the entries up to
+  // its `subtree_end`. Each entry of the stack holds what its element's descendants are pushed
+  // with: the space their items go in, the part of the layout worth building and what the clips
+  // of their ancestors leave visible in the space of the scroll frame `frame`.
+  let root_space_and_clip = SpaceAndClipInfo::root_scroll(builder.pipeline_id);
+  let mut stack = vec![(layout.len(), root_space_and_clip, viewport, viewport, None)];
+
+  let mut index = 0;
+  while index < layout.len() {
+    while stack.last().map_or(false, |&(end, ..)| end <= index) {
+      stack.pop();
+    }
+    let (_, space_and_clip, cull_rect, clip, frame) = *stack.last().unwrap();
+    let id = layout.nodes[index];
+    let subtree_end = layout.subtree_end[index] as usize;
+
+    let rect = LayoutRect::new(
+      LayoutPoint::new(layout.x[index], layout.y[index]),
+      LayoutSize::new(layout.width[index], layout.height[index]),
+    );
+    if !overlaps(&rect, &cull_rect) {
+      items.subtrees_culled += 1;
+      index = subtree_end;
+      continue;
+    }
+
+    builder.push_rect_with_animation(
+      &CommonItemProperties::new(rect, space_and_clip),
+      rect,
+      PropertyBinding::Binding(color_key(id), to_color_f(layout.background_color[index])),
+    );
+    items.pushed += 1;
+
+    let visible = rect.intersection(&clip);
+    if let Some(visible) = visible {
+      items.hit_test.push(id, visible, frame);
+    }
+
+    if subtree_end == index + 1 {
+      index += 1;
+      continue;
+    }
+
+    let (children_space_and_clip, children_cull_rect, children_clip, children_frame) = match layout.overflow[index] {
+      Overflow::Visible => (space_and_clip, cull_rect, clip, frame),
+
+      Overflow::Hidden => {
+        let clip_id = builder.define_clip_rect(&space_and_clip, rect);
+        let space_and_clip = SpaceAndClipInfo {
+          spatial_id: space_and_clip.spatial_id,
+          clip_id,
+        };
+        (
+          space_and_clip,
+          cull_rect.intersection(&rect).unwrap_or_else(LayoutRect::zero),
+          visible.unwrap_or_else(LayoutRect::zero),
+          frame,
+        )
+      }
+
+      Overflow::Scroll => {
+        // Hops from child to child, over their subtrees.
+        let mut content_size = rect.size;
+        let mut child = index + 1;
+        while child < subtree_end {
+          let right = layout.x[child] + layout.width[child];
+          let bottom = layout.y[child] + layout.height[child];
+          content_size.width = content_size.width.max(right - rect.origin.x);
+          content_size.height = content_size.height.max(bottom - rect.origin.y);
+          child = layout.subtree_end[child] as usize;
+        }
+        let max_offset = (content_size - rect.size).to_vector();
+
+        let offset = scroll_offsets.get(&id).copied().unwrap_or_else(LayoutVector2D::zero);
+        let margin = rect.size * DISPLAY_PORT_MARGIN;
+        let display_port = rect
+          .translate(clamp_scroll_offset(offset, max_offset))
+          .inflate(margin.width, margin.height);
+
+        let space_and_clip = builder.define_scroll_frame(
+          &space_and_clip,
+          Some(ExternalScrollId(id.index() as u64, builder.pipeline_id)),
+          LayoutRect::new(rect.origin, content_size),
+          rect,
+          ScrollSensitivity::ScriptAndInputEvents,
+          LayoutVector2D::zero(),
+        );
+        items.scroll_frames.insert(
+          id,
+          ScrollFrame {
+            clip_rect: rect,
+            max_offset,
+            display_port,
+          },
+        );
+        let content_rect = LayoutRect::new(rect.origin, content_size);
+        let frame = items
+          .hit_test
+          .push_frame(id, frame, visible.unwrap_or_else(LayoutRect::zero), max_offset);
+        (space_and_clip, display_port, content_rect, Some(frame))
+      }
+    };
+
+    stack.push((
+      subtree_end,
+      children_space_and_clip,
+      children_cull_rect,
+      children_clip,
+      children_frame,
+    ));
+    index += 1;
+  }
+
+  items
+}
+
+/// Builds the display list for `doc` without a WebRender instance, so display list
+/// building can be measured on its own. The color keys aren't registered anywhere,
+/// the list can't be sent to a renderer. Returns how many items were pushed.
+#[doc(hidden)]
+pub fn build_display_list(doc: &CompiledDocument, width: f32, height: f32) -> u32 {
+  let mut builder = DisplayListBuilder::new(PipelineId(0, 0), LayoutSize::new(width, height));
+  let viewport = LayoutRect::new(LayoutPoint::zero(), LayoutSize::new(width, height));
+  let items = push_display_items(&mut builder, doc, viewport, &HashMap::new(), |id| {
+    PropertyBindingKey::new(id.index() as u64)
+  });
+  let _ = builder.finalize();
+  items.pushed
+}
+
+/// Set once WebRender has a frame that hasn't been composited yet.
+#[derive(Default)]
+struct FrameReady {
+  ready: Mutex<bool>,
+  condvar: Condvar,
+}
+
+impl FrameReady {
+  fn set(&self) {
+    *self.ready.lock().unwrap() = true;
+    self.condvar.notify_all();
+  }
+
+  fn clear(&self) {
+    *self.ready.lock().unwrap() = false;
+  }
+
+  fn is_set(&self) -> bool {
+    *self.ready.lock().unwrap()
+  }
+
+  /// Blocks until a frame is ready.
+  fn wait(&self) {
+    let mut ready = self.ready.lock().unwrap();
+    while !*ready {
+      ready = self.condvar.wait(ready).unwrap();
+    }
+  }
+}
+
+/// Wraps the notifier passed to `Renderer::new` to remember if WebRender has a frame
+/// that hasn't been composited yet.
+struct FrameNotifier {
+  inner: Box<dyn RenderNotifier>,
+  frame_ready: Arc<FrameReady>,
+}
+
+impl RenderNotifier for FrameNotifier {
+  fn clone(&self) -> Box<dyn RenderNotifier> {
+    Box::new(FrameNotifier {
+      inner: self.inner.clone(),
+      frame_ready: Arc::clone(&self.frame_ready),
+    })
+  }
+
+  fn wake_up(&self) {
+    self.inner.wake_up();
+  }
+
+  fn new_frame_ready(&self, document_id: DocumentId, scrolled: bool, composite_needed: bool, render_time: Option<u64>) {
+    if composite_needed {
+      self.frame_ready.set();
+    }
+
+    self
+      .inner
+      .new_frame_ready(document_id, scrolled, composite_needed, render_time);
+  }
+}
 
 #[doc = "module=render"]
 pub struct Renderer {
   renderer: webrender::Renderer,
+  /// Creates the APIs for additional views.
+  sender: RenderApiSender,
+  /// For requests that aren't about a view, it stays here when the scene builder is taken.
+  api: RenderApi,
+  gl: Rc<dyn Gl>,
   device_size: DeviceIntSize,
   device_pixel_ratio: f32,
+  frame_ready: Arc<FrameReady>,
+  /// Where frames are drawn when rendering without a window.
+  offscreen: Option<OffscreenTarget>,
+  /// Told once the first frame has been rendered, so it can write out the programs startup needed.
+  program_cache: Option<Rc<webrender::ProgramCache>>,
+  /// Shared with the scene builder, which fills in the style and display list counters.
+  stats: Arc<Mutex<FrameStats>>,
+  /// The view that fills the framebuffer, `None` once it has been moved to another thread,
+  /// see `take_scene_builder`.
+  scene_builder: Option<SceneBuilder>,
+  /// Views added with `add_view`, view `n` is `views[n - 1]`.
+  views: Vec<SceneBuilder>,
+  /// The main view's, kept here since its scene builder can be taken.
+  hit_tester: HitTester,
+}
+
+/// Turns documents into display lists and sends them to WebRender.
+///
+/// This half of the renderer never touches GL, so it can run on a different thread
+/// than the one that composites.
+pub struct SceneBuilder {
   api: RenderApi,
+  origin: DeviceIntPoint,
+  device_size: DeviceIntSize,
+  device_pixel_ratio: f32,
   pipeline_id: PipelineId,
   document_id: DocumentId,
   layout_size: Size2D<f32, LayoutPixel>,
   epoch: Epoch,
+
+  /// The address of the document the current display list was built from.
+  retained_document: Option<usize>,
+  /// The property binding for the background color of each node, indexed by `NodeId`.
+  color_keys: Vec<PropertyBindingKey<ColorF>>,
+  /// Colors that changed since the current display list was built.
+  color_overrides: HashMap<NodeId, PropertyValue<ColorF>>,
+  /// Positions set with `scroll_to`, they outlive display lists so rebuilds keep them.
+  scroll_offsets: HashMap<NodeId, LayoutVector2D>,
+  /// The scroll frames in the current display list.
+  scroll_frames: HashMap<NodeId, ScrollFrame>,
+  /// Set once a scroll frame was scrolled past the content that was built, so the next build
+  /// rebuilds the display list even if nothing changed.
+  scrolled_out: bool,
+  /// Shares the boxes of the current display list with whoever does hit testing.
+  hit_tester: HitTester,
+
+  stats: Arc<Mutex<FrameStats>>,
 }
 
 impl Renderer {
@@ -98,8 +505,18 @@ impl Renderer {
     device_pixel_ratio: f32,
     device_size: DeviceSize,
     notifier: Box<dyn RenderNotifier>,
+    options: &RendererOptions,
   ) -> Self {
     let device_size = DeviceIntSize::new(device_size.width, device_size.height);
+    let program_cache = options
+      .program_cache_dir
+      .as_ref()
+      .and_then(|dir| program_cache::open(&*gl, dir));
+    let precache_flags = if options.precache_shaders {
+      ShaderPrecacheFlags::ASYNC_COMPILE
+    } else {
+      ShaderPrecacheFlags::EMPTY
+    };
     // let gl = windowing.get_gl();
 
     // windowing.make_current();
@@ -108,17 +525,24 @@ impl Renderer {
 
     let debug_flags = DebugFlags::ECHO_DRIVER_MESSAGES;
     let opts = webrender::RendererOptions {
-      precache_flags: PRECACHE_SHADER_FLAGS,
+      precache_flags,
+      cached_programs: program_cache.clone(),
+      workers: Some(Arc::clone(&WORKERS)),
       device_pixel_ratio,
       clear_color: Some(ColorF::new(0.3, 0.0, 0.0, 1.0)),
       debug_flags,
+      size_of_op: Some(memory::size_of_op),
       //allow_texture_swizzling: false,
       ..webrender::RendererOptions::default()
     };
 
-    let (renderer, sender) = webrender::Renderer::new(gl, notifier, opts, None, device_size).unwrap();
-    let mut api = sender.create_api();
-    let document_id = api.add_document(device_size, 0);
+    let frame_ready = Arc::new(FrameReady::default());
+    let notifier = Box::new(FrameNotifier {
+      inner: notifier,
+      frame_ready: Arc::clone(&frame_ready),
+    });
+
+    let (renderer, sender) = webrender::Renderer::new(Rc::clone(&gl), notifier, opts, None, device_size).unwrap();
 
     // let (external, output) = example.get_image_handlers(&*gl);
 
@@ -130,98 +554,468 @@ impl Renderer {
     //   renderer.set_external_image_handler(external_image_handler);
     // }
 
-    let epoch = Epoch(0);
-    let pipeline_id = PipelineId(0, 0);
-    let layout_size = device_size.to_f32() / euclid::Scale::new(device_pixel_ratio);
-    let mut txn = Transaction::new();
-    txn.set_root_pipeline(pipeline_id);
-    api.send_transaction(document_id, txn);
+    let stats = Arc::new(Mutex::new(FrameStats::default()));
+    let scene_builder = SceneBuilder::new(
+      sender.create_api(),
+      device_size.into(),
+      device_pixel_ratio,
+      0,
+      PipelineId(0, 0),
+      Arc::clone(&stats),
+    );
 
     Self {
       renderer,
+      api: sender.create_api(),
+      sender,
+      gl,
       device_size,
       device_pixel_ratio,
-      api,
-      pipeline_id,
-      document_id,
-      layout_size,
-      epoch,
+      frame_ready,
+      offscreen: None,
+      program_cache,
+      stats,
+      hit_tester: scene_builder.hit_tester().clone(),
+      scene_builder: Some(scene_builder),
+      views: Vec::new(),
     }
   }
 
+  /// Creates a renderer that draws into a framebuffer instead of a window, see `snapshot`.
+  ///
+  /// `gl` still needs a current context, but it can be a pbuffer or surfaceless one.
+  pub fn new_offscreen(
+    gl: Rc<dyn Gl>,
+    device_pixel_ratio: f32,
+    device_size: DeviceSize,
+    notifier: Box<dyn RenderNotifier>,
+    options: &RendererOptions,
+  ) -> Self {
+    let mut renderer = Self::new(Rc::clone(&gl), device_pixel_ratio, device_size, notifier, options);
+    renderer.offscreen = Some(OffscreenTarget::new(gl, renderer.device_size));
+    renderer
+  }
+
   pub fn deinit(self) {
+    // The framebuffer has to go while the context is still around.
+    drop(self.offscreen);
     self.renderer.deinit();
   }
 
+  /// Moves the scene builder out of the renderer so display lists can be built on another thread.
+  ///
+  /// Afterwards only `composite` can be used to produce frames, and size or scale changes
+  /// have to be forwarded to the scene builder as well.
+  pub fn take_scene_builder(&mut self) -> SceneBuilder {
+    self.scene_builder.take().expect("the scene builder was already taken")
+  }
+
+  fn scene_builder(&mut self) -> &mut SceneBuilder {
+    self
+      .scene_builder
+      .as_mut()
+      .expect("the scene builder was moved to another thread")
+  }
+
   pub fn set_device_size(&mut self, size: DeviceSize) {
     self.device_size = DeviceIntSize::new(size.width, size.height);
-    self.layout_size = self.device_size.to_f32() / euclid::Scale::new(self.device_pixel_ratio);
 
-    let mut txn = Transaction::new();
-    txn.set_document_view(self.device_size.into(), self.device_pixel_ratio);
-    self.api.send_transaction(self.document_id, txn);
+    if let Some(offscreen) = &self.offscreen {
+      offscreen.resize(self.device_size);
+    }
+
+    if let Some(scene_builder) = &mut self.scene_builder {
+      scene_builder.set_device_size(size);
+    }
   }
 
   pub fn set_scale_factor(&mut self, scale: f32) {
     self.device_pixel_ratio = scale;
+
+    if let Some(scene_builder) = &mut self.scene_builder {
+      scene_builder.set_scale_factor(scale);
+    }
+    for view in &mut self.views {
+      view.set_scale_factor(scale);
+    }
+  }
+
+  /// Adds a view that shows another document in `rect` of the framebuffer, on top of
+  /// the main view and any views added before it. Returns the id to pass to `render_view`.
+  ///
+  /// Views share this renderer's threads, caches and GPU resources, so splitting a window
+  /// into several documents costs much less than a renderer per document.
+  pub fn add_view(&mut self, rect: DeviceIntRect) -> usize {
+    let id = self.views.len() + 1;
+    self.views.push(SceneBuilder::new(
+      self.sender.create_api(),
+      rect,
+      self.device_pixel_ratio,
+      id as DocumentLayer,
+      PipelineId(0, id as u32),
+      Arc::clone(&self.stats),
+    ));
+    id
+  }
+
+  /// Returns the scene builder of a view, `0` is the main view.
+  ///
+  /// Panics if there is no such view, see `get_view_mut`.
+  pub fn view_mut(&mut self, view: usize) -> &mut SceneBuilder {
+    match view {
+      0 => self.scene_builder(),
+      _ => self.views.get_mut(view - 1).expect("there is no such view"),
+    }
+  }
+
+  /// Like `view_mut`, but returns `None` if there is no such view, or if it is the main view
+  /// and its scene builder was moved to another thread with `take_scene_builder`.
+  pub fn get_view_mut(&mut self, view: usize) -> Option<&mut SceneBuilder> {
+    match view {
+      0 => self.scene_builder.as_mut(),
+      _ => self.views.get_mut(view - 1),
+    }
+  }
+
+  /// Builds a new scene according to `mode` and composites it.
+  pub fn render(&mut self, mode: RenderMode, doc: &Arc<CompiledDocument>) {
+    self.render_view(0, mode, doc);
+  }
+
+  /// Builds a new scene for one view and composites every view.
+  pub fn render_view(&mut self, view: usize, mode: RenderMode, doc: &Arc<CompiledDocument>) {
+    self.view_mut(view).build(mode, doc);
+    self.composite();
+  }
+
+  /// Scrolls an element of a view and composites, see `SceneBuilder::scroll_to`.
+  pub fn scroll_view(&mut self, view: usize, node: NodeId, offset: LayoutVector2D) -> bool {
+    let rebuild = self.view_mut(view).scroll_to(node, offset);
+    self.composite();
+    rebuild
+  }
+
+  /// Returns the topmost view at `point` (in device pixels of the framebuffer) and the element
+  /// of its current display list under the point.
+  ///
+  /// Uses the hit test grid built along with the display list, so it doesn't walk the tree
+  /// and works while scenes are built on another thread.
+  #[must_use]
+  pub fn hit_test(&self, point: DevicePoint) -> Option<(usize, NodeId)> {
+    let views = self.views.iter().enumerate().rev();
+    let (view, hit_tester) = views
+      .map(|(index, view)| (index + 1, view.hit_tester()))
+      .chain(std::iter::once((0, &self.hit_tester)))
+      .find(|(_, hit_tester)| hit_tester.contains(point))?;
+
+    hit_tester.hit_test(point).map(|node| (view, node))
+  }
+
+  /// Returns true if WebRender has finished building a frame that hasn't been composited yet.
+  #[must_use]
+  pub fn has_new_frame(&self) -> bool {
+    self.frame_ready.is_set()
+  }
+
+  /// Renders the most recent scene WebRender has finished building.
+  pub fn composite(&mut self) {
+    self.frame_ready.clear();
+    if let Some(offscreen) = &self.offscreen {
+      offscreen.bind();
+    }
+
+    self.renderer.update();
+    self.renderer.render(self.device_size).unwrap();
+    let _ = self.renderer.flush_pipeline_info();
+
+    // Everything the first frame needed is compiled now, later launches can load it up front.
+    if let Some(program_cache) = self.program_cache.take() {
+      program_cache.startup_complete();
+    }
+
+    let (cpu_profiles, gpu_profiles) = self.renderer.get_frame_profiles();
+    let mut stats = self.stats.lock().unwrap();
+    if let Some(cpu) = cpu_profiles.last() {
+      stats.webrender_cpu_us = (cpu.backend_time_ns + cpu.composite_time_ns) / 1000;
+      stats.draw_calls = cpu.draw_calls as u32;
+    }
+    stats.webrender_gpu_us = gpu_profiles.last().map_or(0, |gpu| gpu.paint_time_ns / 1000);
+  }
+
+  /// Renders `doc` into the offscreen framebuffer and starts reading it back.
+  ///
+  /// Unlike `render` this waits for WebRender to build the scene, so the snapshot is
+  /// always of `doc`. The readback finishes in the background, so many documents can
+  /// be snapshotted in a row before the first one is read.
+  ///
+  /// Panics if the renderer wasn't created with `new_offscreen`.
+  pub fn snapshot(&mut self, doc: &Arc<CompiledDocument>) -> Readback {
+    assert!(self.offscreen.is_some(), "snapshots need an offscreen renderer");
+
+    self.frame_ready.clear();
+    self.scene_builder().build(RenderMode::Full, doc);
+    self.frame_ready.wait();
+    self.composite();
+
+    self.offscreen.as_ref().unwrap().read_pixels(self.device_size)
+  }
+
+  /// Returns the counters for the most recent frame.
+  #[must_use]
+  pub fn frame_stats(&self) -> FrameStats {
+    *self.stats.lock().unwrap()
+  }
+
+  /// Enables GPU timer queries, which `FrameStats::webrender_gpu_us` needs.
+  pub fn set_profiling(&mut self, enabled: bool) {
+    let mut flags = self.renderer.get_debug_flags();
+    flags.set(DebugFlags::GPU_TIME_QUERIES, enabled);
+    self.renderer.set_debug_flags(flags);
+  }
+
+  /// Measures what WebRender holds on to, across every view.
+  ///
+  /// Waits for WebRender's backend thread to measure its caches, so this shouldn't be called every frame.
+  #[must_use]
+  pub fn memory_report(&self) -> RenderMemoryReport {
+    let mut report = self.api.report_memory();
+    report += self.renderer.report_memory();
+    report.into()
+  }
+
+  /// Frees WebRender's caches and textures, for windows that are hidden.
+  ///
+  /// The next frame has to rasterize and upload everything it shows again, so this is only
+  /// worth it when the window won't be drawn for a while. The GL context has to be current.
+  pub fn trim(&mut self) {
+    self.api.notify_memory_pressure();
+    // The backend answers in order, so by the time the report is back it has cleared its caches
+    // and told the renderer to do the same, and this update frees the textures right away
+    // instead of on the next frame.
+    let _ = self.api.report_memory();
+    self.renderer.update();
+  }
+}
+
+impl SceneBuilder {
+  /// Creates a document that covers `rect` of the framebuffer, documents with a higher `layer` are drawn on top.
+  fn new(
+    mut api: RenderApi,
+    rect: DeviceIntRect,
+    device_pixel_ratio: f32,
+    layer: DocumentLayer,
+    pipeline_id: PipelineId,
+    stats: Arc<Mutex<FrameStats>>,
+  ) -> Self {
+    let document_id = api.add_document(rect.size, layer);
+
+    let mut txn = Transaction::new();
+    txn.set_root_pipeline(pipeline_id);
+    api.send_transaction(document_id, txn);
+
+    let mut scene_builder = Self {
+      api,
+      origin: rect.origin,
+      device_size: rect.size,
+      device_pixel_ratio,
+      pipeline_id,
+      document_id,
+      layout_size: rect.size.to_f32() / euclid::Scale::new(device_pixel_ratio),
+      epoch: Epoch(0),
+
+      retained_document: None,
+      color_keys: Vec::new(),
+      color_overrides: HashMap::new(),
+      scroll_offsets: HashMap::new(),
+      scroll_frames: HashMap::new(),
+      scrolled_out: false,
+      hit_tester: HitTester::default(),
+
+      stats,
+    };
+    scene_builder.update_document_view();
+    scene_builder
+  }
+
+  fn update_document_view(&mut self) {
     self.layout_size = self.device_size.to_f32() / euclid::Scale::new(self.device_pixel_ratio);
 
     let mut txn = Transaction::new();
-    txn.set_document_view(self.device_size.into(), self.device_pixel_ratio);
+    txn.set_document_view(
+      DeviceIntRect::new(self.origin, self.device_size),
+      self.device_pixel_ratio,
+    );
     self.api.send_transaction(self.document_id, txn);
   }
 
-  pub fn render(&mut self, inner: bool, doc: &Arc<CompiledDocument>) {
+  pub fn set_device_size(&mut self, size: DeviceSize) {
+    self.device_size = DeviceIntSize::new(size.width, size.height);
+    self.update_document_view();
+  }
+
+  /// Moves and resizes the part of the framebuffer this document covers.
+  pub fn set_device_rect(&mut self, rect: DeviceIntRect) {
+    self.origin = rect.origin;
+    self.device_size = rect.size;
+    self.update_document_view();
+  }
+
+  pub fn set_scale_factor(&mut self, scale: f32) {
+    self.device_pixel_ratio = scale;
+    self.update_document_view();
+  }
+
+  /// Restyles `doc` and sends whatever changed to WebRender, according to `mode`.
+  pub fn build(&mut self, mode: RenderMode, doc: &Arc<CompiledDocument>) {
     let mut txn = Transaction::new();
 
-    if inner {
+    if mode != RenderMode::Composite {
       // self.api.send_debug_cmd(DebugCommand::SetFlags(DebugFlags::PROFILER_DBG));
 
-      let mut builder = DisplayListBuilder::new(self.pipeline_id, self.layout_size);
+      let changes = doc.compute_style(self.layout_size.width, self.layout_size.height, yoga::Direction::LTR);
+      let display_list_start = Instant::now();
+      let mut display_items = 0;
+      let mut subtrees_culled = 0;
 
-      self.render_inner(&mut builder, &mut txn, doc);
-      txn.set_display_list(
-        self.epoch,
-        Some(ColorF::new(0.3, 0.0, 0.0, 1.0)),
-        self.layout_size,
-        builder.finalize(),
-        true,
-      );
-      txn.generate_frame();
+      let same_document = self.retained_document == Some(Arc::as_ptr(doc) as usize);
+      let retained =
+        same_document && !self.scrolled_out && changes.repaint.iter().all(|id| id.index() < self.color_keys.len());
+
+      if mode == RenderMode::Full || changes.layout || !retained {
+        if !same_document {
+          // Scroll positions belong to the elements of the previous document.
+          self.scroll_offsets.clear();
+        }
+
+        let mut builder = DisplayListBuilder::new(self.pipeline_id, self.layout_size);
+
+        let items = self.render_inner(&mut builder, &mut txn, doc);
+        display_items = items.pushed;
+        subtrees_culled = items.subtrees_culled;
+        txn.set_display_list(
+          self.epoch,
+          Some(ColorF::new(0.3, 0.0, 0.0, 1.0)),
+          self.layout_size,
+          builder.finalize(),
+          true,
+        );
+        txn.generate_frame();
+
+        self.retained_document = Some(Arc::as_ptr(doc) as usize);
+      } else if !changes.repaint.is_empty() {
+        self.update_colors(&mut txn, doc, &changes.repaint);
+        txn.generate_frame();
+      }
+
+      let mut stats = self.stats.lock().unwrap();
+      stats.nodes_restyled = changes.stats.nodes_restyled;
+      stats.styles_shared = changes.stats.styles_shared;
+      stats.rules_tested = changes.stats.matching.rules_tested;
+      stats.rules_matched = changes.stats.matching.rules_matched;
+      stats.script_evals = changes.stats.script_evals;
+      stats.layout_us = changes.stats.layout_us;
+      stats.display_list_us = display_list_start.elapsed().as_micros() as u64;
+      stats.display_items = display_items;
+      stats.subtrees_culled = subtrees_culled;
     }
 
     self.api.send_transaction(self.document_id, txn);
+  }
 
-    self.renderer.update();
-    self.renderer.render(self.device_size).unwrap();
-    let _ = self.renderer.flush_pipeline_info();
+  /// Scrolls the content of an `overflow: scroll` element to `offset`, clamped to the content.
+  ///
+  /// Scrolling is done by the compositor, so this doesn't need the document. Returns true if
+  /// the element was scrolled past the content that was built around its last position, the
+  /// next `build` then rebuilds the display list (even in `RenderMode::Incremental`).
+  /// Elements that aren't a scroll frame in the current display list are ignored.
+  pub fn scroll_to(&mut self, node: NodeId, offset: LayoutVector2D) -> bool {
+    let frame = match self.scroll_frames.get(&node) {
+      Some(frame) => frame,
+      None => return false,
+    };
+
+    let offset = clamp_scroll_offset(offset, frame.max_offset);
+    self.scroll_offsets.insert(node, offset);
+    self.hit_tester.set_scroll_offset(node, offset);
+    self.scrolled_out |= !frame.display_port.contains_rect(&frame.clip_rect.translate(offset));
+
+    let mut txn = Transaction::new();
+    txn.scroll_node_with_id(
+      offset.to_point(),
+      ExternalScrollId(node.index() as u64, self.pipeline_id),
+      ScrollClamping::NoClamping,
+    );
+    txn.generate_frame();
+    self.api.send_transaction(self.document_id, txn);
+
+    self.scrolled_out
+  }
+
+  /// Returns the hit tester for this view, it keeps working after the scene builder is moved to another thread.
+  #[must_use]
+  pub fn hit_tester(&self) -> &HitTester {
+    &self.hit_tester
   }
 
-  fn render_inner(&mut self, builder: &mut DisplayListBuilder, txn: &mut Transaction, doc: &Arc<CompiledDocument>) {
+  /// Patches the background colors of `nodes` through WebRender's dynamic properties,
+  /// without touching the retained display list.
+  fn update_colors(&mut self, txn: &mut Transaction, doc: &CompiledDocument, nodes: &[NodeId]) {
+    let layout = doc.layout.read().unwrap();
+    for &id in nodes {
+      let index = match layout.index_of(id) {
+        Some(index) => index,
+        // Not in the document, so it isn't in the display list either.
+        None => continue,
+      };
+      let key = self.color_keys[id.index()];
+      self.color_overrides.insert(
+        id,
+        PropertyValue {
+          key,
+          value: to_color_f(layout.background_color[index]),
+        },
+      );
+    }
+
+    // Dynamic properties replace the previous set, so every override since the
+    // display list was built has to be sent again.
+    txn.update_dynamic_properties(DynamicProperties {
+      transforms: Vec::new(),
+      floats: Vec::new(),
+      colors: self.color_overrides.values().cloned().collect(),
+    });
+  }
+
+  /// Pushes the display items for the part of `doc` that can be seen.
+  fn render_inner(
+    &mut self,
+    builder: &mut DisplayListBuilder,
+    txn: &mut Transaction,
+    doc: &Arc<CompiledDocument>,
+  ) -> DisplayItems {
     let content_bounds = LayoutRect::new(LayoutPoint::zero(), builder.content_size());
     let root_space_and_clip = SpaceAndClipInfo::root_scroll(self.pipeline_id);
     let spatial_id = root_space_and_clip.spatial_id;
 
-    doc.compute_style(self.layout_size.width, self.layout_size.height, yoga::Direction::LTR);
-    for node in doc.root.descendants() {
-      let computed = node.inner().get_render();
-
-      let rect = LayoutRect::new(
-        LayoutPoint::new(computed.left, computed.top),
-        LayoutSize::new(computed.width, computed.height),
-      );
+    // The new display list bakes in the current colors.
+    self.color_overrides.clear();
 
-      builder.push_rect(
-        &CommonItemProperties::new(rect, root_space_and_clip),
-        rect,
-        ColorF::new(
-          computed.background_color.0 as f32 / 255.0,
-          computed.background_color.1 as f32 / 255.0,
-          computed.background_color.2 as f32 / 255.0,
-          computed.background_color.3 as f32 / 255.0,
-        ),
-      );
-    }
+    let viewport = LayoutRect::new(LayoutPoint::zero(), self.layout_size);
+    let (api, color_keys) = (&self.api, &mut self.color_keys);
+    let mut items = push_display_items(builder, doc, viewport, &self.scroll_offsets, |id| {
+      while color_keys.len() <= id.index() {
+        color_keys.push(api.generate_property_binding_key());
+      }
+      color_keys[id.index()]
+    });
+    self.scroll_frames = std::mem::take(&mut items.scroll_frames);
+    self.scrolled_out = false;
+    self.hit_tester.update(
+      std::mem::take(&mut items.hit_test),
+      &self.scroll_offsets,
+      DeviceIntRect::new(self.origin, self.device_size),
+      self.device_pixel_ratio,
+    );
 
     // let mask_clip_id = builder.define_clip_image_mask(
     //   &root_space_and_clip,
@@ -377,5 +1171,7 @@ impl Renderer {
     // }
 
     // builder.pop_stacking_context();
+
+    items
   }
 }
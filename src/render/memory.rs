@@ -0,0 +1,95 @@
+use std::os::raw::c_void;
+
+use webrender::api::MemoryReport;
+
+#[cfg(any(target_os = "linux", target_os = "android"))]
+extern "C" {
+  fn malloc_usable_size(ptr: *const c_void) -> usize;
+}
+
+#[cfg(any(target_os = "macos", target_os = "ios"))]
+extern "C" {
+  fn malloc_size(ptr: *const c_void) -> usize;
+}
+
+#[cfg(windows)]
+extern "C" {
+  fn _msize(ptr: *mut c_void) -> usize;
+}
+
+/// Returns the size of the heap block at `ptr`, WebRender measures its caches with this.
+pub(crate) unsafe extern "C" fn size_of_op(ptr: *const c_void) -> usize {
+  #[cfg(any(target_os = "linux", target_os = "android"))]
+  return malloc_usable_size(ptr);
+
+  #[cfg(any(target_os = "macos", target_os = "ios"))]
+  return malloc_size(ptr);
+
+  #[cfg(windows)]
+  return _msize(ptr as *mut c_void);
+}
+
+/// The memory a `Renderer` and WebRender hold on to, in bytes, see `Renderer::memory_report`.
+///
+/// The CPU sizes are what the allocator handed out, the GPU sizes are what WebRender asked
+/// the driver for. Neither includes the documents, see `CompiledDocument::memory_report`.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+#[doc = "module=render"]
+pub struct RenderMemoryReport {
+  /// The display lists of the scenes of every view.
+  pub display_lists: u64,
+  /// Images and rasterized blobs.
+  pub images: u64,
+  pub fonts: u64,
+  /// GPU cache bookkeeping and its copy on the CPU.
+  pub gpu_cache: u64,
+  /// Clip stores, render tasks, hit testers and compiled shaders.
+  pub other: u64,
+  /// Textures of the texture cache, these are freed by `Renderer::trim`.
+  pub texture_cache_textures: u64,
+  /// Color and depth targets that frames are drawn into before they are composited.
+  pub render_target_textures: u64,
+  /// The GPU cache texture, vertex data and swap chain.
+  pub other_textures: u64,
+}
+
+impl RenderMemoryReport {
+  /// The memory on the CPU side.
+  #[must_use]
+  pub fn cpu(&self) -> u64 {
+    self.display_lists + self.images + self.fonts + self.gpu_cache + self.other
+  }
+
+  /// The memory on the GPU side, which is system memory as well on integrated GPUs.
+  #[must_use]
+  pub fn gpu(&self) -> u64 {
+    self.texture_cache_textures + self.render_target_textures + self.other_textures
+  }
+}
+
+impl From<MemoryReport> for RenderMemoryReport {
+  fn from(report: MemoryReport) -> Self {
+    let bytes = |sizes: &[usize]| sizes.iter().sum::<usize>() as u64;
+
+    Self {
+      display_lists: bytes(&[report.display_list]),
+      images: bytes(&[report.images, report.rasterized_blobs]),
+      fonts: bytes(&[report.fonts]),
+      gpu_cache: bytes(&[report.gpu_cache_metadata, report.gpu_cache_cpu_mirror]),
+      other: bytes(&[
+        report.clip_stores,
+        report.render_tasks,
+        report.hit_testers,
+        report.shader_cache,
+      ]),
+      texture_cache_textures: bytes(&[report.texture_cache_textures]),
+      render_target_textures: bytes(&[report.render_target_textures, report.depth_target_textures]),
+      other_textures: bytes(&[
+        report.gpu_cache_textures,
+        report.vertex_data_textures,
+        report.swap_chain,
+      ]),
+    }
+  }
+}
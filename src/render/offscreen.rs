@@ -0,0 +1,165 @@
+use std::{ptr, rc::Rc};
+
+use gleam::gl::{self, Gl};
+use webrender::api::units::DeviceIntSize;
+
+const BYTES_PER_PIXEL: usize = 4;
+
+/// A framebuffer WebRender draws into instead of the window's.
+///
+/// WebRender renders into whatever framebuffer is bound when a frame starts, so binding
+/// this before compositing is all it takes.
+pub(crate) struct OffscreenTarget {
+  gl: Rc<dyn Gl>,
+  fbo: gl::GLuint,
+  color: gl::GLuint,
+  depth: gl::GLuint,
+}
+
+impl OffscreenTarget {
+  pub fn new(gl: Rc<dyn Gl>, size: DeviceIntSize) -> Self {
+    let fbo = gl.gen_framebuffers(1)[0];
+    let renderbuffers = gl.gen_renderbuffers(2);
+
+    let target = Self {
+      gl,
+      fbo,
+      color: renderbuffers[0],
+      depth: renderbuffers[1],
+    };
+    target.resize(size);
+    target
+  }
+
+  pub fn resize(&self, size: DeviceIntSize) {
+    let gl = &self.gl;
+
+    gl.bind_renderbuffer(gl::RENDERBUFFER, self.color);
+    gl.renderbuffer_storage(gl::RENDERBUFFER, gl::RGBA8, size.width, size.height);
+    gl.bind_renderbuffer(gl::RENDERBUFFER, self.depth);
+    gl.renderbuffer_storage(gl::RENDERBUFFER, gl::DEPTH_COMPONENT24, size.width, size.height);
+    gl.bind_renderbuffer(gl::RENDERBUFFER, 0);
+
+    gl.bind_framebuffer(gl::FRAMEBUFFER, self.fbo);
+    gl.framebuffer_renderbuffer(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0, gl::RENDERBUFFER, self.color);
+    gl.framebuffer_renderbuffer(gl::FRAMEBUFFER, gl::DEPTH_ATTACHMENT, gl::RENDERBUFFER, self.depth);
+    assert_eq!(
+      gl.check_frame_buffer_status(gl::FRAMEBUFFER),
+      gl::FRAMEBUFFER_COMPLETE,
+      "the offscreen framebuffer is incomplete"
+    );
+    gl.bind_framebuffer(gl::FRAMEBUFFER, 0);
+  }
+
+  pub fn bind(&self) {
+    self.gl.bind_framebuffer(gl::FRAMEBUFFER, self.fbo);
+  }
+
+  /// Starts copying the current contents of the framebuffer into a pixel buffer object,
+  /// without waiting for the GPU.
+  pub fn read_pixels(&self, size: DeviceIntSize) -> Readback {
+    let gl = &self.gl;
+    let len = size.width as usize * size.height as usize * BYTES_PER_PIXEL;
+
+    let pbo = gl.gen_buffers(1)[0];
+    gl.bind_buffer(gl::PIXEL_PACK_BUFFER, pbo);
+    gl.buffer_data_untyped(gl::PIXEL_PACK_BUFFER, len as _, ptr::null(), gl::STREAM_READ);
+
+    gl.bind_framebuffer(gl::READ_FRAMEBUFFER, self.fbo);
+    gl.pixel_store_i(gl::PACK_ALIGNMENT, 1);
+    gl.read_pixels_into_pbo(0, 0, size.width, size.height, gl::RGBA, gl::UNSIGNED_BYTE);
+    let fence = gl.fence_sync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Make sure the fence gets to the GPU, otherwise waiting on it could block forever.
+    gl.flush();
+
+    gl.bind_buffer(gl::PIXEL_PACK_BUFFER, 0);
+    gl.bind_framebuffer(gl::READ_FRAMEBUFFER, 0);
+
+    Readback {
+      gl: Rc::clone(gl),
+      pbo,
+      fence,
+      size,
+    }
+  }
+}
+
+impl Drop for OffscreenTarget {
+  fn drop(&mut self) {
+    self.gl.delete_framebuffers(&[self.fbo]);
+    self.gl.delete_renderbuffers(&[self.color, self.depth]);
+  }
+}
+
+/// Pixels being copied out of an offscreen frame.
+///
+/// The copy runs on the GPU in the background, so several snapshots can be in flight
+/// while the next document is styled and laid out. It must be used and dropped on
+/// the thread (and with the GL context) of the renderer that created it.
+#[doc = "module=render"]
+pub struct Readback {
+  gl: Rc<dyn Gl>,
+  pbo: gl::GLuint,
+  fence: gl::GLsync,
+  size: DeviceIntSize,
+}
+
+impl Readback {
+  #[must_use]
+  pub fn size(&self) -> DeviceIntSize {
+    self.size
+  }
+
+  /// Returns how many bytes `read_into` needs, pixels are 8 bit RGBA.
+  #[must_use]
+  pub fn len(&self) -> usize {
+    self.size.width as usize * self.size.height as usize * BYTES_PER_PIXEL
+  }
+
+  #[must_use]
+  pub fn is_empty(&self) -> bool {
+    self.len() == 0
+  }
+
+  /// Returns true if the GPU has finished the copy, so `read_into` won't block.
+  #[must_use]
+  pub fn is_ready(&self) -> bool {
+    let status = self.gl.client_wait_sync(self.fence, 0, 0);
+    status == gl::ALREADY_SIGNALED || status == gl::CONDITION_SATISFIED
+  }
+
+  /// Copies the pixels into `buffer`, top row first, waiting for the GPU if needed.
+  ///
+  /// Panics if `buffer` is shorter than `len`.
+  pub fn read_into(&self, buffer: &mut [u8]) {
+    let len = self.len();
+    assert!(buffer.len() >= len, "the buffer is too small for the snapshot");
+    if len == 0 {
+      return;
+    }
+
+    let gl = &self.gl;
+    gl.client_wait_sync(self.fence, gl::SYNC_FLUSH_COMMANDS_BIT, gl::TIMEOUT_IGNORED);
+
+    gl.bind_buffer(gl::PIXEL_PACK_BUFFER, self.pbo);
+    let data = gl.map_buffer_range(gl::PIXEL_PACK_BUFFER, 0, len as _, gl::MAP_READ_BIT) as *const u8;
+    assert!(!data.is_null(), "the pixel buffer couldn't be mapped");
+
+    // GL rows start at the bottom.
+    let stride = self.size.width as usize * BYTES_PER_PIXEL;
+    let pixels = unsafe { std::slice::from_raw_parts(data, len) };
+    for (row, dest) in pixels.chunks_exact(stride).rev().zip(buffer.chunks_exact_mut(stride)) {
+      dest.copy_from_slice(row);
+    }
+
+    gl.unmap_buffer(gl::PIXEL_PACK_BUFFER);
+    gl.bind_buffer(gl::PIXEL_PACK_BUFFER, 0);
+  }
+}
+
+impl Drop for Readback {
+  fn drop(&mut self) {
+    self.gl.delete_sync(self.fence);
+    self.gl.delete_buffers(&[self.pbo]);
+  }
+}
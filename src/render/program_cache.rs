@@ -0,0 +1,121 @@
+use std::{
+  fs,
+  io::{self, BufReader, BufWriter},
+  path::{Path, PathBuf},
+  rc::Rc,
+  sync::Arc,
+};
+
+use gleam::gl::{self, Gl};
+use log::warn;
+use webrender::{ProgramBinary, ProgramCache, ProgramCacheObserver, ProgramSourceDigest};
+
+/// The file that lists the programs needed for the first frames.
+const STARTUP_FILE: &str = "startup";
+
+/// A stable hash (unlike `DefaultHasher`), so cache directories survive toolchain updates.
+fn fnv1a(bytes: &[u8]) -> u64 {
+  bytes.iter().fold(0xcbf2_9ce4_8422_2325, |hash, &byte| {
+    (hash ^ u64::from(byte)).wrapping_mul(0x0100_0000_01b3)
+  })
+}
+
+/// Stores program binaries in a directory, one file per program.
+///
+/// Binaries only work with the driver that produced them, so every vendor/renderer/version
+/// combination gets its own subdirectory. Errors are logged and otherwise ignored, a broken
+/// cache only means shaders get compiled again.
+#[derive(Clone)]
+struct DiskCache {
+  dir: PathBuf,
+}
+
+impl DiskCache {
+  fn path(&self, digest: &ProgramSourceDigest) -> PathBuf {
+    self.dir.join(format!("{}.bin", digest))
+  }
+
+  fn read(path: &Path) -> io::Result<ProgramBinary> {
+    let reader = BufReader::new(fs::File::open(path)?);
+    bincode::deserialize_from(reader).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))
+  }
+
+  fn write(&self, binary: &ProgramBinary) -> io::Result<()> {
+    let path = self.path(binary.source_digest());
+    // Write to a temporary file first so a crash never leaves a truncated binary behind.
+    let tmp = path.with_extension("tmp");
+    let writer = BufWriter::new(fs::File::create(&tmp)?);
+    bincode::serialize_into(writer, binary).map_err(|e| io::Error::new(io::ErrorKind::Other, e))?;
+    fs::rename(tmp, path)
+  }
+
+  /// Loads every program that was needed to start up last time into `cache`.
+  fn load_startup_programs(&self, cache: &Rc<ProgramCache>) {
+    let startup = match fs::read_to_string(self.dir.join(STARTUP_FILE)) {
+      Ok(startup) => startup,
+      Err(_) => return,
+    };
+
+    for name in startup.lines() {
+      match Self::read(&self.dir.join(name)) {
+        Ok(binary) => cache.load_program_binary(Arc::new(binary)),
+        Err(e) => warn!("couldn't load cached program {}: {}", name, e),
+      }
+    }
+  }
+}
+
+impl ProgramCacheObserver for DiskCache {
+  fn save_shaders_to_disk(&self, entries: Vec<Arc<ProgramBinary>>) {
+    for binary in entries {
+      if let Err(e) = self.write(&binary) {
+        warn!("couldn't save program {}: {}", binary.source_digest(), e);
+      }
+    }
+  }
+
+  fn set_startup_shaders(&self, entries: Vec<Arc<ProgramBinary>>) {
+    let startup: String = entries
+      .iter()
+      .map(|binary| format!("{}.bin\n", binary.source_digest()))
+      .collect();
+
+    if let Err(e) = fs::write(self.dir.join(STARTUP_FILE), startup) {
+      warn!("couldn't save the startup program list: {}", e);
+    }
+  }
+
+  fn try_load_shader_from_disk(&self, digest: &ProgramSourceDigest, program_cache: &Rc<ProgramCache>) {
+    if let Ok(binary) = Self::read(&self.path(digest)) {
+      program_cache.load_program_binary(Arc::new(binary));
+    }
+  }
+
+  fn notify_program_binary_failed(&self, binary: &Arc<ProgramBinary>) {
+    // Most likely a driver update that kept the same version string.
+    let _ = fs::remove_file(self.path(binary.source_digest()));
+  }
+}
+
+/// Creates a program cache backed by a subdirectory of `dir` for the current driver.
+///
+/// Returns `None` if the directory can't be created, shaders are then compiled every launch.
+pub(crate) fn open(gl: &dyn Gl, dir: &Path) -> Option<Rc<ProgramCache>> {
+  let driver = format!(
+    "{}\n{}\n{}",
+    gl.get_string(gl::VENDOR),
+    gl.get_string(gl::RENDERER),
+    gl.get_string(gl::VERSION)
+  );
+  let dir = dir.join(format!("{:016x}", fnv1a(driver.as_bytes())));
+
+  if let Err(e) = fs::create_dir_all(&dir) {
+    warn!("couldn't create the program cache in {}: {}", dir.display(), e);
+    return None;
+  }
+
+  let disk = DiskCache { dir };
+  let cache = ProgramCache::new(Some(Box::new(disk.clone())));
+  disk.load_startup_programs(&cache);
+  Some(cache)
+}
@@ -184,6 +184,19 @@ impl Compiled<'_> {
     let c_str = CStr::from_ptr(sys::sass_context_get_source_map_string(self.ctx));
     Ok(c_str.to_str()?.to_string())
   }
+
+  /// Returns every file that was read while compiling, including the input file.
+  pub fn included_files(&self) -> Result<Vec<String>, Utf8Error> {
+    let mut files = Vec::new();
+    unsafe {
+      let mut file = sys::sass_context_get_included_files(self.ctx);
+      while !file.is_null() && !(*file).is_null() {
+        files.push(CStr::from_ptr(*file).to_str()?.to_string());
+        file = file.add(1);
+      }
+    }
+    Ok(files)
+  }
 }
 
 #[derive(Debug)]
@@ -0,0 +1,198 @@
+use std::{
+  collections::{hash_map::DefaultHasher, HashMap},
+  fmt,
+  hash::{Hash, Hasher},
+  sync::{
+    atomic::{AtomicU32, Ordering},
+    RwLock,
+  },
+};
+
+use once_cell::sync::{Lazy, OnceCell};
+use serde::{de, Deserialize, Deserializer, Serialize, Serializer};
+
+/// An interned string, used for class names, ids and local names so selector
+/// matching is an integer comparison.
+///
+/// The table is shared by every document in the process, selectors creates identifiers
+/// with `From<&str>` while parsing so there is no way to thread a per-document table
+/// through it. Atoms are never freed, scripts that generate a new class or id every frame
+/// will grow the table.
+///
+/// The table holds `MAX_ATOMS` strings. Once it is full `try_new` returns `None` for new
+/// strings and `From<&str>` returns a placeholder that has no string, which selectors can
+/// hold but that never matches an element, see `try_new`.
+#[derive(Copy, Clone, PartialEq, Eq, PartialOrd, Ord)]
+pub struct Atom(u32);
+
+/// The strings of every atom, by index, in chunks that are allocated as the table grows.
+///
+/// A slot is written once, before its atom is handed out, so `as_str` reads it without locking.
+/// That also means a string never moves, the shards below borrow it for the life of the process.
+const CHUNK_LEN: usize = 1024;
+const MAX_CHUNKS: usize = 4096;
+/// How many different strings can be interned in a process.
+pub const MAX_ATOMS: usize = CHUNK_LEN * MAX_CHUNKS;
+type Chunk = Box<[OnceCell<Box<str>>]>;
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_CHUNK: OnceCell<Chunk> = OnceCell::new();
+static STRINGS: [OnceCell<Chunk>; MAX_CHUNKS] = [EMPTY_CHUNK; MAX_CHUNKS];
+static NEXT: AtomicU32 = AtomicU32::new(0);
+
+/// What `From<&str>` returns once the table is full. Its index is past the last chunk.
+const OVERFLOW: Atom = Atom(u32::MAX);
+
+/// Atoms by string, split by hash so interning on different threads rarely waits on the same lock.
+const SHARDS: usize = 16;
+static ATOMS: Lazy<Vec<RwLock<HashMap<&'static str, Atom>>>> =
+  Lazy::new(|| (0..SHARDS).map(|_| RwLock::default()).collect());
+
+fn shard(s: &str) -> &'static RwLock<HashMap<&'static str, Atom>> {
+  let mut hasher = DefaultHasher::new();
+  s.hash(&mut hasher);
+  &ATOMS[hasher.finish() as usize % SHARDS]
+}
+
+fn slot(index: u32) -> Option<&'static OnceCell<Box<str>>> {
+  let index = index as usize;
+  let chunk = STRINGS
+    .get(index / CHUNK_LEN)?
+    .get_or_init(|| (0..CHUNK_LEN).map(|_| OnceCell::new()).collect());
+  Some(&chunk[index % CHUNK_LEN])
+}
+
+impl Atom {
+  /// Returns the atom for `s`, interning it if it hasn't been yet, or `None` if the table is full.
+  ///
+  /// Elements intern their classes and ids with this and leave out the ones that don't fit.
+  /// Selectors parsed once the table is full hold placeholders for new strings, so neither
+  /// side matches a string that didn't fit, and the strings that did keep matching each other.
+  #[must_use]
+  pub fn try_new(s: &str) -> Option<Self> {
+    let shard = shard(s);
+    if let Some(&atom) = shard.read().unwrap().get(s) {
+      return Some(atom);
+    }
+
+    let mut atoms = shard.write().unwrap();
+    // Someone else may have interned it between the two locks.
+    if let Some(&atom) = atoms.get(s) {
+      return Some(atom);
+    }
+
+    let index = NEXT
+      .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |next| {
+        if (next as usize) < MAX_ATOMS {
+          Some(next + 1)
+        } else {
+          None
+        }
+      })
+      .ok()?;
+    let slot = slot(index).unwrap();
+    slot.set(s.into()).expect("atom slots are only written once");
+    atoms.insert(slot.get().unwrap(), Atom(index));
+    Some(Atom(index))
+  }
+
+  /// The string of the atom, or `""` for a placeholder from a full table.
+  #[must_use]
+  pub fn as_str(self) -> &'static str {
+    slot(self.0).and_then(OnceCell::get).map_or("", |s| s)
+  }
+
+  /// Returns the atom for `s` if it has already been interned.
+  ///
+  /// A string that was never interned can't be equal to any atom, so this is
+  /// useful for lookups that shouldn't grow the table.
+  #[must_use]
+  pub fn lookup(s: &str) -> Option<Self> {
+    shard(s).read().unwrap().get(s).copied()
+  }
+
+  /// Compares two atoms ignoring ASCII case.
+  #[must_use]
+  pub fn eq_ignore_ascii_case(self, other: Self) -> bool {
+    self == other || (self != OVERFLOW && other != OVERFLOW && self.as_str().eq_ignore_ascii_case(other.as_str()))
+  }
+}
+
+impl From<&str> for Atom {
+  /// Like `try_new`, but returns a placeholder instead of `None` once the table is full.
+  fn from(s: &str) -> Self {
+    Self::try_new(s).unwrap_or(OVERFLOW)
+  }
+}
+
+impl From<String> for Atom {
+  fn from(s: String) -> Self {
+    Self::from(s.as_str())
+  }
+}
+
+impl Hash for Atom {
+  fn hash<H: Hasher>(&self, state: &mut H) {
+    state.write_u32(self.0);
+  }
+}
+
+impl precomputed_hash::PrecomputedHash for Atom {
+  fn precomputed_hash(&self) -> u32 {
+    self.0
+  }
+}
+
+impl fmt::Debug for Atom {
+  fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+    write!(f, "Atom({:?})", self.as_str())
+  }
+}
+
+impl fmt::Display for Atom {
+  fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+    f.write_str(self.as_str())
+  }
+}
+
+impl cssparser::ToCss for Atom {
+  fn to_css<W>(&self, dest: &mut W) -> fmt::Result
+  where
+    W: fmt::Write,
+  {
+    cssparser::serialize_identifier(self.as_str(), dest)
+  }
+}
+
+impl Default for Atom {
+  fn default() -> Self {
+    Self::from("")
+  }
+}
+
+// The index of an atom is only meaningful inside of this process, so atoms are
+// stored as their string and interned again when they are loaded.
+impl Serialize for Atom {
+  fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+    serializer.serialize_str(self.as_str())
+  }
+}
+
+impl<'de> Deserialize<'de> for Atom {
+  fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+    struct Visitor;
+
+    impl<'de> de::Visitor<'de> for Visitor {
+      type Value = Atom;
+
+      fn expecting(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str("a string")
+      }
+
+      fn visit_str<E: de::Error>(self, v: &str) -> Result<Atom, E> {
+        Ok(Atom::from(v))
+      }
+    }
+
+    deserializer.deserialize_str(Visitor)
+  }
+}
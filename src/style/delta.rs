@@ -0,0 +1,177 @@
+use std::{collections::HashMap, sync::RwLock};
+
+use serde::{Deserialize, Serialize};
+
+use super::{ComputedStyle, Declaration};
+
+bitflags::bitflags! {
+  /// The fields of a `ComputedStyle` a `StyleDelta` sets.
+  #[derive(Default, Serialize, Deserialize)]
+  pub struct Fields: u8 {
+    const WIDTH = 1;
+    const HEIGHT = 2;
+    const BACKGROUND_COLOR = 4;
+    const MARGIN_TOP = 8;
+    const MARGIN_BOTTOM = 16;
+    const MARGIN_LEFT = 32;
+    const MARGIN_RIGHT = 64;
+    const OVERFLOW = 128;
+  }
+}
+
+/// The declarations of one or more rules flattened into the fields they set.
+///
+/// Applying a delta is a masked copy of `values` rather than a dispatch on every declaration,
+/// and deltas merge into deltas, so a run of rules applies like a single one.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Serialize, Deserialize)]
+pub struct StyleDelta {
+  pub fields: Fields,
+  /// The values of `fields`, the other fields are left at their defaults.
+  pub values: ComputedStyle,
+}
+
+impl StyleDelta {
+  /// Flattens `declarations`, later ones win like in the cascade.
+  #[must_use]
+  pub fn new(declarations: &[Declaration]) -> Self {
+    let mut delta = Self::default();
+    for declaration in declarations {
+      declaration.apply(&mut delta.values);
+      delta.fields |= declaration.field();
+    }
+    delta
+  }
+
+  /// Applies `other` on top of this delta, the result applies like both of them in order.
+  pub fn merge(&mut self, other: &Self) {
+    other.apply(&mut self.values);
+    self.fields |= other.fields;
+  }
+
+  #[inline]
+  pub fn apply(&self, computed: &mut ComputedStyle) {
+    let (fields, values) = (self.fields, &self.values);
+    if fields.contains(Fields::WIDTH) {
+      computed.width = values.width;
+    }
+    if fields.contains(Fields::HEIGHT) {
+      computed.height = values.height;
+    }
+    if fields.contains(Fields::BACKGROUND_COLOR) {
+      computed.background_color = values.background_color;
+    }
+    if fields.contains(Fields::MARGIN_TOP) {
+      computed.margin_top = values.margin_top;
+    }
+    if fields.contains(Fields::MARGIN_BOTTOM) {
+      computed.margin_bottom = values.margin_bottom;
+    }
+    if fields.contains(Fields::MARGIN_LEFT) {
+      computed.margin_left = values.margin_left;
+    }
+    if fields.contains(Fields::MARGIN_RIGHT) {
+      computed.margin_right = values.margin_right;
+    }
+    if fields.contains(Fields::OVERFLOW) {
+      computed.overflow = values.overflow;
+    }
+  }
+}
+
+/// Stops a stylesheet with many distinct combinations of matching rules from growing the cache forever.
+const MAX_MERGED_DELTAS: usize = 4096;
+
+/// The merged deltas of sets of rules that matched an element, keyed by their indices.
+///
+/// Elements that match the same rules (siblings, list items, repeated components) apply one
+/// cached delta instead of one per rule. Clones start out empty.
+#[derive(Debug, Default)]
+pub(crate) struct MergedDeltas(RwLock<HashMap<Box<[u32]>, StyleDelta>>);
+
+impl Clone for MergedDeltas {
+  fn clone(&self) -> Self {
+    Self::default()
+  }
+}
+
+impl MergedDeltas {
+  /// Returns the merged delta of `rules`, calling `merge` to compute it the first time.
+  pub fn get_or_merge<F: FnOnce() -> StyleDelta>(&self, rules: &[u32], merge: F) -> StyleDelta {
+    if let Some(&delta) = self.0.read().unwrap().get(rules) {
+      return delta;
+    }
+
+    let delta = merge();
+    let mut merged = self.0.write().unwrap();
+    if merged.len() >= MAX_MERGED_DELTAS {
+      merged.clear();
+    }
+    merged.insert(rules.into(), delta);
+    delta
+  }
+
+  /// Forgets every merged delta, for when rule indices change.
+  pub fn clear(&mut self) {
+    *self.0.get_mut().unwrap() = HashMap::new();
+  }
+
+  /// An estimate of the memory the cache allocated, in bytes.
+  pub fn allocated_bytes(&self) -> usize {
+    let merged = self.0.read().unwrap();
+    merged.capacity() * std::mem::size_of::<(Box<[u32]>, StyleDelta)>()
+      + merged
+        .keys()
+        .map(|rules| rules.len() * std::mem::size_of::<u32>())
+        .sum::<usize>()
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+
+  fn delta(declarations: &[Declaration]) -> StyleDelta {
+    StyleDelta::new(declarations)
+  }
+
+  #[test]
+  fn merge_applies_later_deltas_on_top() {
+    let mut merged = delta(&[
+      Declaration::BackgroundColor(255, 0, 0, 255),
+      Declaration::Width(yoga::Value::Px(1.0)),
+    ]);
+    merged.merge(&delta(&[Declaration::BackgroundColor(0, 0, 255, 255)]));
+
+    let mut computed = ComputedStyle::default();
+    merged.apply(&mut computed);
+    assert_eq!(computed.background_color, (0, 0, 255, 255));
+    assert_eq!(computed.width, yoga::Value::Px(1.0));
+    assert_eq!(merged.fields, Fields::BACKGROUND_COLOR | Fields::WIDTH);
+  }
+
+  #[test]
+  fn merged_deltas_are_cached_by_rules() {
+    let red = delta(&[Declaration::BackgroundColor(255, 0, 0, 255)]);
+    let blue = delta(&[Declaration::BackgroundColor(0, 0, 255, 255)]);
+
+    let mut cache = MergedDeltas::default();
+    assert_eq!(cache.get_or_merge(&[0, 1], || red), red);
+    assert_eq!(cache.get_or_merge(&[0, 1], || unreachable!()), red);
+    // The same rules in another order are another cascade.
+    assert_eq!(cache.get_or_merge(&[1, 0], || blue), blue);
+
+    cache.clear();
+    assert_eq!(cache.get_or_merge(&[0, 1], || blue), blue);
+  }
+
+  #[test]
+  fn merged_deltas_start_over_when_full() {
+    let red = delta(&[Declaration::BackgroundColor(255, 0, 0, 255)]);
+    let cache = MergedDeltas::default();
+    for i in 0..MAX_MERGED_DELTAS as u32 {
+      cache.get_or_merge(&[i], || red);
+    }
+    cache.get_or_merge(&[u32::MAX], || red);
+    assert_eq!(cache.0.read().unwrap().len(), 1);
+  }
+}
@@ -0,0 +1,196 @@
+use std::collections::HashMap;
+
+use selectors::{
+  parser::{Component, Selector},
+  SelectorList,
+};
+use serde::{Deserialize, Serialize};
+
+use crate::{selectors::SelectorImpl, Atom};
+
+/// The parts of an element the `RuleIndex` is keyed on.
+#[derive(Debug, Copy, Clone)]
+pub struct RuleKeys<'a> {
+  pub id: Option<Atom>,
+  pub classes: &'a [Atom],
+  pub local_name: Atom,
+}
+
+/// An element that can be looked up in a `RuleIndex`.
+pub trait TElement: ::selectors::Element<Impl = SelectorImpl> {
+  fn with_rule_keys<R, F: FnOnce(RuleKeys<'_>) -> R>(&self, callback: F) -> R;
+}
+
+/// Buckets rules by the id, class or local name of the rightmost compound selector,
+/// so only rules that could possibly match an element have to be tested against it.
+///
+/// Each selector is only put in one bucket, preferring the most specific key. Selectors
+/// without any of those keys end up in the universal bucket and are tested against everything.
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+pub struct RuleIndex {
+  ids: HashMap<Atom, Vec<u32>>,
+  classes: HashMap<Atom, Vec<u32>>,
+  local_names: HashMap<Atom, Vec<u32>>,
+  universal: Vec<u32>,
+  /// Whether each rule has a selector that depends on siblings or children, see `is_sibling_sensitive`.
+  sibling_sensitive: Vec<bool>,
+}
+
+enum Bucket {
+  Id(Atom),
+  Class(Atom),
+  LocalName(Atom),
+  Universal,
+}
+
+fn bucket_for(selector: &Selector<SelectorImpl>) -> Bucket {
+  let mut bucket = Bucket::Universal;
+
+  // `iter` only walks the rightmost compound selector.
+  for component in selector.iter() {
+    match component {
+      Component::ID(id) => return Bucket::Id(*id),
+      Component::Class(class) => bucket = Bucket::Class(*class),
+      Component::LocalName(name) => {
+        if let Bucket::Universal = bucket {
+          bucket = Bucket::LocalName(name.name);
+        }
+      }
+      _ => {}
+    }
+  }
+
+  bucket
+}
+
+/// Returns true if matching `selector` against an element depends on its siblings or
+/// children, rather than only on the element itself and its ancestors.
+fn selector_is_sibling_sensitive(selector: &Selector<SelectorImpl>) -> bool {
+  selector.iter_raw_match_order().any(component_is_sibling_sensitive)
+}
+
+fn component_is_sibling_sensitive(component: &Component<SelectorImpl>) -> bool {
+  match component {
+    Component::Combinator(combinator) => combinator.is_sibling(),
+    Component::Negation(inner) => inner.iter().any(component_is_sibling_sensitive),
+    Component::FirstChild
+    | Component::LastChild
+    | Component::OnlyChild
+    | Component::Root
+    | Component::Empty
+    | Component::NthChild(..)
+    | Component::NthLastChild(..)
+    | Component::NthOfType(..)
+    | Component::NthLastOfType(..)
+    | Component::FirstOfType
+    | Component::LastOfType
+    | Component::OnlyOfType => true,
+    _ => false,
+  }
+}
+
+impl RuleIndex {
+  #[must_use]
+  pub fn new() -> Self {
+    Self::default()
+  }
+
+  /// Adds the rule at `index` with `selectors` to the index.
+  pub fn insert(&mut self, index: usize, selectors: &SelectorList<SelectorImpl>) {
+    if self.sibling_sensitive.len() <= index {
+      self.sibling_sensitive.resize(index + 1, false);
+    }
+    self.sibling_sensitive[index] = selectors.0.iter().any(selector_is_sibling_sensitive);
+
+    let index = index as u32;
+    for selector in selectors.0.iter() {
+      let entries = match bucket_for(selector) {
+        Bucket::Id(id) => self.ids.entry(id).or_default(),
+        Bucket::Class(class) => self.classes.entry(class).or_default(),
+        Bucket::LocalName(name) => self.local_names.entry(name).or_default(),
+        Bucket::Universal => &mut self.universal,
+      };
+
+      // A rule can have several selectors that land in the same bucket.
+      if entries.last() != Some(&index) {
+        entries.push(index);
+      }
+    }
+  }
+
+  /// Adds the rules of `other` as if they came after the first `offset` rules of this index.
+  pub fn append(&mut self, other: RuleIndex, offset: u32) {
+    fn extend(entries: &mut Vec<u32>, other: Vec<u32>, offset: u32) {
+      entries.extend(other.into_iter().map(|index| index + offset));
+    }
+
+    for (id, rules) in other.ids {
+      extend(self.ids.entry(id).or_default(), rules, offset);
+    }
+    for (class, rules) in other.classes {
+      extend(self.classes.entry(class).or_default(), rules, offset);
+    }
+    for (name, rules) in other.local_names {
+      extend(self.local_names.entry(name).or_default(), rules, offset);
+    }
+    extend(&mut self.universal, other.universal, offset);
+
+    // Rules that were never inserted count as sibling sensitive, see `is_sibling_sensitive`.
+    self.sibling_sensitive.resize(offset as usize, true);
+    self.sibling_sensitive.extend(other.sibling_sensitive);
+  }
+
+  /// Returns true if the rule at `index` has a selector that depends on an element's siblings or children.
+  ///
+  /// Elements with the same parent, local name, id and classes always get the same candidates,
+  /// so if none of those are sibling sensitive they are guaranteed to match the same rules.
+  #[must_use]
+  pub fn is_sibling_sensitive(&self, index: u32) -> bool {
+    self.sibling_sensitive.get(index as usize).copied().unwrap_or(true)
+  }
+
+  /// Returns true if any rule is sibling sensitive, so a change to an element can change which
+  /// rules its later siblings match.
+  #[must_use]
+  pub fn has_sibling_sensitive(&self) -> bool {
+    self.sibling_sensitive.contains(&true)
+  }
+
+  /// Collects the indices of every rule that could match an element with `keys`, in rule order.
+  pub fn candidates(&self, keys: RuleKeys<'_>, out: &mut Vec<u32>) {
+    out.clear();
+    out.extend_from_slice(&self.universal);
+
+    if let Some(rules) = keys.id.and_then(|id| self.ids.get(&id)) {
+      out.extend_from_slice(rules);
+    }
+
+    for class in keys.classes {
+      if let Some(rules) = self.classes.get(class) {
+        out.extend_from_slice(rules);
+      }
+    }
+
+    if let Some(rules) = self.local_names.get(&keys.local_name) {
+      out.extend_from_slice(rules);
+    }
+
+    out.sort_unstable();
+    out.dedup();
+  }
+
+  /// An estimate of the memory the index allocated, in bytes.
+  #[must_use]
+  pub fn allocated_bytes(&self) -> usize {
+    let bucket = |rules: &Vec<u32>| rules.capacity() * std::mem::size_of::<u32>();
+    let map = |map: &HashMap<Atom, Vec<u32>>| {
+      map.capacity() * std::mem::size_of::<(Atom, Vec<u32>)>() + map.values().map(bucket).sum::<usize>()
+    };
+
+    map(&self.ids)
+      + map(&self.classes)
+      + map(&self.local_names)
+      + bucket(&self.universal)
+      + self.sibling_sensitive.capacity()
+  }
+}
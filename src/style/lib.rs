@@ -1,7 +1,19 @@
+use cssparser::ToCss;
+use once_cell::sync::OnceCell;
 use serde::{Deserialize, Serialize};
 
+pub mod atom;
+pub mod delta;
+pub mod index;
 pub mod parser;
 pub mod selectors;
+pub mod strings;
+
+pub use atom::Atom;
+use delta::MergedDeltas;
+pub use delta::{Fields, StyleDelta};
+pub use index::{RuleIndex, RuleKeys, TElement};
+pub use strings::{StrRef, StringTable};
 
 #[derive(Debug, Copy, Clone, PartialEq)]
 pub struct RenderStyle {
@@ -10,6 +22,7 @@ pub struct RenderStyle {
   pub top: f32,
   pub left: f32,
   pub background_color: (u8, u8, u8, u8),
+  pub overflow: Overflow,
 }
 
 impl Default for RenderStyle {
@@ -20,11 +33,33 @@ impl Default for RenderStyle {
       top: f32::NAN,
       left: f32::NAN,
       background_color: (0, 0, 0, 0),
+      overflow: Overflow::Visible,
     }
   }
 }
 
-#[derive(Debug, Copy, Clone, PartialEq)]
+/// What happens to children that don't fit in an element.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Serialize, Deserialize)]
+pub enum Overflow {
+  /// Children are drawn outside the element.
+  Visible,
+  /// Children are clipped to the element.
+  Hidden,
+  /// Children are clipped to the element, which can be scrolled to show the rest of them.
+  Scroll,
+}
+
+impl From<Overflow> for yoga::Overflow {
+  fn from(overflow: Overflow) -> Self {
+    match overflow {
+      Overflow::Visible => Self::Visible,
+      Overflow::Hidden => Self::Hidden,
+      Overflow::Scroll => Self::Scroll,
+    }
+  }
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Serialize, Deserialize)]
 pub struct ComputedStyle {
   pub width: yoga::Value,
   pub height: yoga::Value,
@@ -33,6 +68,22 @@ pub struct ComputedStyle {
   pub margin_bottom: yoga::Value,
   pub margin_left: yoga::Value,
   pub margin_right: yoga::Value,
+  pub overflow: Overflow,
+}
+
+impl ComputedStyle {
+  /// Returns true if any property that feeds into yoga (or the structure of the display list) differs
+  /// between the two styles.
+  #[must_use]
+  pub fn layout_differs(&self, other: &Self) -> bool {
+    self.width != other.width
+      || self.height != other.height
+      || self.margin_top != other.margin_top
+      || self.margin_bottom != other.margin_bottom
+      || self.margin_left != other.margin_left
+      || self.margin_right != other.margin_right
+      || self.overflow != other.overflow
+  }
 }
 
 impl Default for ComputedStyle {
@@ -45,6 +96,7 @@ impl Default for ComputedStyle {
       margin_bottom: yoga::Value::Px(0.0),
       margin_left: yoga::Value::Px(0.0),
       margin_right: yoga::Value::Px(0.0),
+      overflow: Overflow::Visible,
     }
   }
 }
@@ -55,15 +107,26 @@ pub type Error<'i> = (
   &'i str,
 );
 
+/// Below this many matching rules applying their deltas one by one is cheaper than looking up the merged one.
+const MERGE_THRESHOLD: usize = 3;
+
 #[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct StyleSheet {
+  /// The rules in the order they are applied, see `sort_by_specificity`.
   pub rules: Vec<StyleRule>,
+  pub index: RuleIndex,
+  #[serde(skip)]
+  merged: MergedDeltas,
 }
 
 impl StyleSheet {
   #[must_use]
   pub fn new() -> Self {
-    Self { rules: Vec::new() }
+    Self {
+      rules: Vec::new(),
+      index: RuleIndex::new(),
+      merged: MergedDeltas::default(),
+    }
   }
 
   #[must_use]
@@ -76,23 +139,174 @@ impl StyleSheet {
     cssparser::ParserInput::new_with_line_number_offset(input, offset)
   }
 
-  pub fn parse<'i>(&mut self, input: &mut cssparser::ParserInput<'i>) -> Result<(), Error<'i>> {
+  /// Parses `input` and appends its rules, the selector source of each rule is stored in `strings`.
+  pub fn parse<'i>(
+    &mut self,
+    input: &mut cssparser::ParserInput<'i>,
+    strings: &mut StringTable,
+  ) -> Result<(), Error<'i>> {
     let mut parser = cssparser::Parser::new(input);
 
-    let rule_list_parser = cssparser::RuleListParser::new_for_stylesheet(&mut parser, parser::QualifiedRuleParser);
+    let rule_list_parser =
+      cssparser::RuleListParser::new_for_stylesheet(&mut parser, parser::QualifiedRuleParser { strings });
     for rule in rule_list_parser {
-      self.rules.push(rule?);
+      let rule = rule?;
+      self.index.insert(self.rules.len(), rule.parsed_selectors().unwrap());
+      self.rules.push(rule);
     }
 
+    self.merged.clear();
     Ok(())
   }
 
-  pub fn apply<E: ::selectors::Element<Impl = selectors::SelectorImpl>>(
+  /// Appends the rules of `other`, whose selector sources are in `other_strings`.
+  ///
+  /// Neither the selectors nor the index are rebuilt, so stylesheets can be parsed (or loaded
+  /// from a cache) separately and merged afterwards for about the cost of a copy.
+  pub fn append(&mut self, other: StyleSheet, other_strings: &StringTable, strings: &mut StringTable) {
+    let base = strings.push(other_strings.as_str());
+    self.index.append(other.index, self.rules.len() as u32);
+    self.rules.extend(other.rules.into_iter().map(|mut rule| {
+      rule.source = rule.source.rebase(base);
+      rule
+    }));
+    self.merged.clear();
+  }
+
+  /// Rebuilds the rule index, this only needs to be called after modifying `rules` directly.
+  pub fn rebuild_index(&mut self, strings: &StringTable) {
+    self.index = RuleIndex::new();
+    for (i, rule) in self.rules.iter().enumerate() {
+      self.index.insert(i, rule.selectors(strings));
+    }
+    self.merged.clear();
+  }
+
+  /// Puts the rules in cascade order, by specificity and then by source order.
+  ///
+  /// Matching rules are applied in rule order, so matching never has to sort. Every selector of a
+  /// list cascades on its own, so a rule whose selectors have different specificities is split
+  /// into one rule per selector, with its own source in `strings`.
+  pub fn sort_by_specificity(&mut self, strings: &mut StringTable) {
+    let mut rules = Vec::with_capacity(self.rules.len());
+    for rule in std::mem::take(&mut self.rules) {
+      let selectors = &rule.selectors(strings).0;
+      let specificity = selectors
+        .iter()
+        .map(|selector| selector.specificity())
+        .max()
+        .unwrap_or(0);
+      if selectors.iter().all(|selector| selector.specificity() == specificity) {
+        rules.push((specificity, rule));
+        continue;
+      }
+
+      let split: Vec<_> = selectors
+        .iter()
+        .map(|selector| (selector.specificity(), selector.to_css_string()))
+        .collect();
+      for (specificity, source) in split {
+        let source = strings.push(&source);
+        rules.push((
+          specificity,
+          StyleRule {
+            source,
+            selectors: OnceCell::new(),
+            delta: rule.delta,
+          },
+        ));
+      }
+    }
+
+    // Stable, so rules with the same specificity stay in source order.
+    rules.sort_by_key(|&(specificity, _)| specificity);
+    self.rules = rules.into_iter().map(|(_, rule)| rule).collect();
+    self.rebuild_index(strings);
+  }
+
+  /// Applies every matching rule to `computed`, counting the work done in `stats`.
+  ///
+  /// The deltas of the matching rules are merged once per distinct set of rules, elements that
+  /// match the same set apply the cached result.
+  ///
+  /// Returns false if any of the candidate rules is sibling sensitive, in which case the
+  /// result can't be shared with siblings that have the same local name, id and classes.
+  pub fn apply<E: TElement>(
     &self,
     element: &E,
     computed: &mut ComputedStyle,
-  ) {
-    self.rules.iter().for_each(|x| x.apply(element, computed));
+    strings: &StringTable,
+    stats: &mut MatchStats,
+  ) -> bool {
+    let mut candidates = Vec::new();
+    element.with_rule_keys(|keys| self.index.candidates(keys, &mut candidates));
+
+    let mut context = ::selectors::matching::MatchingContext::new(
+      ::selectors::matching::MatchingMode::Normal,
+      None,
+      None,
+      ::selectors::matching::QuirksMode::NoQuirks,
+    );
+
+    let mut shareable = true;
+    stats.rules_tested += candidates.len() as u32;
+    candidates.retain(|&i| {
+      // Rules that don't match this element can still match a sibling, so every candidate counts.
+      shareable &= !self.index.is_sibling_sensitive(i);
+      self.rules[i as usize].matches(element, &mut context, strings)
+    });
+    stats.rules_matched += candidates.len() as u32;
+
+    if candidates.len() < MERGE_THRESHOLD {
+      for &i in &candidates {
+        self.rules[i as usize].delta.apply(computed);
+      }
+    } else {
+      let delta = self.merged.get_or_merge(&candidates, || {
+        let mut delta = StyleDelta::default();
+        for &i in &candidates {
+          delta.merge(&self.rules[i as usize].delta);
+        }
+        delta
+      });
+      delta.apply(computed);
+    }
+
+    shareable
+  }
+
+  /// An estimate of the memory the stylesheet allocated, in bytes.
+  #[must_use]
+  pub fn allocated_bytes(&self) -> usize {
+    self.rules.capacity() * std::mem::size_of::<StyleRule>()
+      + self.rules.iter().map(StyleRule::allocated_bytes).sum::<usize>()
+      + self.index.allocated_bytes()
+      + self.merged.allocated_bytes()
+  }
+
+  /// Frees the parsed selectors and merged deltas, they are rebuilt the first time they are needed again.
+  pub fn trim(&mut self) {
+    for rule in &mut self.rules {
+      rule.trim();
+    }
+    self.rules.shrink_to_fit();
+    self.merged.clear();
+  }
+}
+
+/// How much selector matching work `StyleSheet::apply` did.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct MatchStats {
+  /// Candidate rules from the index that were matched against an element.
+  pub rules_tested: u32,
+  /// Candidate rules that matched.
+  pub rules_matched: u32,
+}
+
+impl std::ops::AddAssign for MatchStats {
+  fn add_assign(&mut self, other: Self) {
+    self.rules_tested += other.rules_tested;
+    self.rules_matched += other.rules_matched;
   }
 }
 
@@ -102,18 +316,69 @@ impl Default for StyleSheet {
   }
 }
 
-#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
-#[serde(from = "SerdeStyleRule", into = "SerdeStyleRule")]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct StyleRule {
-  pub selectors: ::selectors::SelectorList<selectors::SelectorImpl>,
-  pub properties: Vec<Declaration>,
+  /// The source of the selector list, in the document's string table.
+  pub source: StrRef,
+  /// The parsed selector list.
+  ///
+  /// Parsing selectors is expensive, so rules loaded from a document only parse their
+  /// selectors the first time they are a candidate for an element.
+  #[serde(skip)]
+  selectors: OnceCell<::selectors::SelectorList<selectors::SelectorImpl>>,
+  /// The rule's declarations, see `StyleDelta`.
+  pub delta: StyleDelta,
 }
 
 impl StyleRule {
+  #[must_use]
+  pub fn new(
+    source: StrRef,
+    selectors: ::selectors::SelectorList<selectors::SelectorImpl>,
+    declarations: &[Declaration],
+  ) -> Self {
+    Self {
+      source,
+      selectors: OnceCell::from(selectors),
+      delta: StyleDelta::new(declarations),
+    }
+  }
+
+  /// Returns the selector list, parsing it from `strings` if that hasn't happened yet.
+  pub fn selectors(&self, strings: &StringTable) -> &::selectors::SelectorList<selectors::SelectorImpl> {
+    self.selectors.get_or_init(|| {
+      let mut input = cssparser::ParserInput::new(strings.get(self.source));
+      ::selectors::SelectorList::parse(&selectors::SelectorParser, &mut cssparser::Parser::new(&mut input)).unwrap()
+    })
+  }
+
+  /// An estimate of the memory the parsed selectors take up, `0` if they haven't been parsed.
+  #[must_use]
+  pub fn allocated_bytes(&self) -> usize {
+    let component = std::mem::size_of::<::selectors::parser::Component<selectors::SelectorImpl>>();
+    self.selectors.get().map_or(0, |list| {
+      let spilled = if list.0.spilled() { list.0.capacity() } else { 0 };
+      spilled * std::mem::size_of::<::selectors::parser::Selector<selectors::SelectorImpl>>()
+        + list.0.iter().map(|selector| selector.len() * component).sum::<usize>()
+    })
+  }
+
+  /// Forgets the parsed selectors, `selectors` parses them again from the source.
+  pub fn trim(&mut self) {
+    self.selectors = OnceCell::new();
+  }
+
+  /// Returns the selector list if it has already been parsed.
+  #[must_use]
+  pub fn parsed_selectors(&self) -> Option<&::selectors::SelectorList<selectors::SelectorImpl>> {
+    self.selectors.get()
+  }
+
   pub fn apply<E: ::selectors::Element<Impl = selectors::SelectorImpl>>(
     &self,
     element: &E,
     computed: &mut ComputedStyle,
+    strings: &StringTable,
   ) {
     let mut context = ::selectors::matching::MatchingContext::new(
       ::selectors::matching::MatchingMode::Normal,
@@ -122,38 +387,18 @@ impl StyleRule {
       ::selectors::matching::QuirksMode::NoQuirks,
     );
 
-    if ::selectors::matching::matches_selector_list(&self.selectors, element, &mut context) {
-      self.properties.iter().for_each(|x| x.apply(computed));
+    if self.matches(element, &mut context, strings) {
+      self.delta.apply(computed);
     }
   }
-}
-
-use cssparser::ToCss;
-
-#[derive(Serialize, Deserialize)]
-struct SerdeStyleRule {
-  selectors: String,
-  properties: Vec<Declaration>,
-}
 
-impl From<StyleRule> for SerdeStyleRule {
-  fn from(rule: StyleRule) -> Self {
-    Self {
-      selectors: rule.selectors.to_css_string(),
-      properties: rule.properties,
-    }
-  }
-}
-
-impl From<SerdeStyleRule> for StyleRule {
-  fn from(rule: SerdeStyleRule) -> Self {
-    let mut input = cssparser::ParserInput::new(&rule.selectors);
-    let selectors =
-      ::selectors::SelectorList::parse(&selectors::SelectorParser, &mut cssparser::Parser::new(&mut input)).unwrap();
-    StyleRule {
-      selectors,
-      properties: rule.properties,
-    }
+  pub fn matches<E: ::selectors::Element<Impl = selectors::SelectorImpl>>(
+    &self,
+    element: &E,
+    context: &mut ::selectors::matching::MatchingContext<selectors::SelectorImpl>,
+    strings: &StringTable,
+  ) -> bool {
+    ::selectors::matching::matches_selector_list(self.selectors(strings), element, context)
   }
 }
 
@@ -166,6 +411,7 @@ pub enum Declaration {
   MarginBottom(yoga::Value),
   MarginLeft(yoga::Value),
   MarginRight(yoga::Value),
+  Overflow(Overflow),
 }
 
 impl Declaration {
@@ -178,6 +424,99 @@ impl Declaration {
       Self::MarginBottom(value) => computed.margin_bottom = *value,
       Self::MarginLeft(value) => computed.margin_left = *value,
       Self::MarginRight(value) => computed.margin_right = *value,
+      Self::Overflow(overflow) => computed.overflow = *overflow,
+    }
+  }
+
+  /// Returns the field `apply` sets.
+  #[must_use]
+  pub fn field(&self) -> Fields {
+    match self {
+      Self::Width(..) => Fields::WIDTH,
+      Self::Height(..) => Fields::HEIGHT,
+      Self::BackgroundColor(..) => Fields::BACKGROUND_COLOR,
+      Self::MarginTop(..) => Fields::MARGIN_TOP,
+      Self::MarginBottom(..) => Fields::MARGIN_BOTTOM,
+      Self::MarginLeft(..) => Fields::MARGIN_LEFT,
+      Self::MarginRight(..) => Fields::MARGIN_RIGHT,
+      Self::Overflow(..) => Fields::OVERFLOW,
     }
   }
 }
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+
+  const RED: (u8, u8, u8, u8) = (255, 0, 0, 255);
+  const BLUE: (u8, u8, u8, u8) = (0, 0, 255, 255);
+
+  fn sorted(css: &str) -> (StyleSheet, StringTable) {
+    let mut strings = StringTable::new();
+    let mut stylesheet = StyleSheet::new();
+    stylesheet
+      .parse(&mut StyleSheet::create_parser_input(css), &mut strings)
+      .unwrap();
+    stylesheet.sort_by_specificity(&mut strings);
+    (stylesheet, strings)
+  }
+
+  fn sources<'a>(stylesheet: &StyleSheet, strings: &'a StringTable) -> Vec<&'a str> {
+    stylesheet.rules.iter().map(|rule| strings.get(rule.source)).collect()
+  }
+
+  /// Cascades the rules whose selector is one of `matching` like `apply` does past `MERGE_THRESHOLD`.
+  fn background_color(stylesheet: &StyleSheet, strings: &StringTable, matching: &[&str]) -> (u8, u8, u8, u8) {
+    let rules: Vec<u32> = (0..stylesheet.rules.len() as u32)
+      .filter(|&i| matching.contains(&strings.get(stylesheet.rules[i as usize].source)))
+      .collect();
+    let delta = stylesheet.merged.get_or_merge(&rules, || {
+      let mut delta = StyleDelta::default();
+      for &i in &rules {
+        delta.merge(&stylesheet.rules[i as usize].delta);
+      }
+      delta
+    });
+
+    let mut computed = ComputedStyle::default();
+    delta.apply(&mut computed);
+    computed.background_color
+  }
+
+  #[test]
+  fn sort_keeps_source_order_within_a_specificity() {
+    let (stylesheet, strings) = sorted(".b { width: 1px } #a { width: 2px } .c { width: 3px }");
+    assert_eq!(sources(&stylesheet, &strings), [".b", ".c", "#a"]);
+  }
+
+  #[test]
+  fn sort_splits_lists_with_mixed_specificities() {
+    let (stylesheet, strings) = sorted("#a, .b { background-color: red } .c { background-color: blue }");
+    assert_eq!(sources(&stylesheet, &strings), [".b", ".c", "#a"]);
+    assert_eq!(stylesheet.rules[0].delta, stylesheet.rules[2].delta);
+
+    // Left whole, the list would have sorted after `.c` and `.b.c` would be red.
+    assert_eq!(background_color(&stylesheet, &strings, &[".b", ".c"]), BLUE);
+    assert_eq!(background_color(&stylesheet, &strings, &["#a", ".c"]), RED);
+  }
+
+  #[test]
+  fn sort_rebuilds_the_index() {
+    let (stylesheet, strings) = sorted("#a, .b { width: 1px } .b { width: 2px }");
+    let b = Atom::from("b");
+    let mut candidates = Vec::new();
+    stylesheet.index.candidates(
+      RuleKeys {
+        id: None,
+        classes: &[b],
+        local_name: Atom::from("div"),
+      },
+      &mut candidates,
+    );
+    let candidates: Vec<_> = candidates
+      .iter()
+      .map(|&i| strings.get(stylesheet.rules[i as usize].source))
+      .collect();
+    assert_eq!(candidates, [".b", ".b"]);
+  }
+}
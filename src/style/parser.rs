@@ -1,6 +1,8 @@
+use cssparser::ToCss;
+
 use crate::{
   selectors::{SelectorImpl, SelectorParser},
-  Declaration, StyleRule,
+  Declaration, StringTable, StyleRule,
 };
 
 fn parse_yoga_value<'i, 't>(
@@ -47,6 +49,17 @@ impl Declaration {
       "margin-left" => Ok(Self::MarginLeft(parse_yoga_value(input)?)),
       "margin-right" => Ok(Self::MarginRight(parse_yoga_value(input)?)),
 
+      "overflow" => {
+        let start_location = input.current_source_location();
+        let ident = input.expect_ident()?.clone();
+        cssparser::match_ignore_ascii_case! { &ident,
+          "visible" => Ok(Self::Overflow(crate::Overflow::Visible)),
+          "hidden" => Ok(Self::Overflow(crate::Overflow::Hidden)),
+          "scroll" => Ok(Self::Overflow(crate::Overflow::Scroll)),
+          _ => Err(start_location.new_basic_unexpected_token_error(cssparser::Token::Ident(ident))),
+        }
+      }
+
       _ => Err(cssparser::BasicParseError {
         kind: cssparser::BasicParseErrorKind::QualifiedRuleInvalid,
         location: input.current_source_location(),
@@ -77,9 +90,11 @@ impl<'i> cssparser::AtRuleParser<'i> for DeclarationParser {
   type Error = selectors::parser::SelectorParseErrorKind<'i>;
 }
 
-pub struct QualifiedRuleParser;
+pub struct QualifiedRuleParser<'a> {
+  pub strings: &'a mut StringTable,
+}
 
-impl<'i> cssparser::QualifiedRuleParser<'i> for QualifiedRuleParser {
+impl<'i> cssparser::QualifiedRuleParser<'i> for QualifiedRuleParser<'_> {
   type Prelude = selectors::SelectorList<SelectorImpl>;
   type QualifiedRule = StyleRule;
   type Error = selectors::parser::SelectorParseErrorKind<'i>;
@@ -104,14 +119,12 @@ impl<'i> cssparser::QualifiedRuleParser<'i> for QualifiedRuleParser {
       declarations.push(decl);
     }
 
-    Ok(StyleRule {
-      selectors: prelude,
-      properties: declarations,
-    })
+    let source = self.strings.push(&prelude.to_css_string());
+    Ok(StyleRule::new(source, prelude, &declarations))
   }
 }
 
-impl<'i> cssparser::AtRuleParser<'i> for QualifiedRuleParser {
+impl<'i> cssparser::AtRuleParser<'i> for QualifiedRuleParser<'_> {
   type PreludeNoBlock = ();
   type PreludeBlock = ();
   type AtRule = StyleRule;
@@ -1,3 +1,5 @@
+use crate::Atom;
+
 #[derive(Debug, Clone)]
 pub struct SelectorParser;
 
@@ -11,14 +13,14 @@ pub struct SelectorImpl;
 
 impl selectors::SelectorImpl for SelectorImpl {
   type AttrValue = String;
-  type Identifier = String;
-  type ClassName = String;
-  type LocalName = String;
+  type Identifier = Atom;
+  type ClassName = Atom;
+  type LocalName = Atom;
   type PartName = String;
   type NamespacePrefix = String;
   type NamespaceUrl = String;
   type BorrowedNamespaceUrl = str;
-  type BorrowedLocalName = str;
+  type BorrowedLocalName = Atom;
 
   type NonTSPseudoClass = PseudoClass;
   type PseudoElement = PseudoElement;
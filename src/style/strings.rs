@@ -0,0 +1,162 @@
+use std::{
+  collections::{hash_map::DefaultHasher, HashMap},
+  hash::{Hash, Hasher},
+  ops::Range,
+  sync::Arc,
+};
+
+use serde::{Deserialize, Serialize};
+
+/// A string stored in a `StringTable`, as a byte range into the table.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub struct StrRef {
+  offset: u32,
+  len: u32,
+}
+
+impl StrRef {
+  #[must_use]
+  pub fn len(self) -> usize {
+    self.len as usize
+  }
+
+  #[must_use]
+  pub fn is_empty(self) -> bool {
+    self.len == 0
+  }
+
+  /// Turns a reference into a table that was appended to another table (where it became `base`)
+  /// into a reference into that other table.
+  #[must_use]
+  pub fn rebase(self, base: StrRef) -> StrRef {
+    StrRef {
+      offset: base.offset + self.offset,
+      len: self.len,
+    }
+  }
+}
+
+/// The bytes backing a `StringTable` that was loaded from a document.
+pub type SharedBytes = Arc<dyn AsRef<[u8]> + Send + Sync>;
+
+#[derive(Clone)]
+enum Backing {
+  Owned(String),
+  Shared { bytes: SharedBytes, range: Range<usize> },
+}
+
+/// All of the strings of a document, stored back to back.
+///
+/// Documents that were loaded from memory (an mmapped file or `include_bytes!`) read
+/// their strings in place, so loading doesn't allocate a `String` per attribute or selector.
+#[derive(Clone)]
+pub struct StringTable {
+  backing: Backing,
+  /// The strings added through `intern`, by their hash.
+  interned: HashMap<u64, StrRef>,
+}
+
+impl StringTable {
+  #[must_use]
+  pub fn new() -> Self {
+    Self {
+      backing: Backing::Owned(String::new()),
+      interned: HashMap::new(),
+    }
+  }
+
+  /// Creates a table that reads its strings from `range` of `bytes`.
+  ///
+  /// The range is validated to be UTF-8 once here, so lookups don't have to.
+  pub fn from_shared(bytes: SharedBytes, range: Range<usize>) -> Result<Self, std::str::Utf8Error> {
+    std::str::from_utf8(&(*bytes).as_ref()[range.clone()])?;
+    Ok(Self {
+      backing: Backing::Shared { bytes, range },
+      interned: HashMap::new(),
+    })
+  }
+
+  #[must_use]
+  pub fn as_str(&self) -> &str {
+    match &self.backing {
+      Backing::Owned(s) => s,
+      // The range was validated in `from_shared`.
+      Backing::Shared { bytes, range } => unsafe { std::str::from_utf8_unchecked(&(**bytes).as_ref()[range.clone()]) },
+    }
+  }
+
+  /// Returns true if the strings are read in place from the bytes the table was created from.
+  #[must_use]
+  pub fn is_shared(&self) -> bool {
+    matches!(self.backing, Backing::Shared { .. })
+  }
+
+  /// The memory the table allocated, in bytes. Shared tables haven't allocated any.
+  #[must_use]
+  pub fn allocated_bytes(&self) -> usize {
+    let interned = self.interned.capacity() * std::mem::size_of::<(u64, StrRef)>();
+    match &self.backing {
+      Backing::Owned(s) => s.capacity() + interned,
+      Backing::Shared { .. } => interned,
+    }
+  }
+
+  #[must_use]
+  pub fn get(&self, s: StrRef) -> &str {
+    let start = s.offset as usize;
+    &self.as_str()[start..start + s.len as usize]
+  }
+
+  /// Appends `s` to the table.
+  ///
+  /// Tables that read from shared memory are copied the first time they are appended to.
+  pub fn push(&mut self, s: &str) -> StrRef {
+    if let Backing::Shared { .. } = self.backing {
+      self.backing = Backing::Owned(self.as_str().to_string());
+    }
+
+    match &mut self.backing {
+      Backing::Owned(table) => {
+        let offset = table.len() as u32;
+        table.push_str(s);
+        StrRef {
+          offset,
+          len: s.len() as u32,
+        }
+      }
+
+      Backing::Shared { .. } => unreachable!(),
+    }
+  }
+
+  /// Like `push`, but returns the earlier reference if the same string was interned before,
+  /// so values that are set over and over only take up space once.
+  pub fn intern(&mut self, s: &str) -> StrRef {
+    let mut hasher = DefaultHasher::new();
+    s.hash(&mut hasher);
+    let hash = hasher.finish();
+
+    match self.interned.get(&hash) {
+      Some(&existing) if self.get(existing) == s => existing,
+      _ => {
+        let new = self.push(s);
+        self.interned.insert(hash, new);
+        new
+      }
+    }
+  }
+}
+
+impl Default for StringTable {
+  fn default() -> Self {
+    Self::new()
+  }
+}
+
+impl std::fmt::Debug for StringTable {
+  fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+    f.debug_struct("StringTable")
+      .field("len", &self.as_str().len())
+      .finish()
+  }
+}
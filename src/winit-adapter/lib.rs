@@ -49,6 +49,8 @@ impl<T: Send + Sync + 'static> RenderNotifier for Notifier<T> {
 pub struct Window {
   window_id: WindowId,
   event_handler: event::EventHandler<InternalWindow>,
+  /// Events since the last `RedrawEventsCleared`, handled in one batch so they share a frame.
+  pending: Vec<event::Event>,
 }
 
 impl Window {
@@ -98,11 +100,13 @@ impl Window {
       device_pixel_ratio,
       device_size,
       Box::new(Notifier::new(window_id, ep)),
+      &render::RendererOptions::default(),
     );
 
     Self {
       window_id,
       event_handler: event::EventHandler::new(windowing_impl, renderer, doc),
+      pending: Vec::new(),
     }
   }
 
@@ -124,14 +128,25 @@ impl Window {
             event::Event::ScaleFactorChanged(*scale_factor as f32)
           }
 
-          glutin::event::WindowEvent::AxisMotion { .. } | glutin::event::WindowEvent::CursorMoved { .. } => {
+          glutin::event::WindowEvent::CursorMoved { position, .. } => {
+            event::Event::PointerMoved(render::DevicePoint::new(position.x as f32, position.y as f32))
+          }
+
+          glutin::event::WindowEvent::CursorLeft { .. } => event::Event::PointerLeft,
+
+          glutin::event::WindowEvent::MouseInput { state, .. } => match state {
+            glutin::event::ElementState::Pressed => event::Event::PointerDown,
+            glutin::event::ElementState::Released => event::Event::PointerUp,
+          },
+
+          glutin::event::WindowEvent::AxisMotion { .. } => {
             return;
           }
 
           _ => event::Event::Empty,
         };
 
-        self.event_handler.handle_event(event);
+        self.pending.push(event);
       }
 
       glutin::event::Event::RedrawRequested(window_id) => {
@@ -139,17 +154,30 @@ impl Window {
           return;
         }
 
-        self.event_handler.handle_event(event::Event::Redraw);
+        self.pending.push(event::Event::Redraw);
       }
 
       glutin::event::Event::UserEvent(_) => {
-        self.event_handler.handle_event(event::Event::Empty);
+        self.pending.push(event::Event::Empty);
+      }
+
+      // The last event of every loop iteration.
+      glutin::event::Event::RedrawEventsCleared => {
+        if !self.pending.is_empty() {
+          self.event_handler.handle_events(self.pending.drain(..));
+        }
       }
 
       _ => {}
     };
   }
 
+  /// Shows `doc` instead of the current document, see `event::EventHandler::set_document`.
+  pub fn set_document(&mut self, doc: Arc<CompiledDocument>) {
+    self.event_handler.set_document(doc);
+    self.window().request_redraw();
+  }
+
   pub fn deinit(self) {
     self.event_handler.deinit();
   }
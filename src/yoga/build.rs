@@ -21,6 +21,7 @@ impl bindgen::callbacks::ParseCallbacks for BindgenCallbacks {
 
 fn main() {
   println!("cargo:rerun-if-changed=yoga/yoga/Yoga.h");
+  println!("cargo:rerun-if-changed=memory.cpp");
 
   cc::Build::new()
     .file("yoga/yoga/event/event.cpp")
@@ -35,6 +36,7 @@ fn main() {
     .file("yoga/yoga/YGStyle.cpp")
     .file("yoga/yoga/YGValue.cpp")
     .file("yoga/yoga/Yoga.cpp")
+    .file("memory.cpp")
     .flag_if_supported("-fno-omit-frame-pointer")
     .flag_if_supported("-fexceptions")
     .flag_if_supported("-fvisibility=hidden")
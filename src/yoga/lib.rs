@@ -10,7 +10,7 @@ pub mod sys {
 }
 
 use serde::{Deserialize, Serialize};
-use std::{ffi::CStr, fmt, ops::Deref};
+use std::{ffi::CStr, fmt, ops::Deref, ptr, sync::Mutex};
 
 #[allow(clippy::useless_attribute)]
 #[allow(clippy::wildcard_imports)]
@@ -77,12 +77,99 @@ pub struct Node {
   inner: YGNodeRef,
 }
 
+extern "C" {
+  /// Defined in `memory.cpp`.
+  fn FrameUiYGNodeAllocatedBytes(node: YGNodeRef) -> usize;
+}
+
+/// Nodes given back through `Node::release`, `Node::alloc` hands them out again.
+static POOL: Mutex<Vec<Node>> = Mutex::new(Vec::new());
+
+/// The most nodes `POOL` keeps, the ones released beyond that are freed.
+const MAX_POOLED_NODES: usize = 1 << 16;
+
 impl Node {
   #[must_use]
   pub unsafe fn new() -> Self {
     Self { inner: YGNodeNew() }
   }
 
+  /// A placeholder for a node that hasn't been allocated yet, it must not be passed to yoga.
+  #[must_use]
+  pub const fn null() -> Self {
+    Self { inner: ptr::null_mut() }
+  }
+
+  #[must_use]
+  pub fn is_null(&self) -> bool {
+    self.inner.is_null()
+  }
+
+  /// Moves the node out, leaving a null node behind.
+  #[must_use]
+  pub fn take(&mut self) -> Self {
+    std::mem::replace(self, Self::null())
+  }
+
+  /// Returns `count` nodes with the default style, reusing released nodes before allocating new ones.
+  ///
+  /// Takes the pool's lock once, however many nodes are needed.
+  #[must_use]
+  pub unsafe fn alloc(count: usize) -> Vec<Self> {
+    let mut nodes = {
+      let mut pool = POOL.lock().unwrap();
+      let reused = pool.len().saturating_sub(count);
+      pool.split_off(reused)
+    };
+
+    nodes.reserve_exact(count - nodes.len());
+    while nodes.len() < count {
+      nodes.push(Self::new());
+    }
+    nodes
+  }
+
+  /// Gives `nodes` back to the pool, detaching them from each other first.
+  ///
+  /// Every node that is attached to one of `nodes` (as a parent or a child) must be released
+  /// along with it. Null nodes are skipped.
+  pub unsafe fn release<I: IntoIterator<Item = Self>>(nodes: I) {
+    let mut nodes: Vec<Self> = nodes.into_iter().filter(|node| !node.is_null()).collect();
+    for node in &nodes {
+      node.remove_all_children();
+    }
+    for node in &nodes {
+      YGNodeReset(**node);
+    }
+
+    let mut pool = POOL.lock().unwrap();
+    let kept = nodes.len().min(MAX_POOLED_NODES.saturating_sub(pool.len()));
+    for mut node in nodes.drain(kept..) {
+      node.free();
+    }
+    pool.append(&mut nodes);
+  }
+
+  /// Returns how many released nodes the pool is holding on to.
+  #[must_use]
+  pub fn pooled() -> usize {
+    POOL.lock().unwrap().len()
+  }
+
+  /// Frees every node in the pool, for processes that won't create more documents for a while.
+  pub unsafe fn trim_pool() {
+    let nodes = std::mem::take(&mut *POOL.lock().unwrap());
+    for mut node in nodes {
+      node.free();
+    }
+  }
+
+  /// The memory yoga allocated for this node, including the list of its children.
+  #[must_use]
+  pub unsafe fn allocated_bytes(&self) -> usize {
+    FrameUiYGNodeAllocatedBytes(**self)
+  }
+
   pub unsafe fn free(&mut self) {
     YGNodeFree(**self)
   }
@@ -112,6 +199,19 @@ impl Node {
     YGNodeInsertChild(**self, child, index);
   }
 
+  pub unsafe fn remove_child(&self, child: YGNodeRef) {
+    YGNodeRemoveChild(**self, child);
+  }
+
+  pub unsafe fn remove_all_children(&self) {
+    YGNodeRemoveAllChildren(**self);
+  }
+
+  /// Replaces the children of this node with `children`, in one call instead of one insert per child.
+  pub unsafe fn set_children(&self, children: &[YGNodeRef]) {
+    YGNodeSetChildren(**self, children.as_ptr(), children.len() as u32);
+  }
+
   pub unsafe fn set_width(&mut self, width: Value) {
     match width {
       Value::Px(v) => YGNodeStyleSetWidth(**self, v),
@@ -156,6 +256,10 @@ impl Node {
     YGNodeStyleSetDisplay(**self, display);
   }
 
+  pub unsafe fn set_overflow(&mut self, overflow: Overflow) {
+    YGNodeStyleSetOverflow(**self, overflow);
+  }
+
   pub unsafe fn set_justify_content(&mut self, justify_content: Justify) {
     YGNodeStyleSetJustifyContent(**self, justify_content);
   }
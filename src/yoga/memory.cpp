@@ -0,0 +1,6 @@
+// Yoga.h keeps `YGNode` opaque, this is the one place that looks inside of it.
+#include <yoga/YGNode.h>
+
+extern "C" size_t FrameUiYGNodeAllocatedBytes(YGNodeRef node) {
+  return sizeof(YGNode) + node->getChildren().capacity() * sizeof(YGNodeRef);
+}
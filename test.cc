@@ -1,7 +1,9 @@
+#define MODULE_DOM
 #define MODULE_EVENT
 #define MODULE_RENDER
 
 #include <iostream>
+#include <vector>
 #include "project-a.h"
 #include <GLFW/glfw3.h>
 
@@ -21,37 +23,54 @@ void make_not_current(void *user) {
   glfwMakeContextCurrent(nullptr);
 }
 
+// Events from the callbacks, handled together after every glfwWaitEvents.
+std::vector<Event> pending;
+
 void window_size_callback(GLFWwindow* window, int width, int height) {
-  EventHandler *event_handler = (EventHandler *)glfwGetWindowUserPointer(window);
-  EventHandler_handle_resize(event_handler, DeviceSize { width, height });
+  Event event = {};
+  event.tag = Resized;
+  event.resized.size = DeviceSize { width, height };
+  pending.push_back(event);
 }
 
 void window_content_scale_callback(GLFWwindow* window, float xscale, float yscale) {
-  EventHandler *event_handler = (EventHandler *)glfwGetWindowUserPointer(window);
-  EventHandler_handle_scale_factor_change(event_handler, xscale);
+  Event event = {};
+  event.tag = ScaleFactorChanged;
+  event.scale_factor_changed.scale = xscale;
+  pending.push_back(event);
 }
 
 void window_refresh_callback(GLFWwindow* window) {
-  EventHandler *event_handler = (EventHandler *)glfwGetWindowUserPointer(window);
-  EventHandler_handle_redraw(event_handler);
+  Event event = {};
+  event.tag = Redraw;
+  pending.push_back(event);
 }
 
-int main() {
+int main(int argc, char **argv) {
   // std::cout << "foo" << std::endl;
   GLFWwindow* window;
 
+  // Compiled from file.frame by the compiler.
+  const char *path = argc > 1 ? argv[1] : "file.cframe";
+  const CompiledDocument *doc = CompiledDocument_load_mmap(path);
+  if (!doc) {
+    std::cerr << "couldn't load " << path << std::endl;
+    return -1;
+  }
+
   /* Initialize the library */
   if (!glfwInit()) return -1;
 
   /* Create a windowed mode window and its OpenGL context */
   window = glfwCreateWindow(640, 480, "Hello World", NULL, NULL);
   if (!window) {
+    CompiledDocument_drop(doc);
     glfwTerminate();
     return -1;
   }
 
   glfwMakeContextCurrent(window);
-  Gl *gl = load_gl(get_proc_address);
+  Gl *gl = Gl_load_gl(get_proc_address);
 
   int width, height;
   glfwGetWindowSize(window, &width, &height);
@@ -59,8 +78,10 @@ int main() {
   float xscale, yscale;
   glfwGetWindowContentScale(window, &xscale, &yscale);
 
-  Renderer *renderer = renderer_new(gl, xscale, DeviceSize { width, height });
-  EventHandler *event_handler = EventHandler_new(renderer, swap_buffers, make_current, make_not_current, (void *)window);
+  Renderer *renderer = Renderer_new(gl, xscale, DeviceSize { width, height }, NULL);
+  // Takes over the renderer and the reference to doc.
+  EventHandler *event_handler = EventHandler_new(renderer, doc, false, swap_buffers, make_current,
+                                                 make_not_current, (void *)window);
 
   glfwSetWindowUserPointer(window, (void *)event_handler);
 
@@ -69,7 +90,11 @@ int main() {
   glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
   while (!glfwWindowShouldClose(window)) {
-    EventHandler_handle_empty(event_handler);
+    Event empty = {};
+    empty.tag = Empty;
+    pending.push_back(empty);
+    EventHandler_handle_events(event_handler, pending.data(), pending.size());
+    pending.clear();
     /* Render here */
     // glClear(GL_COLOR_BUFFER_BIT);
 
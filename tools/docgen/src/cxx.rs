@@ -58,24 +58,13 @@ impl Struct<'_> {
     methods.sort_by_key(|(_, x)| x.get_index());
     let methods = methods.iter().map(|(_, x)| x.to_cxx()).collect::<Vec<_>>().join("\n");
 
+    // `detail::Handle` frees the pointer and makes the class move-only.
     format!(
       "
-      class {} {{
+      class {0} : public detail::Handle<c_api::{0}, c_api::{0}_drop> {{
         public:
-          {}
-
-          c_api::{0} *GetInternalPointer() {{
-            return self;
-          }}
-
-          c_api::{0} *TakeInternalPointer() {{
-            c_api::{0} *out = self;
-            self = nullptr;
-            return out;
-          }}
-
-        private:
-          c_api::{0} *self = nullptr;
+          using Handle::Handle;
+          {1}
       }};
     ",
       self.name, methods
@@ -127,33 +116,35 @@ impl Method<'_> {
     match kind {
       MethodKind::Constructor => format!(
         "
-          {struct_name}({args}) {{
-            self = c_api::{c_name}({c_args});
-          }}",
+          {struct_name}({args}) : Handle(c_api::{c_name}({c_args})) {{}}",
         struct_name = struct_name,
         args = args,
         c_name = c_name,
         c_args = c_args,
       ),
 
-      MethodKind::Destructor => format!(
+      // The handle's destructor calls it.
+      MethodKind::Destructor => String::new(),
+
+      // There is no `self` to check.
+      MethodKind::StaticMethod => format!(
         "
-          ~{struct_name}() {{
-            if (self) {{
-              c_api::{c_name}(self);
-            }}
+          static {ret} {name}({args}) {{
+            return c_api::{c_name}({c_args});
           }}",
-        struct_name = struct_name,
+        ret = return_type,
+        name = name,
+        args = args,
         c_name = c_name,
+        c_args = c_args,
       ),
 
-      _ => format!(
+      MethodKind::Method => format!(
         "
-          {static_keyword} {ret} {name}({args}) {{
+          {ret} {name}({args}) {{
             assert(self != nullptr);
             return c_api::{c_name}({c_args});
           }}",
-        static_keyword = if kind == MethodKind::StaticMethod { "static" } else { "" },
         ret = return_type,
         name = name,
         args = args,